@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <string_view>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "demo.h"
+
+// Simulated syscalls from a second thread and a forked child. Both inherit
+// the seccomp filter, so they only work if the runner traces them too.
+
+int to_main[2];
+int to_thread[2];
+
+// Records that the thread and main write to one pipe at the same time. Each
+// fits in PIPE_BUF, so none may be split, and all of them fit in the pipe.
+constexpr std::size_t record_size = 64;
+constexpr int records = 500;
+
+void expect_read(int fd, std::string_view expected) {
+  char buf[64] = {};
+  auto n = read(fd, buf, sizeof(buf));
+  check_return_value(n);
+  if (std::string_view{buf, static_cast<std::size_t>(n)} != expected) {
+    fprintf(stderr, "read '%.*s', expected '%.*s'\n", static_cast<int>(n),
+            buf, static_cast<int>(expected.size()), expected.data());
+    _exit(1);
+  }
+}
+
+void *thread_main(void *) {
+  check_return_value(write(to_main[1], "thread", 6));
+  // Blocks until main writes, while main keeps making syscalls
+  expect_read(to_thread[0], "main");
+  return nullptr;
+}
+
+void write_records(char tag) {
+  char record[record_size];
+  memset(record, tag, sizeof(record));
+  for (int i = 0; i < records; ++i) {
+    check_return_value(write(to_main[1], record, sizeof(record)));
+  }
+}
+
+void *thread_records(void *) {
+  write_records('t');
+  return nullptr;
+}
+
+void *wait_for_eof(void *) {
+  // Still blocked in read when main closes the write end
+  expect_read(to_thread[0], "");
+  return nullptr;
+}
+
+int main(int argc, char **argv) {
+  check_return_value(pipe(to_main));
+  check_return_value(pipe(to_thread));
+
+  pthread_t thread;
+  check_return_value(-pthread_create(&thread, nullptr, thread_main, nullptr));
+  expect_read(to_main[0], "thread");
+  usleep(10000);
+  check_return_value(write(to_thread[1], "main", 4));
+  check_return_value(-pthread_join(thread, nullptr));
+
+  check_return_value(
+      -pthread_create(&thread, nullptr, thread_records, nullptr));
+  write_records('m');
+  check_return_value(-pthread_join(thread, nullptr));
+  int counts[2] = {};
+  for (int i = 0; i < 2 * records; ++i) {
+    char record[record_size];
+    check_return_value(read(to_main[0], record, sizeof(record)));
+    if (memchr(record, record[0] == 't' ? 'm' : 't', sizeof(record))) {
+      fprintf(stderr, "interleaved record\n");
+      return 1;
+    }
+    counts[record[0] == 't']++;
+  }
+  if (counts[0] != records || counts[1] != records) {
+    fprintf(stderr, "got %d and %d records\n", counts[0], counts[1]);
+    return 1;
+  }
+
+  check_return_value(-pthread_create(&thread, nullptr, wait_for_eof, nullptr));
+  usleep(10000);
+  check_return_value(close(to_thread[1]));
+  check_return_value(-pthread_join(thread, nullptr));
+
+  pid_t pid = fork();
+  check_return_value(pid);
+  if (pid == 0) {
+    // Closes the child's copy only
+    check_return_value(close(to_main[0]));
+    usleep(10000);
+    check_return_value(write(to_main[1], "child", 5));
+    _exit(0);
+  }
+
+  // Blocks until the child writes, and sees the end of the pipe once both
+  // write ends are closed
+  check_return_value(close(to_main[1]));
+  expect_read(to_main[0], "child");
+  expect_read(to_main[0], "");
+
+  int status;
+  check_return_value(waitpid(pid, &status, 0));
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "child failed with status %d\n", status);
+    return 1;
+  }
+
+  printf("thread and child done\n");
+  return 0;
+}
@@ -1,31 +1,33 @@
+import shutil
 import subprocess
-import hashlib
 import time
+from pathlib import Path
 
 RUNS = 100
-args = ["./build/redstone", "demo_repro3.toml"]
-
-sha = None
-
-runs = []
+CONFIG = "demo_repro3.toml"
+# Must match [output] path in the config
+OUTPUT = Path("output")
+args = ["./build/redstone", CONFIG]
 
+digests = None
 
+Path("runs").mkdir(exist_ok=True)
 
 for i in range(RUNS):
-    result = subprocess.run(args, stdout=subprocess.PIPE)
+    result = subprocess.run(args)
     result.check_returncode()
 
     print("finished run!")
 
-    runs.append(result.stdout)
-
-    with open(f"runs/run{i}.txt", "wb") as f:
-        _ = f.write(result.stdout)
-
-    iter_sha = hashlib.sha256(result.stdout).digest()
-    if sha is None:
-        sha = iter_sha
-    if sha != iter_sha:
-        print(sha, iter_sha)
-        print("run had different sha")
+    # One line per captured stream, hashed by redstone as it was written
+    iter_digests = (OUTPUT / "digests").read_text()
+
+    # Keep the logs of the first run, and of any that differ from it
+    if digests is None:
+        digests = iter_digests
+        shutil.copytree(OUTPUT, f"runs/run{i}", dirs_exist_ok=True)
+    elif digests != iter_digests:
+        print(digests, iter_digests)
+        print("run had different output")
+        shutil.copytree(OUTPUT, f"runs/run{i}", dirs_exist_ok=True)
     time.sleep(1)
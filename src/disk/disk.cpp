@@ -1,144 +1,391 @@
 #include "disk/disk.hpp"
+#include "sim/scratch.hpp"
 
+#include <fcntl.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <limits>
+#include <memory_resource>
 #include <mutex>
+#include <shared_mutex>
 #include <vector>
 
 namespace redstone::disk {
 constexpr auto max_file_size =
     static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
 
+// Reads and writes move through the scratch arena this much at a time
+constexpr std::size_t transfer_chunk = 64 * 1024;
+
 // disk_file functions
 
-int64_t disk_file::write(std::uint64_t pos, std::span<const std::byte> buf) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (pos < 0 || max_file_size <= pos)
-    return -EINVAL; // Invalid arg
+int64_t disk_file::write(std::uint64_t pos, std::span<const std::byte> buf,
+                         bool sync) {
+  std::unique_lock lock{mutex_};
+  if (max_file_size <= pos || max_file_size - pos < buf.size_bytes())
+    return -EFBIG;
 
-  // Expand buffer if more space is needed
-  if (pos + buf.size_bytes() > buffer_.size()) {
-    // Calculate the new size needed
-    size_t newSize = pos + buf.size_bytes();
+  std::size_t done = 0;
+  while (done < buf.size_bytes()) {
+    const auto at = pos + done;
+    const auto offset = at % page_size;
+    const auto n = std::min(page_size - offset, buf.size_bytes() - done);
 
-    // Resize the buffer
-    buffer_.resize(newSize);
+    const auto index = at / page_size;
+    auto it = pages_.lower_bound(index);
+    if (it == pages_.end() || it->first != index) {
+      // New pages start out zeroed, like the hole they replace. Allocating
+      // before inserting leaves no null page behind if either throws.
+      it = pages_.emplace_hint(it, index, std::make_unique<page>());
+    }
+    std::memcpy(it->second->data() + offset, buf.data() + done, n);
+    done += n;
   }
-  // Copy the data from 'buf' into 'buffer_' at the specified position 'pos'
-  std::copy(buf.begin(), buf.end(), buffer_.begin() + pos);
 
-  // Return the number of bytes written (which is the size of 'buf')
-  return buf.size_bytes();
+  size_ = std::max(size_, pos + done);
+
+  if (!sync && done != 0) {
+    // Merge with the ranges it overlaps or touches
+    auto start = pos;
+    auto end = pos + done;
+    auto it = unsynced_.upper_bound(start);
+    if (it != unsynced_.begin() && start <= std::prev(it)->second) {
+      --it;
+      start = it->first;
+    }
+    while (it != unsynced_.end() && it->first <= end) {
+      end = std::max(end, it->second);
+      it = unsynced_.erase(it);
+    }
+    unsynced_.emplace(start, end);
+  }
+  return done;
+}
+
+void disk_file::sync() {
+  std::unique_lock lock{mutex_};
+  unsynced_.clear();
 }
 
 int64_t disk_file::read(std::uint64_t pos, std::span<std::byte> buf) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::shared_lock lock{mutex_};
+
+  if (pos >= size_)
+    return 0; // End of file
+
+  const auto bytes =
+      std::min(static_cast<std::uint64_t>(buf.size()), size_ - pos);
+  auto it = pages_.lower_bound(pos / page_size);
+  std::size_t done = 0;
+  while (done < bytes) {
+    const auto at = pos + done;
+    const auto offset = at % page_size;
+    const auto n = std::min(page_size - offset, bytes - done);
 
-  // Calculate the number of bytes available to read starting from 'pos'
-  size_t availableBytes = buffer_.size() - pos;
+    if (it != pages_.end() && it->first == at / page_size) {
+      std::memcpy(buf.data() + done, it->second->data() + offset, n);
+      ++it;
+    } else {
+      std::memset(buf.data() + done, 0, n);
+    }
+    done += n;
+  }
+  return done;
+}
 
-  if (pos < 0 || pos >= buffer_.size())
-    return -EINVAL; // Invalid arg
+int disk_file::truncate(std::uint64_t size) {
+  std::unique_lock lock{mutex_};
+  if (max_file_size < size)
+    return -EFBIG;
 
-  // Copy the data from 'buffer_' into 'buf' starting at the specified position
-  // 'pos'
-  size_t num_elements_to_copy =
-      std::min(static_cast<std::uint64_t>(buf.size()), buffer_.size() - pos);
+  if (size < size_) {
+    const auto first = size / page_size;
+    const auto offset = size % page_size;
+    pages_.erase(pages_.lower_bound(offset == 0 ? first : first + 1),
+                 pages_.end());
+    if (auto it = pages_.find(first); offset != 0 && it != pages_.end()) {
+      std::memset(it->second->data() + offset, 0, page_size - offset);
+    }
 
-  // Perform the copy
-  std::copy_n(buffer_.begin() + pos, num_elements_to_copy, buf.begin());
+    // Nothing past the new end is left to lose
+    unsynced_.erase(unsynced_.lower_bound(size), unsynced_.end());
+    if (!unsynced_.empty() && size < unsynced_.rbegin()->second) {
+      unsynced_.rbegin()->second = size;
+    }
+  }
+  size_ = size;
+  return 0;
+}
 
-  // Return the number of bytes read
-  return num_elements_to_copy;
+size_t disk_file::get_size() {
+  std::shared_lock lock{mutex_};
+  return size_;
 }
 
-size_t disk_file::get_size() { return buffer_.size(); }
+void disk_file::stat(struct stat &st) {
+  std::shared_lock lock{mutex_};
+  st = {};
+  st.st_ino = ino_;
+  st.st_mode = S_IFREG | mode_;
+  st.st_nlink = linked() ? 1 : 0;
+  st.st_size = static_cast<off_t>(size_);
+  st.st_blksize = page_size;
+  st.st_blocks = static_cast<blkcnt_t>(pages_.size() * (page_size / 512));
+}
+
+int64_t disk_file::seek_data(std::uint64_t pos, bool hole) {
+  std::shared_lock lock{mutex_};
+  if (size_ <= pos) {
+    return -ENXIO;
+  }
+
+  auto index = pos / page_size;
+  auto it = pages_.lower_bound(index);
+  if (!hole) {
+    if (it == pages_.end()) {
+      return -ENXIO;
+    }
+    return std::max(pos, it->first * page_size);
+  }
+
+  while (it != pages_.end() && it->first == index) {
+    ++it;
+    ++index;
+  }
+  return std::min(std::max(pos, index * page_size), size_);
+}
 
 // open_file functions
 
-int64_t open_file::write(std::span<const std::byte> buf) {
+open_file::open_file(std::shared_ptr<disk_file> disk, int flags)
+    : file_descriptor{sim::fd_kind::file}, disk_{std::move(disk)},
+      direct_{(flags & (O_DIRECT | O_SYNC | O_DSYNC)) != 0} {
+  set_status_flags(flags & (O_ACCMODE | O_APPEND | O_NONBLOCK | O_DIRECT |
+                            O_SYNC | O_DSYNC));
+}
+
+bool open_file::readable() const {
+  return (status_flags() & O_ACCMODE) != O_WRONLY;
+}
+
+bool open_file::writable() const {
+  return (status_flags() & O_ACCMODE) != O_RDONLY;
+}
+
+std::int64_t
+open_file::write(tl::function_ref<int(std::span<std::byte>)> load,
+                 std::size_t bytes) {
   std::lock_guard<std::mutex> lock(mutex_);
-  int64_t result = pwrite_unlocked(buf, pos_);
+  if (!writable()) {
+    return -EBADF;
+  }
+
+  auto pos = offset();
+  if ((status_flags() & O_APPEND) != 0) {
+    pos = disk_->get_size();
+  }
+
+  int64_t result = pwrite_unlocked(load, bytes, pos);
   if (result < 0) {
     return result;
   }
-  pos_ += static_cast<size_t>(result);
+  set_offset(pos + static_cast<size_t>(result));
   return result;
 }
 
-int64_t open_file::read(std::span<std::byte> buf) {
+std::int64_t
+open_file::read(tl::function_ref<int(std::span<const std::byte>)> store,
+                std::size_t bytes) {
   std::lock_guard<std::mutex> lock(mutex_);
-  int64_t result = pread_unlocked(buf, pos_);
+  if (!readable()) {
+    return -EBADF;
+  }
+
+  int64_t result = pread_unlocked(store, bytes, offset());
   if (result < 0) {
     return result;
   }
-  pos_ += static_cast<size_t>(result);
+  set_offset(offset() + static_cast<size_t>(result));
   return result;
 }
 
-int64_t open_file::pwrite_unlocked(std::span<const std::byte> buf,
-                                   size_t offset) {
-  if (direct_) {
-    size_t bytes_written = disk_->write(offset, buf);
-    return static_cast<int64_t>(bytes_written);
-  } else {
-    write_backlog_.push_back({{buf.begin(), buf.end()}, offset});
-    return buf.size();
+int64_t open_file::pwrite_unlocked(
+    tl::function_ref<int(std::span<std::byte>)> load, std::size_t bytes,
+    std::uint64_t offset) {
+  if (max_file_size <= offset || max_file_size - offset < bytes) {
+    return -EFBIG;
   }
+
+  std::pmr::vector<std::byte> chunk{&sim::scratch()};
+  std::size_t done = 0;
+  while (done < bytes) {
+    const auto n = std::min(bytes - done, transfer_chunk);
+    chunk.resize(n);
+    if (auto res = load(chunk); res < 0) {
+      return done == 0 ? res : done;
+    }
+
+    if (auto res = disk_->write(offset + done, chunk, direct_); res < 0) {
+      return done == 0 ? res : done;
+    }
+    done += n;
+  }
+  return done;
 }
 
-int64_t open_file::pread_unlocked(std::span<std::byte> buf, size_t offset) {
-  fsync_unlocked();
-  size_t bytes_read = disk_->read(offset, buf);
-  return bytes_read;
+int64_t open_file::pread_unlocked(
+    tl::function_ref<int(std::span<const std::byte>)> store, std::size_t bytes,
+    std::uint64_t offset) {
+  std::pmr::vector<std::byte> chunk{&sim::scratch()};
+  std::size_t done = 0;
+  while (done < bytes) {
+    chunk.resize(std::min(bytes - done, transfer_chunk));
+    auto n = disk_->read(offset + done, chunk);
+    if (n <= 0) {
+      break;
+    }
+    if (auto res = store({chunk.data(), static_cast<std::size_t>(n)});
+        res < 0) {
+      return done == 0 ? res : done;
+    }
+    done += n;
+  }
+  return done;
 }
 
-int64_t open_file::pwrite(std::span<const std::byte> buf, size_t offset) {
+std::int64_t
+open_file::pwrite(tl::function_ref<int(std::span<std::byte>)> load,
+                  std::size_t bytes, std::uint64_t offset) {
   std::lock_guard<std::mutex> lock(mutex_);
-  return pwrite_unlocked(buf, offset);
+  if (!writable()) {
+    return -EBADF;
+  }
+  return pwrite_unlocked(load, bytes, offset);
 }
 
-int64_t open_file::pread(std::span<std::byte> buf, size_t offset) {
+std::int64_t
+open_file::pread(tl::function_ref<int(std::span<const std::byte>)> store,
+                 std::size_t bytes, std::uint64_t offset) {
   std::lock_guard<std::mutex> lock(mutex_);
-  return pread_unlocked(buf, offset);
+  if (!readable()) {
+    return -EBADF;
+  }
+  return pread_unlocked(store, bytes, offset);
 }
 
-int64_t open_file::lseek(size_t offset, int whence) {
+std::int64_t open_file::seek(std::int64_t offset, int whence) {
   std::lock_guard<std::mutex> lock(mutex_);
+
+  std::int64_t base;
   switch (whence) {
   case SEEK_SET:
-    pos_ = offset;
+    base = 0;
     break;
   case SEEK_CUR:
-    pos_ += offset;
+    base = static_cast<std::int64_t>(this->offset());
     break;
   case SEEK_END:
-    pos_ = disk_->get_size() + offset;
+    base = static_cast<std::int64_t>(disk_->get_size());
     break;
+  case SEEK_DATA:
+  case SEEK_HOLE: {
+    if (offset < 0) {
+      return -ENXIO;
+    }
+    auto pos = disk_->seek_data(offset, whence == SEEK_HOLE);
+    if (0 <= pos) {
+      set_offset(pos);
+    }
+    return pos;
+  }
   default:
     return -EINVAL;
   }
-  return pos_;
+
+  std::int64_t pos;
+  if (__builtin_add_overflow(base, offset, &pos)) {
+    return -EOVERFLOW;
+  }
+  if (pos < 0) {
+    return -EINVAL;
+  }
+  set_offset(pos);
+  return pos;
 }
 
-int open_file::fsync() {
-  std::lock_guard lock{mutex_};
-  return fsync_unlocked();
+int open_file::sync() {
+  disk_->sync();
+  return 0;
 }
 
-int open_file::fsync_unlocked() {
-  if (direct_) {
+int open_file::truncate(std::uint64_t size) {
+  if (!writable()) {
+    return -EINVAL;
+  }
+  return disk_->truncate(size);
+}
+
+int open_file::stat(struct stat &st) {
+  disk_->stat(st);
+  return 0;
+}
+
+// disk functions
+
+disk::disk(std::string root) : root_{std::move(root)} {
+  while (1 < root_.size() && root_.back() == '/') {
+    root_.pop_back();
+  }
+}
+
+bool disk::contains(std::string_view path) const {
+  return root_.size() < path.size() && path.starts_with(root_) &&
+         path[root_.size()] == '/';
+}
+
+int disk::open(const std::string &path, int flags, mode_t mode,
+               std::shared_ptr<disk_file> &file) {
+  std::lock_guard lock{mutex_};
+
+  auto it = filenameMap.find(path);
+  if (it != filenameMap.end()) {
+    if ((flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) {
+      return -EEXIST;
+    }
+    file = it->second;
+    if ((flags & O_TRUNC) != 0) {
+      file->truncate(0);
+    }
     return 0;
   }
 
-  for (const write_req &req : write_backlog_) {
-    disk_->write(req.pos, req.bytes);
+  if ((flags & O_CREAT) == 0) {
+    return -ENOENT;
+  }
+  file = std::make_shared<disk_file>(next_ino_++, mode);
+  filenameMap.emplace(path, file);
+  return 0;
+}
+
+std::shared_ptr<disk_file> disk::find(const std::string &path) {
+  std::lock_guard lock{mutex_};
+  auto it = filenameMap.find(path);
+  return it == filenameMap.end() ? nullptr : it->second;
+}
+
+int disk::unlink(const std::string &path) {
+  std::lock_guard lock{mutex_};
+  auto it = filenameMap.find(path);
+  if (it == filenameMap.end()) {
+    return -ENOENT;
   }
-  write_backlog_.clear();
+  it->second->unlink();
+  filenameMap.erase(it);
   return 0;
 }
 } // namespace redstone::disk
@@ -1,59 +1,141 @@
 #pragma once
 
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <span>
+#include <string>
+#include <string_view>
+#include <tl/function_ref.hpp>
 #include <unordered_map>
 #include <vector>
 
+#include "sim/file_descriptor.hpp"
+
 namespace redstone::disk {
 
+// A file's contents, in fixed-size pages indexed by their position. Holes
+// have no pages and read as zeros, so sparse writes cost only the pages they
+// touch, and growing a file never moves what it already holds. Reads share
+// the lock, and only writes and truncation take it exclusively.
 class disk_file {
 public:
+  static constexpr std::size_t page_size = 4096;
+
+  // Only the permission bits of `mode` are kept
+  disk_file(std::uint64_t ino, mode_t mode) : ino_{ino}, mode_{mode & 07777} {}
+
+  // Returns the bytes read, 0 at or past the end of the file
   int64_t read(std::uint64_t pos, std::span<std::byte> buf);
-  int64_t write(std::uint64_t pos, std::span<const std::byte> buf);
+  // Written data is visible at once, but unsynced until sync() unless `sync`
+  // is set
+  int64_t write(std::uint64_t pos, std::span<const std::byte> buf,
+                bool sync = false);
+  // Makes everything written so far durable, as fsync does
+  void sync();
+  int truncate(std::uint64_t size);
   size_t get_size();
+  void stat(struct stat &st);
+
+  // The first offset at or after `pos` that holds data, or that is in a hole
+  // if `hole` is set. The end of the file counts as a hole. Returns -ENXIO
+  // if `pos` is past the end, or if only holes follow it when seeking data.
+  int64_t seek_data(std::uint64_t pos, bool hole);
+
+  std::uint64_t ino() const { return ino_; }
+
+  // Cleared once unlinked, open files keep the contents alive
+  bool linked() const { return linked_; }
+  void unlink() { linked_ = false; }
 
 private:
-  std::mutex mutex_;
-  std::vector<std::byte> buffer_;
-};
+  using page = std::array<std::byte, page_size>;
 
-class open_file {
-  struct write_req {
-    std::vector<std::byte> bytes;
-    uint64_t pos;
-  };
+  std::shared_mutex mutex_;
+  // Bytes of a page past the end of the file are always zero
+  std::map<std::uint64_t, std::unique_ptr<page>> pages_;
+  std::uint64_t size_ = 0;
+  // What a crash would lose, as disjoint [start, end) ranges by their start.
+  // Reads never depend on it.
+  std::map<std::uint64_t, std::uint64_t> unsynced_;
+  const std::uint64_t ino_;
+  const mode_t mode_;
+  std::atomic<bool> linked_ = true;
+};
 
+// An open file on a simulated disk. Writes reach the file at once, where
+// every open of it sees them, and stay unsynced until fsync unless the file
+// was opened with O_DIRECT or O_SYNC.
+class open_file final : public sim::file_descriptor {
 public:
-  int64_t read(std::span<std::byte> buf);
-  int64_t write(std::span<const std::byte> buf);
-  int64_t pread(std::span<std::byte> buf, size_t offset);
-  int64_t pwrite(std::span<const std::byte> buf, size_t offset);
-  int64_t lseek(size_t offset, int whence);
-  int fsync();
+  open_file(std::shared_ptr<disk_file> disk, int flags);
+
+  bool seekable() const override { return true; }
+
+  std::int64_t read(tl::function_ref<int(std::span<const std::byte>)> store,
+                    std::size_t bytes) override;
+  std::int64_t write(tl::function_ref<int(std::span<std::byte>)> load,
+                     std::size_t bytes) override;
+  std::int64_t pread(tl::function_ref<int(std::span<const std::byte>)> store,
+                     std::size_t bytes, std::uint64_t offset) override;
+  std::int64_t pwrite(tl::function_ref<int(std::span<std::byte>)> load,
+                      std::size_t bytes, std::uint64_t offset) override;
+  std::int64_t seek(std::int64_t offset, int whence) override;
+  int sync() override;
+  int truncate(std::uint64_t size) override;
+  int stat(struct stat &st) override;
 
 private:
-  std::vector<write_req> write_backlog_;
+  // Serializes uses of the offset
   std::mutex mutex_;
   std::shared_ptr<disk_file> disk_;
-  uint64_t pos_;
-  bool direct_;
+  const bool direct_;
+
+  bool readable() const;
+  bool writable() const;
 
-  int fsync_unlocked();
-  int64_t pread_unlocked(std::span<std::byte> buf, size_t offset);
-  int64_t pwrite_unlocked(std::span<const std::byte> buf, size_t offset);
+  int64_t pread_unlocked(tl::function_ref<int(std::span<const std::byte>)> store,
+                         std::size_t bytes, std::uint64_t offset);
+  int64_t pwrite_unlocked(tl::function_ref<int(std::span<std::byte>)> load,
+                          std::size_t bytes, std::uint64_t offset);
 };
 
+// The files of one machine, in a flat namespace of absolute paths under a
+// root directory. Paths elsewhere are left to the host.
 class disk {
 public:
+  explicit disk(std::string root);
+
+  // Whether an absolute, lexically normal `path` is on this disk
+  bool contains(std::string_view path) const;
+
+  // Opens or creates the file at `path` as open(2) would with `flags` and
+  // `mode`, though without applying the tracee's umask. Returns 0, -ENOENT
+  // or -EEXIST.
+  int open(const std::string &path, int flags, mode_t mode,
+           std::shared_ptr<disk_file> &file);
+
+  // Null if there is no file at `path`
+  std::shared_ptr<disk_file> find(const std::string &path);
+
+  // Returns 0 or -ENOENT
+  int unlink(const std::string &path);
+
 private:
+  std::string root_;
+
+  std::mutex mutex_;
   std::unordered_map<std::string, std::shared_ptr<disk_file>> filenameMap;
+  std::uint64_t next_ino_ = 1;
 };
 
-} // namespace redstone::disk
\ No newline at end of file
+} // namespace redstone::disk
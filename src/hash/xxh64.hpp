@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace redstone::hash {
+// Streaming XXH64. Feeding the input in pieces of any size gives the same
+// digest as hashing it at once, so output can be hashed as it is written.
+class xxh64 {
+public:
+  explicit xxh64(std::uint64_t seed = 0)
+      : acc_{seed + p1 + p2, seed + p2, seed, seed - p1}, seed_{seed} {}
+
+  void update(std::span<const std::byte> data) {
+    total_ += data.size();
+
+    if (pending_ != 0) {
+      const auto take = std::min(data.size(), stripe - pending_);
+      std::memcpy(buf_ + pending_, data.data(), take);
+      pending_ += take;
+      data = data.subspan(take);
+      if (pending_ < stripe) {
+        return;
+      }
+      consume(buf_);
+      pending_ = 0;
+    }
+
+    while (stripe <= data.size()) {
+      consume(data.data());
+      data = data.subspan(stripe);
+    }
+
+    std::memcpy(buf_, data.data(), data.size());
+    pending_ = data.size();
+  }
+
+  std::uint64_t digest() const {
+    std::uint64_t h;
+    if (stripe <= total_) {
+      h = std::rotl(acc_[0], 1) + std::rotl(acc_[1], 7) +
+          std::rotl(acc_[2], 12) + std::rotl(acc_[3], 18);
+      for (auto acc : acc_) {
+        h = merge(h, acc);
+      }
+    } else {
+      h = seed_ + p5;
+    }
+    h += total_;
+
+    const std::byte *p = buf_;
+    std::size_t left = pending_;
+    for (; 8 <= left; p += 8, left -= 8) {
+      h ^= round(0, load<std::uint64_t>(p));
+      h = std::rotl(h, 27) * p1 + p4;
+    }
+    if (4 <= left) {
+      h ^= load<std::uint32_t>(p) * p1;
+      h = std::rotl(h, 23) * p2 + p3;
+      p += 4;
+      left -= 4;
+    }
+    for (; left != 0; ++p, --left) {
+      h ^= std::to_integer<std::uint64_t>(*p) * p5;
+      h = std::rotl(h, 11) * p1;
+    }
+
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+  }
+
+  // Bytes hashed so far
+  std::uint64_t size() const { return total_; }
+
+private:
+  static constexpr std::uint64_t p1 = 0x9e3779b185ebca87;
+  static constexpr std::uint64_t p2 = 0xc2b2ae3d27d4eb4f;
+  static constexpr std::uint64_t p3 = 0x165667b19e3779f9;
+  static constexpr std::uint64_t p4 = 0x85ebca77c2b2ae63;
+  static constexpr std::uint64_t p5 = 0x27d4eb2f165667c5;
+  static constexpr std::size_t stripe = 32;
+
+  template <class T> static T load(const std::byte *p) {
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static std::uint64_t round(std::uint64_t acc, std::uint64_t input) {
+    return std::rotl(acc + input * p2, 31) * p1;
+  }
+
+  static std::uint64_t merge(std::uint64_t h, std::uint64_t acc) {
+    return (h ^ round(0, acc)) * p1 + p4;
+  }
+
+  void consume(const std::byte *p) {
+    for (std::size_t i = 0; i < 4; ++i) {
+      acc_[i] = round(acc_[i], load<std::uint64_t>(p + 8 * i));
+    }
+  }
+
+  std::uint64_t acc_[4];
+  const std::uint64_t seed_;
+  std::uint64_t total_ = 0;
+  std::byte buf_[stripe];
+  std::size_t pending_ = 0;
+};
+} // namespace redstone::hash
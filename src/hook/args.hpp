@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <span>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <system_error>
+#include <tuple>
+#include <utility>
+
+#include "hook/syscalls.hpp"
+#include "sim/runner.hpp"
+
+namespace redstone::hook {
+// Tracee memory regions of one syscall, transferred with a single vectored
+// call
+class transfer_batch {
+public:
+  // At most one region per argument
+  static constexpr std::size_t capacity = 6;
+
+  void add(std::uintptr_t remote, const void *local, std::size_t len) {
+    if (len == 0) {
+      return;
+    }
+    assert(size_ < capacity);
+    // iovec is not const-correct, writes only read from `local`
+    local_[size_] = {const_cast<void *>(local), len};
+    remote_[size_] = {reinterpret_cast<void *>(remote), len};
+    size_++;
+  }
+
+  bool empty() const { return size_ == 0; }
+
+  // Returns 0 or a negative errno. Empty batches make no call.
+  int read(sim::runner_handle &runner) const {
+    return empty() ? 0 : runner.read_memory_v(local(), remote());
+  }
+  int write(sim::runner_handle &runner) const {
+    return empty() ? 0 : runner.write_memory_v(local(), remote());
+  }
+
+private:
+  std::span<const iovec> local() const { return {local_.data(), size_}; }
+  std::span<const iovec> remote() const { return {remote_.data(), size_}; }
+
+  std::array<iovec, capacity> local_;
+  std::array<iovec, capacity> remote_;
+  std::size_t size_ = 0;
+};
+
+// A decoded syscall argument. Fixed-size inputs in tracee memory are queued
+// on the batch by decode(), and hold their value once the batch is read.
+template <arg_kind Kind> struct arg;
+
+template <class T> struct scalar_arg {
+  T value;
+
+  void decode(std::span<const std::uint64_t, 6> raw, std::size_t i,
+              transfer_batch &, std::error_code &) {
+    value = static_cast<T>(raw[i]);
+  }
+};
+
+// Payloads and output buffers are transferred by the hook itself
+struct pointer_arg {
+  std::uintptr_t addr;
+
+  void decode(std::span<const std::uint64_t, 6> raw, std::size_t i,
+              transfer_batch &, std::error_code &) {
+    addr = raw[i];
+  }
+};
+
+template <> struct arg<arg_kind::integer> : scalar_arg<std::int64_t> {};
+template <> struct arg<arg_kind::flags> : scalar_arg<int> {};
+template <> struct arg<arg_kind::fd> : scalar_arg<int> {};
+template <> struct arg<arg_kind::dirfd> : scalar_arg<int> {};
+template <> struct arg<arg_kind::length> : scalar_arg<std::size_t> {};
+template <> struct arg<arg_kind::socklen> : scalar_arg<socklen_t> {};
+template <> struct arg<arg_kind::pointer> : pointer_arg {};
+template <> struct arg<arg_kind::path> : pointer_arg {};
+template <> struct arg<arg_kind::in_buf> : pointer_arg {};
+template <> struct arg<arg_kind::out_buf> : pointer_arg {};
+template <> struct arg<arg_kind::out_timespec> : pointer_arg {};
+
+// Sized by the socklen argument after it. A null or empty address is left
+// unread. Like the kernel, only the maximum length is checked here, since
+// calls that ignore the address accept any shorter one; decode_addr checks
+// the minimum when the address is used.
+template <> struct arg<arg_kind::in_sockaddr> {
+  std::uintptr_t addr;
+  socklen_t len;
+  sockaddr_storage storage;
+
+  void decode(std::span<const std::uint64_t, 6> raw, std::size_t i,
+              transfer_batch &in, std::error_code &err) {
+    assert(i + 1 < raw.size());
+    addr = raw[i];
+    len = static_cast<socklen_t>(raw[i + 1]);
+    if (addr == 0 || err) {
+      return;
+    }
+    if (sizeof(storage) < len) {
+      err = std::error_code{EINVAL, std::generic_category()};
+      return;
+    }
+    if (len != 0) {
+      in.add(addr, &storage, len);
+    }
+  }
+};
+
+// Takes its capacity from the socklen_t the next argument points to, as
+// recvfrom does. A null address is left unread.
+template <> struct arg<arg_kind::out_sockaddr> {
+  std::uintptr_t addr;
+  std::uintptr_t len_addr;
+  socklen_t capacity;
+
+  void decode(std::span<const std::uint64_t, 6> raw, std::size_t i,
+              transfer_batch &in, std::error_code &) {
+    assert(i + 1 < raw.size());
+    addr = raw[i];
+    len_addr = raw[i + 1];
+    if (addr != 0) {
+      in.add(len_addr, &capacity, sizeof(capacity));
+    }
+  }
+
+  // Queues `len` bytes of `storage`, truncated to the capacity, and the full
+  // length
+  void store(transfer_batch &out, const sockaddr_storage &storage,
+             const socklen_t &len) const {
+    if (addr != 0) {
+      out.add(addr, &storage, std::min(capacity, len));
+      out.add(len_addr, &len, sizeof(len));
+    }
+  }
+};
+
+// A value-result length, like getsockopt's optlen
+template <> struct arg<arg_kind::socklen_ptr> {
+  std::uintptr_t addr;
+  socklen_t value;
+
+  void decode(std::span<const std::uint64_t, 6> raw, std::size_t i,
+              transfer_batch &in, std::error_code &) {
+    addr = raw[i];
+    in.add(addr, &value, sizeof(value));
+  }
+};
+
+// A null timespec is left unread
+template <> struct arg<arg_kind::in_timespec> {
+  std::uintptr_t addr;
+  timespec value;
+
+  void decode(std::span<const std::uint64_t, 6> raw, std::size_t i,
+              transfer_batch &in, std::error_code &) {
+    addr = raw[i];
+    if (addr != 0) {
+      in.add(addr, &value, sizeof(value));
+    }
+  }
+};
+
+// Decodes the leading arguments of a syscall, and reads all their inputs
+// from the tracee with one transfer. Invalid arguments set `err` to EINVAL,
+// and unreadable ones to EFAULT, so that hooks can report them in the order
+// the kernel would.
+template <arg_kind... Kinds>
+std::tuple<arg<Kinds>...> decode(sim::runner_handle &runner,
+                                 std::span<const std::uint64_t, 6> raw,
+                                 std::error_code &err) {
+  static_assert(sizeof...(Kinds) <= 6);
+
+  std::tuple<arg<Kinds>...> args;
+  transfer_batch in;
+  err = {};
+
+  [&]<std::size_t... I>(std::index_sequence<I...>) {
+    (std::get<I>(args).decode(raw, I, in, err), ...);
+  }(std::make_index_sequence<sizeof...(Kinds)>{});
+
+  if (!err && in.read(runner) < 0) {
+    err = std::error_code{EFAULT, std::generic_category()};
+  }
+  return args;
+}
+} // namespace redstone::hook
@@ -0,0 +1,85 @@
+#include "hook/filter.hpp"
+#include "hook/syscalls.hpp"
+#include "sim/file_descriptor.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <linux/audit.h>
+#include <linux/seccomp.h>
+#include <unistd.h>
+
+namespace redstone::hook {
+namespace {
+sock_filter load(std::uint32_t offset) {
+  return BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offset);
+}
+
+sock_filter ret(std::uint32_t action) {
+  return BPF_STMT(BPF_RET | BPF_K, action);
+}
+
+// Jumps from instruction `at` to `target` if the accumulator matches `k`
+sock_filter jump_if(std::uint16_t op, std::uint32_t k, std::size_t at,
+                    std::size_t target) {
+  assert(at < target && target - at - 1 <= 0xff);
+  return BPF_JUMP(BPF_JMP | op | BPF_K, k,
+                  static_cast<std::uint8_t>(target - at - 1), 0);
+}
+} // namespace
+
+std::vector<sock_filter> build_filter(bool trap_stdio) {
+  std::vector<std::uint32_t> allowed;
+  std::vector<std::uint32_t> by_fd;
+  for (std::uint32_t nr = 0; nr < syscall_count; ++nr) {
+    const auto &info = syscall_table()[nr];
+    if (info.passthrough) {
+      allowed.push_back(nr);
+    } else if (info.impl && info.args[0] == arg_kind::fd) {
+      by_fd.push_back(nr);
+    }
+  }
+
+  // Compares against every listed syscall, in order of number so that the
+  // common low ones are found first, then fall back to stopping
+  const std::size_t compares = 4;
+  const std::size_t fallback = compares + allowed.size() + by_fd.size();
+  const std::size_t fd_check = fallback + 1;
+  const std::size_t allow = fd_check + (trap_stdio ? 4 : 2);
+  const std::size_t trace = allow + 1;
+
+  std::vector<sock_filter> prog;
+  prog.reserve(trace + 1);
+
+  // Other ABIs number their syscalls differently
+  prog.push_back(load(offsetof(seccomp_data, arch)));
+  prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0));
+  prog.push_back(ret(SECCOMP_RET_TRACE));
+  prog.push_back(load(offsetof(seccomp_data, nr)));
+
+  std::size_t a = 0, f = 0;
+  while (a < allowed.size() || f < by_fd.size()) {
+    const auto at = prog.size();
+    if (f == by_fd.size() || (a < allowed.size() && allowed[a] < by_fd[f])) {
+      prog.push_back(jump_if(BPF_JEQ, allowed[a++], at, allow));
+    } else {
+      prog.push_back(jump_if(BPF_JEQ, by_fd[f++], at, fd_check));
+    }
+  }
+  assert(prog.size() == fallback);
+  prog.push_back(ret(SECCOMP_RET_TRACE));
+
+  // Only the low half of the argument holds the fd
+  prog.push_back(load(offsetof(seccomp_data, args)));
+  prog.push_back(jump_if(BPF_JSET, sim::file_descriptor_table::simulated,
+                         prog.size(), trace));
+  if (trap_stdio) {
+    prog.push_back(jump_if(BPF_JEQ, STDOUT_FILENO, prog.size(), trace));
+    prog.push_back(jump_if(BPF_JEQ, STDERR_FILENO, prog.size(), trace));
+  }
+  assert(prog.size() == allow);
+  prog.push_back(ret(SECCOMP_RET_ALLOW));
+  prog.push_back(ret(SECCOMP_RET_TRACE));
+  return prog;
+}
+} // namespace redstone::hook
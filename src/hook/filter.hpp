@@ -0,0 +1,12 @@
+#pragma once
+
+#include <linux/filter.h>
+#include <vector>
+
+namespace redstone::hook {
+// A seccomp program that stops the tracee only for syscalls a hook may
+// simulate. Passthroughs never stop, and hooked syscalls that take an fd
+// first only stop for simulated fds, and for standard output and error if
+// `trap_stdio`. Anything else stops, so that it is reported as unimplemented.
+std::vector<sock_filter> build_filter(bool trap_stdio);
+} // namespace redstone::hook
@@ -59,7 +59,7 @@ struct hook_result {
 using hook = hook_result (*)(sim::replica &replica,
                              std::span<const std::uint64_t, 6> args);
 
-std::span<const hook> hook_table();
+// Null if the syscall runs on the host
 hook get_hook(uint64_t sys);
 
 struct handlers {
@@ -1,24 +1,40 @@
 #include "impls.hpp"
+#include "disk/disk.hpp"
 #include "hook.hpp"
+#include "hook/args.hpp"
 #include "metrics.hpp"
 #include "net/datagram_socket.hpp"
 #include "net/socket.hpp"
+#include "net/socket_pair.hpp"
 #include "net/stream_socket.hpp"
+#include "sim/pipe.hpp"
 #include "sim/replica.hpp"
+#include "sim/scratch.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <chrono>
+#include <climits>
+#include <csignal>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
+#include <fcntl.h>
+#include <filesystem>
 #include <memory>
+#include <memory_resource>
 #include <netinet/ip.h>
+#include <optional>
 #include <span>
 #include <spdlog/spdlog.h>
+#include <string>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <system_error>
 #include <thread>
@@ -27,12 +43,16 @@
 
 namespace redstone::hook {
 namespace {
+using kind = arg_kind;
+
+// Callbacks that copy consecutive fragments from or to tracee memory
+// starting at `addr`
 auto store_fragment_callback(sim::replica &replica, uintptr_t addr) {
   return [&replica, addr](auto fragment) mutable {
     auto &runner = replica.runner();
     auto res = runner.read_memory(addr, fragment);
     if (0 <= res) {
-      addr += res;
+      addr += fragment.size();
     }
     return res;
   };
@@ -43,333 +63,1927 @@ auto load_fragment_callback(sim::replica &replica, uintptr_t addr) {
     auto &runner = replica.runner();
     auto res = runner.write_memory(addr, fragment);
     if (0 <= res) {
-      addr += res;
+      addr += fragment.size();
     }
     return res;
   };
 }
 
-net::socket_addr parse_addr(sim::replica &replica, uintptr_t dest_addr,
-                            size_t dest_len, std::error_code &err) {
-  err = {};
+// A write callback that serves staged `data` front to back
+auto load_from(std::span<const std::byte> data) {
+  return [data](std::span<std::byte> fragment) mutable {
+    assert(fragment.size() <= data.size());
+    std::copy_n(data.begin(), fragment.size(), fragment.begin());
+    data = data.subspan(fragment.size());
+    return 0;
+  };
+}
+
+// A read callback that stages fragments in `out`
+auto append_to(std::pmr::vector<std::byte> &out) {
+  return [&out](std::span<const std::byte> fragment) {
+    out.insert(out.end(), fragment.begin(), fragment.end());
+    return 0;
+  };
+}
+
+// The most one read or write transfers, MAX_RW_COUNT in the kernel
+constexpr std::size_t max_rw_count = INT_MAX & ~std::size_t{4095};
+
+// The end of user space, TASK_SIZE_MAX with 4-level page tables
+constexpr std::uintptr_t user_space_end = (std::uintptr_t{1} << 47) - 4096;
+
+// Reads the iovec array of a vectored call and sums its lengths. Like the
+// kernel, more than UIO_MAXIOV segments or a negative segment length is
+// invalid, a segment reaching past user space faults, and segments past
+// max_rw_count bytes are cut short.
+int read_iovecs(sim::replica &replica, uintptr_t addr, std::int64_t count,
+                std::pmr::vector<iovec> &iovs, std::size_t &total) {
+  if (count < 0 || UIO_MAXIOV < count) {
+    return -EINVAL;
+  }
+
+  iovs.resize(count);
+  transfer_batch in;
+  in.add(addr, iovs.data(), iovs.size() * sizeof(iovec));
+  if (in.read(replica.runner()) < 0) {
+    return -EFAULT;
+  }
+
+  for (auto &v : iovs) {
+    if (SSIZE_MAX < v.iov_len) {
+      return -EINVAL;
+    }
+  }
+
+  total = 0;
+  for (auto &v : iovs) {
+    const auto base = reinterpret_cast<std::uintptr_t>(v.iov_base);
+    if (user_space_end < v.iov_len || user_space_end - v.iov_len < base) {
+      return -EFAULT;
+    }
+    v.iov_len = std::min(v.iov_len, max_rw_count - total);
+    total += v.iov_len;
+  }
+  return 0;
+}
+
+// Walks the segments of a vectored call front to back
+class segment_cursor {
+public:
+  explicit segment_cursor(std::span<const iovec> iovs)
+      : iovs_{iovs}, remote_{&sim::scratch()} {
+    remote_.reserve(iovs.size());
+  }
+
+  // The tracee ranges that cover the next `n` bytes, which are then skipped
+  std::span<const iovec> next(std::size_t n) {
+    remote_.clear();
+    while (n != 0 && !iovs_.empty()) {
+      const auto &v = iovs_.front();
+      const auto take = std::min(n, v.iov_len - skip_);
+      if (take != 0) {
+        remote_.push_back({static_cast<std::byte *>(v.iov_base) + skip_, take});
+      }
+      n -= take;
+      skip_ += take;
+      if (skip_ == v.iov_len) {
+        iovs_ = iovs_.subspan(1);
+        skip_ = 0;
+      }
+    }
+    return remote_;
+  }
+
+private:
+  std::span<const iovec> iovs_;
+  std::size_t skip_ = 0;
+  std::pmr::vector<iovec> remote_;
+};
+
+// Like the fragment callbacks, but for the segments of readv and writev.
+// Every fragment the descriptor asks for is copied with one transfer over
+// the segments it spans, so nothing is staged in between.
+auto store_segments_callback(sim::replica &replica, segment_cursor &cursor) {
+  return [&replica, &cursor](std::span<std::byte> fragment) {
+    iovec local{fragment.data(), fragment.size()};
+    return replica.runner().read_memory_v({&local, 1},
+                                          cursor.next(fragment.size()));
+  };
+}
+
+auto load_segments_callback(sim::replica &replica, segment_cursor &cursor) {
+  return [&replica, &cursor](std::span<const std::byte> fragment) {
+    iovec local{const_cast<std::byte *>(fragment.data()), fragment.size()};
+    return replica.runner().write_memory_v({&local, 1},
+                                           cursor.next(fragment.size()));
+  };
+}
+
+// Copies what `iovs` cover into `out`, which must be as long, with one
+// transfer
+int gather(sim::replica &replica, std::span<const iovec> iovs,
+           std::span<std::byte> out) {
+  iovec local{out.data(), out.size()};
+  return replica.runner().read_memory_v({&local, 1}, iovs);
+}
+
+// Copies `data` over the leading bytes that `iovs` cover, with one transfer
+int scatter(sim::replica &replica, std::span<const std::byte> data,
+            std::span<const iovec> iovs) {
+  std::pmr::vector<iovec> remote{&sim::scratch()};
+  for (std::size_t left = data.size(); auto &v : iovs) {
+    if (left == 0) {
+      break;
+    }
+    const auto take = std::min(left, v.iov_len);
+    remote.push_back({v.iov_base, take});
+    left -= take;
+  }
+
+  iovec local{const_cast<std::byte *>(data.data()), data.size()};
+  return replica.runner().write_memory_v({&local, 1}, remote);
+}
+
+// Installs both ends of a pipe or socketpair and writes their fds to the
+// two ints at `fds_addr`
+hook_result install_pair(sim::replica &replica,
+                         std::shared_ptr<sim::file_descriptor> first,
+                         std::shared_ptr<sim::file_descriptor> second,
+                         uintptr_t fds_addr, bool cloexec) {
+  auto &fd_table = replica.fd_table();
+
+  int fds[2];
+  fds[0] = fd_table.insert(std::move(first), cloexec);
+  if (fds[0] < 0) {
+    return error{EMFILE};
+  }
+  fds[1] = fd_table.insert(std::move(second), cloexec);
+  if (fds[1] < 0) {
+    fd_table.close(fds[0]);
+    return error{EMFILE};
+  }
+
+  if (0 > replica.runner().write_memory(fds_addr,
+                                        std::as_bytes(std::span{fds}))) {
+    fd_table.close(fds[0]);
+    fd_table.close(fds[1]);
+    return error{EFAULT};
+  }
+  return handled{0};
+}
+
+// IPPROTO_IP socket options, of which only multicast group membership is
+// simulated
+hook_result ip_setsockopt(sim::replica &replica, sim::file_descriptor &fd,
+                          int optname, uintptr_t optval, socklen_t optlen) {
+  if (optname != IP_ADD_MEMBERSHIP && optname != IP_DROP_MEMBERSHIP) {
+    spdlog::warn("unsupported IP socket option {}", optname);
+    return error{ENOPROTOOPT};
+  }
+
+  if (fd.kind() != sim::fd_kind::datagram_socket) {
+    return error{EPROTO};
+  }
+  auto &dgram = static_cast<net::datagram_socket &>(fd);
+
+  // ip_mreqn starts like ip_mreq, and only the group address matters here
+  ip_mreq mreq;
+  if (optlen < sizeof(mreq)) {
+    return error{EINVAL};
+  }
+  if (0 > replica.runner().read_memory(
+              optval, std::as_writable_bytes(std::span{&mreq, 1}))) {
+    return error{EFAULT};
+  }
+
+  // Groups are per port, so the socket has to be bound first
+  auto &network = replica.network();
+
+  const auto local = dgram.local_addr();
+  auto local_ip = local != net::unspecified_addr
+                      ? std::get_if<net::ipv4_addr>(&network.address(local))
+                      : nullptr;
+  if (!local_ip) {
+    spdlog::warn("multicast membership on an unbound socket");
+    return error{EINVAL};
+  }
+
+  net::ipv4_addr group{.port = local_ip->port, .octets = {}};
+  std::memcpy(group.octets, &mreq.imr_multiaddr, sizeof(group.octets));
+  if (!net::is_multicast(group)) {
+    return error{EINVAL};
+  }
+
+  auto err = optname == IP_ADD_MEMBERSHIP
+                 ? network.join(network.intern(group), dgram.shared_from_this())
+                 : network.leave(network.intern(group), &dgram);
+  if (err) {
+    return error{err.value()};
+  }
+  return handled{0};
+}
+
+net::socket_addr decode_addr(const sockaddr_storage &addr_storage,
+                             size_t dest_len, std::error_code &err) {
+  err = {};
+
+  if (sizeof(addr_storage) < dest_len || dest_len < 2) {
+    err = std::error_code{EINVAL, std::generic_category()};
+    return {};
+  }
+
+  switch (addr_storage.ss_family) {
+  case AF_INET: {
+    auto in_addr = reinterpret_cast<const sockaddr_in *>(&addr_storage);
+    net::ipv4_addr ip_addr{};
+
+    memcpy(ip_addr.octets, &in_addr->sin_addr, 4);
+    ip_addr.port = in_addr->sin_port;
+
+    return ip_addr;
+  }
+  case AF_UNIX: {
+    auto un_addr = reinterpret_cast<const sockaddr_un *>(&addr_storage);
+
+    std::string path;
+
+    for (size_t i = offsetof(struct sockaddr_un, sun_path); i < dest_len; ++i) {
+      char c = un_addr->sun_path[i - offsetof(struct sockaddr_un, sun_path)];
+      if (c == '\0')
+        break;
+      if (i == dest_len - 1) {
+        err = std::error_code{EINVAL, std::generic_category()};
+        return {};
+      }
+      path.push_back(c);
+    }
+
+    return net::unix_addr{std::move(path)};
+  }
+  default: {
+    err = std::error_code{ENOTSUP, std::generic_category()};
+    return {};
+  }
+  }
+}
+
+// Encodes `id` the way the kernel reports a sender to a socket of family
+// `af`, and returns the address length. Unbound Unix senders have no name.
+socklen_t encode_addr(const net::network &network, net::addr_id id,
+                      net::address_family af, sockaddr_storage &out) {
+  out = {};
+
+  if (id == net::unspecified_addr && af == net::address_family::unix_) {
+    out.ss_family = AF_UNIX;
+    return sizeof(sa_family_t);
+  }
+
+  const auto &addr = network.address(id);
+
+  if (auto ip = std::get_if<net::ipv4_addr>(&addr)) {
+    auto in_addr = reinterpret_cast<sockaddr_in *>(&out);
+    in_addr->sin_family = AF_INET;
+    in_addr->sin_port = ip->port;
+    memcpy(&in_addr->sin_addr, ip->octets, 4);
+    return sizeof(sockaddr_in);
+  }
+
+  auto &path = std::get<net::unix_addr>(addr).path;
+  auto un_addr = reinterpret_cast<sockaddr_un *>(&out);
+  un_addr->sun_family = AF_UNIX;
+
+  const auto len = std::min(path.size(), sizeof(un_addr->sun_path) - 1);
+  memcpy(un_addr->sun_path, path.data(), len);
+  return offsetof(sockaddr_un, sun_path) + len + 1;
+}
+
+// Messages of a sendmsg/recvmsg family call. The iovec arrays of all messages
+// are stored back to back in `iovs`.
+struct msg_batch {
+  std::pmr::vector<mmsghdr> headers{&sim::scratch()};
+  std::pmr::vector<iovec> iovs{&sim::scratch()};
+  std::pmr::vector<sockaddr_storage> names{&sim::scratch()};
+
+  std::size_t length(std::size_t i, std::span<const iovec> iov) const {
+    std::size_t n = 0;
+    for (auto &v : iov.first(headers[i].msg_hdr.msg_iovlen)) {
+      n += v.iov_len;
+    }
+    return n;
+  }
+};
+
+// Reads every message's iovec array, and destination address if `names` is
+// set, with one tracee transfer.
+int read_msg_batch(sim::replica &replica, msg_batch &batch, bool names) {
+  std::size_t iov_count = 0;
+
+  for (auto &h : batch.headers) {
+    if (UIO_MAXIOV < h.msg_hdr.msg_iovlen) {
+      return -EMSGSIZE;
+    }
+    if (names && sizeof(sockaddr_storage) < h.msg_hdr.msg_namelen) {
+      return -EINVAL;
+    }
+    iov_count += h.msg_hdr.msg_iovlen;
+  }
+
+  batch.iovs.resize(iov_count);
+  batch.names.resize(names ? batch.headers.size() : 0);
+
+  std::pmr::vector<iovec> local{&sim::scratch()};
+  std::pmr::vector<iovec> remote{&sim::scratch()};
+  local.reserve(2 * batch.headers.size());
+  remote.reserve(2 * batch.headers.size());
+
+  iovec *next = batch.iovs.data();
+
+  for (std::size_t i = 0; i < batch.headers.size(); ++i) {
+    auto &h = batch.headers[i].msg_hdr;
+
+    if (h.msg_iovlen != 0) {
+      const auto len = h.msg_iovlen * sizeof(iovec);
+      local.push_back({next, len});
+      remote.push_back({h.msg_iov, len});
+      next += h.msg_iovlen;
+    }
+
+    if (names && h.msg_name != nullptr && h.msg_namelen != 0) {
+      local.push_back({&batch.names[i], h.msg_namelen});
+      remote.push_back({h.msg_name, h.msg_namelen});
+    }
+  }
+
+  return replica.runner().read_memory_v(local, remote);
+}
+
+// Gathers the payloads of all messages with one tracee transfer and sends
+// them as a batch. Returns the number of messages sent, and stores each
+// message's length in its header.
+std::int64_t send_msg_batch(sim::replica &replica,
+                            net::datagram_socket &socket, msg_batch &batch,
+                            int flags) {
+  auto res = read_msg_batch(replica, batch, true);
+  if (res < 0) {
+    return res;
+  }
+
+  std::pmr::vector<net::outgoing_datagram> dgrams{&sim::scratch()};
+  dgrams.reserve(batch.headers.size());
+
+  std::span<const iovec> iov = batch.iovs;
+  std::size_t total = 0;
+  std::int64_t err = 0;
+
+  for (std::size_t i = 0; i < batch.headers.size(); ++i) {
+    auto &h = batch.headers[i].msg_hdr;
+    const auto len = batch.length(i, iov);
+
+    // Like Linux, a name of length zero is no name at all
+    const bool named = h.msg_name != nullptr && h.msg_namelen != 0;
+    std::error_code ec;
+    auto dst = named ? decode_addr(batch.names[i], h.msg_namelen, ec)
+                     : net::socket_addr{};
+
+    if (!named) {
+      err = -EDESTADDRREQ;
+    } else if (ec) {
+      err = -ec.value();
+    } else if (net::max_udp_packet_size < len) {
+      err = -EMSGSIZE;
+    }
+
+    if (err < 0) {
+      // Like the kernel, report the error only if nothing was sent
+      if (i == 0) {
+        return err;
+      }
+      batch.headers.resize(i);
+      break;
+    }
+
+    dgrams.push_back({.bytes = {}, .dst = std::move(dst)});
+    batch.headers[i].msg_len = len;
+    total += len;
+    iov = iov.subspan(h.msg_iovlen);
+  }
+
+  // Every payload is staged back to back in one arena buffer, and copied out
+  // once the socket takes it
+  std::pmr::vector<std::byte> staged(total, &sim::scratch());
+  for (std::size_t i = 0, offset = 0; i < dgrams.size(); ++i) {
+    const std::size_t len = batch.headers[i].msg_len;
+    dgrams[i].bytes = std::span{staged}.subspan(offset, len);
+    offset += len;
+  }
+
+  const iovec local{staged.data(), total};
+  const auto remote =
+      std::span<const iovec>{batch.iovs}.first(batch.iovs.size() - iov.size());
+
+  res = replica.runner().read_memory_v({&local, 1}, remote);
+  if (res < 0) {
+    return res;
+  }
+
+  return socket.send_batch(dgrams, flags);
+}
+
+// Receives one datagram per message and scatters each over the message's
+// iovecs. Payloads and the updated headers at `headers_addr` go back to the
+// tracee with one transfer. Returns the number of messages received.
+std::int64_t recv_msg_batch(sim::replica &replica,
+                            net::datagram_socket &socket, msg_batch &batch,
+                            uintptr_t headers_addr, bool single, int flags) {
+  auto res = read_msg_batch(replica, batch, false);
+  if (res < 0) {
+    return res;
+  }
+
+  std::pmr::vector<net::datagram> dgrams{&sim::scratch()};
+  dgrams.reserve(batch.headers.size());
+
+  auto n = socket.recv_batch(dgrams, batch.headers.size(), flags,
+                             (flags & MSG_WAITFORONE) == 0);
+  if (n < 0) {
+    return n;
+  }
+
+  std::pmr::vector<iovec> local{&sim::scratch()};
+  std::pmr::vector<iovec> remote{&sim::scratch()};
+  local.reserve(2 * dgrams.size() + 1);
+  remote.reserve(batch.iovs.size() + dgrams.size() + 1);
+  std::span<const iovec> iov = batch.iovs;
+
+  batch.names.resize(dgrams.size());
+
+  for (std::size_t i = 0; i < dgrams.size(); ++i) {
+    auto &h = batch.headers[i];
+    auto &[data, from] = dgrams[i];
+    auto &bytes = *data;
+
+    const auto capacity = batch.length(i, iov);
+    const auto len = std::min(capacity, bytes.size());
+
+    if (len != 0) {
+      local.push_back({const_cast<std::byte *>(bytes.data()), len});
+    }
+
+    for (std::size_t left = len; auto &v : iov.first(h.msg_hdr.msg_iovlen)) {
+      const auto take = std::min(left, v.iov_len);
+      if (take != 0) {
+        remote.push_back({v.iov_base, take});
+      }
+      left -= take;
+    }
+
+    if (h.msg_hdr.msg_name != nullptr) {
+      const auto name_len = encode_addr(replica.network(), from,
+                                        socket.get_af(), batch.names[i]);
+      const auto take = std::min(h.msg_hdr.msg_namelen, name_len);
+      if (take != 0) {
+        local.push_back({&batch.names[i], take});
+        remote.push_back({h.msg_hdr.msg_name, take});
+      }
+      h.msg_hdr.msg_namelen = name_len;
+    } else {
+      h.msg_hdr.msg_namelen = 0;
+    }
+
+    // Ancillary data is not simulated
+    h.msg_len = len;
+    h.msg_hdr.msg_controllen = 0;
+    h.msg_hdr.msg_flags = capacity < bytes.size() ? MSG_TRUNC : 0;
+
+    iov = iov.subspan(h.msg_hdr.msg_iovlen);
+  }
+
+  if (single) {
+    local.push_back({&batch.headers[0].msg_hdr, sizeof(msghdr)});
+    remote.push_back({reinterpret_cast<void *>(headers_addr), sizeof(msghdr)});
+  } else {
+    const auto len = dgrams.size() * sizeof(mmsghdr);
+    local.push_back({batch.headers.data(), len});
+    remote.push_back({reinterpret_cast<void *>(headers_addr), len});
+  }
+
+  res = replica.runner().write_memory_v(local, remote);
+  if (res < 0) {
+    return res;
+  }
+  return n;
+}
+
+// Reads the headers of a sendmmsg/recvmmsg call, capped at UIO_MAXIOV
+// messages like the kernel does.
+int read_msg_headers(sim::replica &replica, msg_batch &batch, uintptr_t addr,
+                     std::size_t count) {
+  batch.headers.resize(std::min<std::size_t>(count, UIO_MAXIOV));
+  return replica.runner().read_memory(
+      addr, std::as_writable_bytes(std::span{batch.headers}));
+}
+
+// Reads the header of a sendmsg/recvmsg call
+int read_msg_header(sim::replica &replica, msg_batch &batch, uintptr_t addr) {
+  batch.headers.resize(1);
+  return replica.runner().read_memory(
+      addr, std::as_writable_bytes(std::span{&batch.headers[0].msg_hdr, 1}));
+}
+
+// Reads into the segments of readv and preadv as the descriptor produces
+// the data, so that it sees one read whatever their number. Positional reads
+// pass an offset.
+hook_result read_segments(sim::replica &replica, sim::file_descriptor &fildes,
+                          uintptr_t iov, std::int64_t count,
+                          std::optional<std::uint64_t> offset) {
+  if (offset && !fildes.seekable()) {
+    return error{ESPIPE};
+  }
+
+  std::pmr::vector<iovec> iovs{&sim::scratch()};
+  std::size_t total;
+  auto res = read_iovecs(replica, iov, count, iovs, total);
+  if (res < 0) {
+    return error{-res};
+  }
+
+  segment_cursor cursor{iovs};
+  auto store = load_segments_callback(replica, cursor);
+  return handled{offset ? fildes.pread(store, total, *offset)
+                        : fildes.read(store, total)};
+}
+
+// Writes that fail with EPIPE also raise SIGPIPE, as in the kernel, unless
+// the caller passed MSG_NOSIGNAL
+std::int64_t raise_sigpipe(sim::replica &replica, std::int64_t res,
+                           int flags = 0) {
+  if (res == -EPIPE && (flags & MSG_NOSIGNAL) == 0) {
+    replica.runner().raise(SIGPIPE);
+  }
+  return res;
+}
+
+// Writes the segments of writev and pwritev as one write, reading them as
+// the descriptor consumes the data
+hook_result write_segments(sim::replica &replica, sim::file_descriptor &fildes,
+                           uintptr_t iov, std::int64_t count,
+                           std::optional<std::uint64_t> offset) {
+  if (offset && !fildes.seekable()) {
+    return error{ESPIPE};
+  }
+
+  std::pmr::vector<iovec> iovs{&sim::scratch()};
+  std::size_t total;
+  auto res = read_iovecs(replica, iov, count, iovs, total);
+  if (res < 0) {
+    return error{-res};
+  }
+
+  segment_cursor cursor{iovs};
+  auto load = store_segments_callback(replica, cursor);
+  return handled{raise_sigpipe(replica,
+                               offset ? fildes.pwrite(load, total, *offset)
+                                      : fildes.write(load, total))};
+}
+
+// Reads a NUL-terminated path from the tracee a page at a time, so that no
+// transfer runs past the end of the mapping it lives in. Returns 0, -EFAULT
+// or -ENAMETOOLONG.
+int read_path(sim::replica &replica, uintptr_t addr, std::string &path) {
+  constexpr std::size_t page = 4096;
+
+  path.clear();
+  while (path.size() < PATH_MAX) {
+    const auto n = std::min(page - addr % page, PATH_MAX - path.size());
+    const auto old = path.size();
+    path.resize(old + n);
+
+    transfer_batch in;
+    in.add(addr, path.data() + old, n);
+    if (in.read(replica.runner()) < 0) {
+      return -EFAULT;
+    }
+    if (auto end = path.find('\0', old); end != std::string::npos) {
+      path.resize(end);
+      return 0;
+    }
+    addr += n;
+  }
+  return -ENAMETOOLONG;
+}
+
+// Resolves a path read from the tracee against the machine's disk. Returns
+// 1, with `path` made lexically normal, if it names a file there, 0 if the
+// host should run the call, or a negative errno.
+int resolve_path(sim::replica &replica, int dirfd, std::string &path) {
+  auto disk = replica.disk();
+  if (!disk) {
+    return 0;
+  }
+  if (path.empty()) {
+    return -ENOENT;
+  }
+  if (path[0] != '/') {
+    // Simulated fds are never directories
+    const bool simulated =
+        0 <= dirfd && sim::file_descriptor_table::is_simulated(dirfd);
+    return simulated ? -ENOTDIR : 0;
+  }
+
+  auto normal = std::filesystem::path{path}.lexically_normal().native();
+  if (!disk->contains(normal)) {
+    return 0;
+  }
+  if (normal.back() == '/') {
+    // The disk has no directories
+    return -ENOENT;
+  }
+  path = std::move(normal);
+  return 1;
+}
+
+int read_disk_path(sim::replica &replica, int dirfd, uintptr_t addr,
+                   std::string &path) {
+  if (!replica.disk()) {
+    return 0;
+  }
+  if (auto res = read_path(replica, addr, path); res < 0) {
+    return res;
+  }
+  return resolve_path(replica, dirfd, path);
+}
+
+hook_result open_on_disk(sim::replica &replica, const std::string &path,
+                         int flags, mode_t mode) {
+  if ((flags & O_TMPFILE) == O_TMPFILE || (flags & O_PATH) != 0) {
+    spdlog::warn("unsupported open flags {:#o} on {}", flags, path);
+    return error{EINVAL};
+  }
+  if ((flags & O_ACCMODE) == O_ACCMODE) {
+    return error{EINVAL};
+  }
+  if ((flags & O_DIRECTORY) != 0) {
+    return error{ENOTDIR};
+  }
+
+  std::shared_ptr<disk::disk_file> file;
+  if (auto res = replica.disk()->open(path, flags, mode, file); res < 0) {
+    return error{-res};
+  }
+
+  auto fd = replica.fd_table().insert(
+      std::make_shared<disk::open_file>(std::move(file), flags),
+      (flags & O_CLOEXEC) != 0);
+  if (fd < 0) {
+    return error{EMFILE};
+  }
+  return handled{fd};
+}
+
+int store_stat(sim::replica &replica, uintptr_t addr, const struct stat &st) {
+  transfer_batch out;
+  out.add(addr, &st, sizeof(st));
+  return out.write(replica.runner()) < 0 ? -EFAULT : 0;
+}
+} // namespace
+
+// Standard output and error go to the replica's capture, if it has one
+hook_result sys_write(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args) {
+  std::error_code err;
+  auto [fd, buf, len] =
+      decode<kind::fd, kind::in_buf, kind::length>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  if (auto output = replica.output(fd.value)) {
+    auto store = store_fragment_callback(replica, buf.addr);
+    return handled{output->write(store, len.value)};
+  }
+  if (!sim::file_descriptor_table::is_simulated(fd.value)) {
+    return passthrough;
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+
+  auto store = store_fragment_callback(replica, buf.addr);
+  auto res = fildes->write(store, len.value);
+  return handled{raise_sigpipe(replica, res)};
+}
+
+hook_result sys_read(sim::replica &replica,
+                     std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [fd, buf, len] = decode<kind::fd, kind::out_buf, kind::length>(
+      replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+
+  auto store = load_fragment_callback(replica, buf.addr);
+  auto res = fildes->read(store, len.value);
+  return handled{res};
+}
+
+hook_result sys_pwrite64(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [fd, buf, len, offset] =
+      decode<kind::fd, kind::in_buf, kind::length, kind::integer>(
+          replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  if (offset.value < 0) {
+    return error{EINVAL};
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+  if (!fildes->seekable()) {
+    return error{ESPIPE};
+  }
+
+  auto store = store_fragment_callback(replica, buf.addr);
+  return handled{fildes->pwrite(store, len.value, offset.value)};
+}
+
+hook_result sys_pread64(sim::replica &replica,
+                        std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [fd, buf, len, offset] =
+      decode<kind::fd, kind::out_buf, kind::length, kind::integer>(
+          replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  if (offset.value < 0) {
+    return error{EINVAL};
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+  if (!fildes->seekable()) {
+    return error{ESPIPE};
+  }
+
+  auto store = load_fragment_callback(replica, buf.addr);
+  return handled{fildes->pread(store, len.value, offset.value)};
+}
+
+hook_result sys_writev(sim::replica &replica,
+                       std::span<const std::uint64_t, 6> args) {
+  std::error_code err;
+  auto [fd, iov, count] = decode<kind::fd, kind::pointer, kind::integer>(
+      replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  if (auto output = replica.output(fd.value)) {
+    return write_segments(replica, *output, iov.addr, count.value,
+                          std::nullopt);
+  }
+  if (!sim::file_descriptor_table::is_simulated(fd.value)) {
+    return passthrough;
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+  return write_segments(replica, *fildes, iov.addr, count.value, std::nullopt);
+}
+
+hook_result sys_readv(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [fd, iov, count] = decode<kind::fd, kind::pointer, kind::integer>(
+      replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+  return read_segments(replica, *fildes, iov.addr, count.value, std::nullopt);
+}
+
+// The offset's high half, args[4], is unused on 64-bit targets. Like the
+// kernel, a negative offset is checked before the descriptor.
+hook_result sys_pwritev(sim::replica &replica,
+                        std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [fd, iov, count, offset] =
+      decode<kind::fd, kind::pointer, kind::integer, kind::integer>(
+          replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  if (offset.value < 0) {
+    return error{EINVAL};
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+  return write_segments(replica, *fildes, iov.addr, count.value,
+                        offset.value);
+}
+
+hook_result sys_preadv(sim::replica &replica,
+                       std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [fd, iov, count, offset] =
+      decode<kind::fd, kind::pointer, kind::integer, kind::integer>(
+          replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  if (offset.value < 0) {
+    return error{EINVAL};
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+  return read_segments(replica, *fildes, iov.addr, count.value, offset.value);
+}
+
+hook_result sys_close(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args) {
+  auto _t = metrics::sys_close.start();
+
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [fd] = decode<kind::fd>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  return handled{replica.fd_table().close(fd.value)};
+}
+
+hook_result sys_open(sim::replica &replica,
+                     std::span<const std::uint64_t, 6> args) {
+  std::error_code err;
+  auto [path, flags, mode] =
+      decode<kind::path, kind::flags, kind::integer>(replica.runner(), args,
+                                                     err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  std::string name;
+  auto res = read_disk_path(replica, AT_FDCWD, path.addr, name);
+  if (res <= 0) {
+    return res == 0 ? hook_result{passthrough} : error{-res};
+  }
+  return open_on_disk(replica, name, flags.value, mode.value);
+}
+
+hook_result sys_openat(sim::replica &replica,
+                       std::span<const std::uint64_t, 6> args) {
+  std::error_code err;
+  auto [dirfd, path, flags, mode] =
+      decode<kind::dirfd, kind::path, kind::flags, kind::integer>(
+          replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  std::string name;
+  auto res = read_disk_path(replica, dirfd.value, path.addr, name);
+  if (res <= 0) {
+    return res == 0 ? hook_result{passthrough} : error{-res};
+  }
+  return open_on_disk(replica, name, flags.value, mode.value);
+}
+
+hook_result sys_lseek(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [fd, offset, whence] = decode<kind::fd, kind::integer, kind::integer>(
+      replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+  return handled{fildes->seek(offset.value, whence.value)};
+}
+
+// fdatasync has nothing less to do, file metadata is always in memory
+hook_result sys_fsync(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [fd] = decode<kind::fd>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+  return handled{fildes->sync()};
+}
+
+hook_result sys_fdatasync(sim::replica &replica,
+                          std::span<const std::uint64_t, 6> args) {
+  return sys_fsync(replica, args);
+}
+
+hook_result sys_ftruncate(sim::replica &replica,
+                          std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [fd, length] =
+      decode<kind::fd, kind::integer>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+  if (length.value < 0) {
+    return error{EINVAL};
+  }
+  return handled{fildes->truncate(length.value)};
+}
+
+hook_result sys_fstat(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [fd, buf] = decode<kind::fd, kind::pointer>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
+
+  struct stat st;
+  if (auto res = fildes->stat(st); res < 0) {
+    return error{-res};
+  }
+  if (auto res = store_stat(replica, buf.addr, st); res < 0) {
+    return error{-res};
+  }
+  return handled{0};
+}
+
+// Stats a simulated fd itself with AT_EMPTY_PATH, or a file on the disk
+hook_result sys_newfstatat(sim::replica &replica,
+                           std::span<const std::uint64_t, 6> args) {
+  std::error_code err;
+  auto [dirfd, path, buf, flags] =
+      decode<kind::dirfd, kind::path, kind::pointer, kind::flags>(
+          replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  const bool simulated_dirfd =
+      0 <= dirfd.value && sim::file_descriptor_table::is_simulated(dirfd.value);
+  if (!simulated_dirfd && !replica.disk()) {
+    return passthrough;
+  }
+
+  std::string name;
+  if (auto res = read_path(replica, path.addr, name); res < 0) {
+    return error{-res};
+  }
+
+  struct stat st;
+  if (name.empty() && (flags.value & AT_EMPTY_PATH) != 0) {
+    if (!simulated_dirfd) {
+      return passthrough;
+    }
+    auto fildes = replica.fd_table().borrow(dirfd.value);
+    if (!fildes) {
+      return error{EBADF};
+    }
+    if (auto res = fildes->stat(st); res < 0) {
+      return error{-res};
+    }
+  } else {
+    auto res = resolve_path(replica, dirfd.value, name);
+    if (res <= 0) {
+      return res == 0 ? hook_result{passthrough} : error{-res};
+    }
+    auto file = replica.disk()->find(name);
+    if (!file) {
+      return error{ENOENT};
+    }
+    file->stat(st);
+  }
+
+  if (auto res = store_stat(replica, buf.addr, st); res < 0) {
+    return error{-res};
+  }
+  return handled{0};
+}
+
+hook_result sys_unlink(sim::replica &replica,
+                       std::span<const std::uint64_t, 6> args) {
+  std::error_code err;
+  auto [path] = decode<kind::path>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  std::string name;
+  auto res = read_disk_path(replica, AT_FDCWD, path.addr, name);
+  if (res <= 0) {
+    return res == 0 ? hook_result{passthrough} : error{-res};
+  }
+  return handled{replica.disk()->unlink(name)};
+}
+
+hook_result sys_unlinkat(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args) {
+  std::error_code err;
+  auto [dirfd, path, flags] =
+      decode<kind::dirfd, kind::path, kind::flags>(replica.runner(), args,
+                                                   err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  std::string name;
+  auto res = read_disk_path(replica, dirfd.value, path.addr, name);
+  if (res <= 0) {
+    return res == 0 ? hook_result{passthrough} : error{-res};
+  }
+  if ((flags.value & AT_REMOVEDIR) != 0) {
+    return error{replica.disk()->find(name) ? ENOTDIR : ENOENT};
+  }
+  return handled{replica.disk()->unlink(name)};
+}
+
+hook_result sys_socket(sim::replica &replica,
+                       std::span<const std::uint64_t, 6> args) {
+  auto _t = metrics::sys_socket.start();
+
+  std::error_code err;
+  auto [domain, flags, proto] =
+      decode<kind::integer, kind::flags, kind::integer>(replica.runner(), args,
+                                                        err);
+  if (err) {
+    return error{err.value()};
+  }
+  const int type = flags.value & ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+  net::address_family af;
+
+  switch (domain.value) {
+  case AF_INET:
+    af = net::address_family::ipv4;
+    break;
+  case AF_UNIX:
+    af = net::address_family::unix_;
+    break;
+  default:
+    spdlog::warn("unsupported socket address family {}", domain.value);
+    return error{EINVAL};
+  }
+
+  std::shared_ptr<sim::file_descriptor> sock;
+
+  switch (type) {
+  case SOCK_STREAM:
+    sock = std::make_shared<net::stream_socket>(af, replica.sim(),
+                                                replica.machine_id());
+    break;
+  case SOCK_DGRAM:
+    sock = std::make_shared<net::datagram_socket>(af, replica.sim(),
+                                                  replica.machine_id());
+    break;
+  default:
+    spdlog::warn("unsupported socket type {}", type);
+    return error{EINVAL};
+  }
+
+  if ((flags.value & SOCK_NONBLOCK) != 0) {
+    sock->set_status_flags(sock->status_flags() | O_NONBLOCK);
+  }
+
+  auto fd =
+      replica.fd_table().insert(sock, (flags.value & SOCK_CLOEXEC) != 0);
+  if (fd < 0) {
+    return error{EMFILE};
+  }
+
+  return handled{fd};
+}
+
+hook_result sys_socketpair(sim::replica &replica,
+                           std::span<const std::uint64_t, 6> args) {
+  std::error_code err;
+  auto [domain, flags, proto, sv] =
+      decode<kind::integer, kind::flags, kind::integer, kind::pointer>(
+          replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+  const int type = flags.value & ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+  if (domain.value != AF_UNIX) {
+    return error{EOPNOTSUPP};
+  }
+  if (type != SOCK_STREAM) {
+    spdlog::warn("unsupported socketpair type {}", type);
+    return error{EINVAL};
+  }
+
+  auto [first, second] =
+      net::make_socket_pair(replica.sim().initial_options().socket_buffers);
+
+  if ((flags.value & SOCK_NONBLOCK) != 0) {
+    first->set_status_flags(first->status_flags() | O_NONBLOCK);
+    second->set_status_flags(second->status_flags() | O_NONBLOCK);
+  }
+
+  return install_pair(replica, std::move(first), std::move(second), sv.addr,
+                      (flags.value & SOCK_CLOEXEC) != 0);
+}
+
+hook_result sys_sendto(sim::replica &replica,
+                       std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [socket_fd, buffer, length, flags, dst] =
+      decode<kind::fd, kind::in_buf, kind::length, kind::flags,
+             kind::in_sockaddr>(replica.runner(), args, err);
+
+  auto fd = replica.fd_table().borrow(socket_fd.value);
+  if (!fd) {
+    return error{EBADF};
+  }
+
+  if (!fd->is_socket()) {
+    return error{ENOTSOCK};
+  }
+
+  if (err) {
+    return error{err.value()};
+  }
+
+  auto read_data_callback = store_fragment_callback(replica, buffer.addr);
+
+  // Connected sockets ignore the destination, however short it is
+  if (dst.addr == 0 || fd->kind() != sim::fd_kind::datagram_socket) {
+    return handled{raise_sigpipe(
+        replica,
+        static_cast<net::socket &>(*fd).send(read_data_callback, length.value,
+                                             flags.value, nullptr),
+        flags.value)};
+  }
+
+  const auto dst_addr = decode_addr(dst.storage, dst.len, err);
+  if (err) {
+    return error{err.value()};
+  }
+
+  return handled{raise_sigpipe(
+      replica,
+      static_cast<net::socket &>(*fd).send(read_data_callback, length.value,
+                                           flags.value, &dst_addr),
+      flags.value)};
+}
+
+hook_result sys_recvfrom(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [socket_fd, buffer, length, flags, src] =
+      decode<kind::fd, kind::out_buf, kind::length, kind::flags,
+             kind::out_sockaddr>(replica.runner(), args, err);
+
+  auto fd = replica.fd_table().borrow(socket_fd.value);
+  if (!fd) {
+    return error{EBADF};
+  }
+
+  if (!fd->is_socket()) {
+    return error{ENOTSOCK};
+  }
+
+  if (err) {
+    return error{err.value()};
+  }
+
+  // Staged, so that the payload and the sender go back in one transfer
+  std::pmr::vector<std::byte> payload{&sim::scratch()};
+
+  auto &socket = static_cast<net::socket &>(*fd);
+
+  std::optional<net::addr_id> from;
+  auto res =
+      socket.recv(append_to(payload), length.value, flags.value, &from);
+  if (res < 0) {
+    return handled{res};
+  }
+
+  transfer_batch out;
+  out.add(buffer.addr, payload.data(), payload.size());
+
+  sockaddr_storage storage;
+  socklen_t len;
+  if (from) {
+    len = encode_addr(replica.network(), *from, socket.get_af(), storage);
+    src.store(out, storage, len);
+  }
+
+  if (out.write(replica.runner()) < 0) {
+    return error{EFAULT};
+  }
+  return handled{res};
+}
+
+hook_result sys_sendmsg(sim::replica &replica,
+                        std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [socket_fd, msg_arg, flags_arg] =
+      decode<kind::fd, kind::pointer, kind::flags>(replica.runner(), args,
+                                                   err);
+  if (err) {
+    return error{err.value()};
+  }
+  const auto msg = msg_arg.addr;
+  const auto flags = flags_arg.value;
+
+  auto fd = replica.fd_table().borrow(socket_fd.value);
+  if (!fd) {
+    return error{EBADF};
+  }
+
+  if (!fd->is_socket()) {
+    return error{ENOTSOCK};
+  }
+
+  msg_batch batch;
+  auto res = read_msg_header(replica, batch, msg);
+  if (res < 0) {
+    return error{-res};
+  }
+
+  if (fd->kind() == sim::fd_kind::datagram_socket) {
+    auto &socket = static_cast<net::datagram_socket &>(*fd);
+    res = send_msg_batch(replica, socket, batch, flags);
+    if (res < 0) {
+      return error{static_cast<int>(-res)};
+    }
+    return handled{batch.headers[0].msg_len};
+  }
+
+  // Connected sockets ignore the destination address
+  res = read_msg_batch(replica, batch, false);
+  if (res < 0) {
+    return error{-res};
+  }
+
+  std::pmr::vector<std::byte> payload(batch.length(0, batch.iovs),
+                                      &sim::scratch());
+  res = gather(replica, batch.iovs, payload);
+  if (res < 0) {
+    return error{-res};
+  }
+
+  return handled{raise_sigpipe(replica,
+                               static_cast<net::socket &>(*fd).send(
+                                   load_from(payload), payload.size(), flags,
+                                   nullptr),
+                               flags)};
+}
+
+hook_result sys_recvmsg(sim::replica &replica,
+                        std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [socket_fd, msg_arg, flags_arg] =
+      decode<kind::fd, kind::pointer, kind::flags>(replica.runner(), args,
+                                                   err);
+  if (err) {
+    return error{err.value()};
+  }
+  const auto msg = msg_arg.addr;
+  const auto flags = flags_arg.value;
+
+  auto fd = replica.fd_table().borrow(socket_fd.value);
+  if (!fd) {
+    return error{EBADF};
+  }
+
+  if (!fd->is_socket()) {
+    return error{ENOTSOCK};
+  }
+
+  msg_batch batch;
+  auto res = read_msg_header(replica, batch, msg);
+  if (res < 0) {
+    return error{-res};
+  }
+
+  if (fd->kind() == sim::fd_kind::datagram_socket) {
+    auto &socket = static_cast<net::datagram_socket &>(*fd);
+    res = recv_msg_batch(replica, socket, batch, msg, true,
+                         flags | MSG_WAITFORONE);
+    if (res < 0) {
+      return error{static_cast<int>(-res)};
+    }
+    return handled{batch.headers[0].msg_len};
+  }
+
+  // Connected sockets have no per-message sender
+  res = read_msg_batch(replica, batch, false);
+  if (res < 0) {
+    return error{-res};
+  }
+
+  std::pmr::vector<std::byte> payload{&sim::scratch()};
+  auto n = static_cast<net::socket &>(*fd).recv(
+      append_to(payload), batch.length(0, batch.iovs), flags, nullptr);
+  if (n < 0) {
+    return handled{n};
+  }
+
+  res = scatter(replica, payload, batch.iovs);
+  if (res < 0) {
+    return error{-res};
+  }
+  return handled{n};
+}
+
+hook_result sys_sendmmsg(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
+
+  std::error_code err;
+  auto [socket_fd, msgvec_arg, vlen_arg, flags_arg] =
+      decode<kind::fd, kind::pointer, kind::integer, kind::flags>(
+          replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+  const auto msgvec = msgvec_arg.addr;
+  const auto vlen = static_cast<unsigned int>(vlen_arg.value);
+  const auto flags = flags_arg.value;
+
+  auto fd = replica.fd_table().borrow(socket_fd.value);
+  if (!fd) {
+    return error{EBADF};
+  }
+
+  if (fd->kind() != sim::fd_kind::datagram_socket) {
+    return error{fd->is_socket() ? EOPNOTSUPP : ENOTSOCK};
+  }
+  auto &socket = static_cast<net::datagram_socket &>(*fd);
+
+  if (vlen == 0) {
+    return handled{0};
+  }
 
-  struct sockaddr_storage addr_storage;
+  msg_batch batch;
+  auto res = read_msg_headers(replica, batch, msgvec, vlen);
+  if (res < 0) {
+    return error{-res};
+  }
 
-  if (sizeof(addr_storage) < dest_len || dest_len < 2) {
-    err = std::error_code{EINVAL, std::generic_category()};
-    return {};
+  auto sent = send_msg_batch(replica, socket, batch, flags);
+  if (sent <= 0) {
+    return handled{sent};
   }
 
-  std::vector<std::byte> dest{dest_len, std::byte{}};
-  if (0 > replica.runner().read_memory(dest_addr, dest)) {
-    err = std::error_code{EFAULT, std::generic_category()};
-    return {};
+  // Report each message's length back through msg_len
+  res = replica.runner().write_memory(
+      msgvec, std::as_bytes(std::span{batch.headers}.first(sent)));
+  if (res < 0) {
+    return error{-res};
   }
+  return handled{sent};
+}
 
-  memcpy(&addr_storage, dest.data(), dest.size());
+hook_result sys_recvmmsg(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
 
-  net::address_family af;
+  std::error_code err;
+  auto [socket_fd, msgvec_arg, vlen_arg, flags_arg] =
+      decode<kind::fd, kind::pointer, kind::integer, kind::flags>(
+          replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+  const auto msgvec = msgvec_arg.addr;
+  const auto vlen = static_cast<unsigned int>(vlen_arg.value);
+  const auto flags = flags_arg.value;
 
-  switch (addr_storage.ss_family) {
-  case AF_INET: {
-    auto in_addr = reinterpret_cast<const sockaddr_in *>(&addr_storage);
-    net::ipv4_addr ip_addr{};
+  auto fd = replica.fd_table().borrow(socket_fd.value);
+  if (!fd) {
+    return error{EBADF};
+  }
 
-    memcpy(ip_addr.octets, &in_addr->sin_addr, 4);
-    ip_addr.port = in_addr->sin_port;
+  if (fd->kind() != sim::fd_kind::datagram_socket) {
+    return error{fd->is_socket() ? EOPNOTSUPP : ENOTSOCK};
+  }
+  auto &socket = static_cast<net::datagram_socket &>(*fd);
 
-    return ip_addr;
+  if (vlen == 0) {
+    return handled{0};
   }
-  case AF_UNIX: {
-    auto un_addr = reinterpret_cast<const sockaddr_un *>(&addr_storage);
 
-    std::string path;
+  // The timeout argument is not simulated: calls wait as if it were NULL
+  msg_batch batch;
+  auto res = read_msg_headers(replica, batch, msgvec, vlen);
+  if (res < 0) {
+    return error{-res};
+  }
 
-    for (size_t i = offsetof(struct sockaddr_un, sun_path); i < dest_len; ++i) {
-      char c = un_addr->sun_path[i];
-      if (c == '\0')
-        break;
-      if (i == dest_len - 1) {
-        err = std::error_code{EINVAL, std::generic_category()};
-        return {};
-      }
-      path.push_back(c);
-    }
+  return handled{recv_msg_batch(replica, socket, batch, msgvec, false, flags)};
+}
 
-    return net::unix_addr{std::move(path)};
+hook_result sys_connect(sim::replica &replica,
+                        std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
   }
-  default: {
-    err = std::error_code{ENOTSUP, std::generic_category()};
-    return {};
+
+  std::error_code err;
+  auto [sockfd, addr] =
+      decode<kind::fd, kind::in_sockaddr>(replica.runner(), args, err);
+  if (!err && addr.addr == 0) {
+    err = std::error_code{EFAULT, std::generic_category()};
   }
+  if (err) {
+    return error{err.value()};
   }
-}
-} // namespace
-
-hook_result sys_write(sim::replica &replica,
-                      std::span<const std::uint64_t, 6> args) {
-  int fd = args[0];
-  uintptr_t ptr = args[1];
-  size_t len = args[2];
 
-  auto &fd_table = replica.fd_table();
+  auto sock_addr = decode_addr(addr.storage, addr.len, err);
+  if (err) {
+    return error{err.value()};
+  }
 
-  std::shared_ptr<sim::file_descriptor> fildes;
+  auto sock = replica.fd_table().borrow(sockfd.value);
+  if (!sock) {
+    return error{EBADF};
+  }
+  if (!sock->is_socket()) {
+    return error{ENOTSOCK};
+  }
+  return handled{static_cast<net::socket &>(*sock).connect(sock_addr)};
+}
 
-  if (!fd_table.is_simulated(fd)) {
+hook_result sys_shutdown(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
     return passthrough;
   }
 
-  fildes = fd_table.get(fd);
-  if (!fildes) {
-    return error{EBADF};
+  std::error_code err;
+  auto [sockfd, how] =
+      decode<kind::fd, kind::integer>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
   }
 
-  auto store = store_fragment_callback(replica, ptr);
-  auto res = fildes->write(store, len);
-  return handled{res};
+  auto fd = replica.fd_table().borrow(sockfd.value);
+  if (!fd) {
+    return error{EBADF};
+  }
+  if (!fd->is_socket()) {
+    return error{ENOTSOCK};
+  }
+  return handled{static_cast<net::socket &>(*fd).shutdown(how.value)};
 }
 
-hook_result sys_read(sim::replica &replica,
+hook_result sys_bind(sim::replica &replica,
                      std::span<const std::uint64_t, 6> args) {
-  int fd = args[0];
-  uintptr_t ptr = args[1];
-  size_t len = args[2];
-
-  auto &fd_table = replica.fd_table();
-
-  if (!fd_table.is_simulated(fd)) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
     return passthrough;
   }
 
-  auto fildes = fd_table.get(fd);
-  if (!fildes) {
+  std::error_code err;
+  auto [socket_fd, addr_arg] =
+      decode<kind::fd, kind::in_sockaddr>(replica.runner(), args, err);
+
+  auto fd = replica.fd_table().borrow(socket_fd.value);
+  if (!fd) {
     return error{EBADF};
   }
 
-  auto store = [&replica, addr = ptr](auto fragment) {
-    auto &runner = replica.runner();
-    return runner.write_memory(addr, fragment);
-  };
+  if (!fd->is_socket()) {
+    return error{ENOTSOCK};
+  }
 
-  auto res = fildes->read(store, len);
-  return handled{res};
-}
+  if (!err && addr_arg.addr == 0) {
+    err = std::error_code{EFAULT, std::generic_category()};
+  }
+  if (err) {
+    return error{err.value()};
+  }
 
-hook_result sys_close(sim::replica &replica,
-                      std::span<const std::uint64_t, 6> args) {
-  auto _t = metrics::sys_close.start();
+  auto addr = decode_addr(addr_arg.storage, addr_arg.len, err);
+  if (err) {
+    return error{err.value()};
+  }
 
-  int fd = args[0];
+  return handled{static_cast<net::socket &>(*fd).bind(addr)};
+}
 
-  if (!sim::file_descriptor_table::is_simulated(fd))
+hook_result sys_fcntl(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
     return passthrough;
+  }
 
-  auto &fd_table = replica.fd_table();
-
-  return handled{fd_table.close(fd)};
-}
+  std::error_code err;
+  auto [fd, cmd, arg] = decode<kind::fd, kind::integer, kind::integer>(
+      replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
+  // Every command handled here takes an int
+  const int flags = static_cast<int>(arg.value);
 
-hook_result sys_open(sim::replica &replica,
-                     std::span<const std::uint64_t> args) {
-  uintptr_t path = args[0];
-  int oflag = args[1];
-  int mode = args[2];
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
+    return error{EBADF};
+  }
 
-  return passthrough;
+  switch (cmd.value) {
+  case F_GETFL:
+    return handled{fildes->status_flags()};
+  case F_SETFL: {
+    // Like Linux, silently ignore flags that cannot be changed after open
+    constexpr int settable = O_APPEND | O_NONBLOCK;
+    const int status = fildes->status_flags();
+    fildes->set_status_flags((status & ~settable) | (flags & settable));
+    return handled{0};
+  }
+  case F_GETFD:
+    return handled{replica.fd_table().fd_flags(fd.value)};
+  case F_SETFD:
+    return handled{replica.fd_table().set_fd_flags(fd.value, flags)};
+  case F_DUPFD:
+  case F_DUPFD_CLOEXEC:
+    return handled{replica.fd_table().dup(fd.value, flags,
+                                          cmd.value == F_DUPFD_CLOEXEC)};
+  default:
+    spdlog::warn("unsupported fcntl command {}", cmd.value);
+    return error{EINVAL};
+  }
 }
 
-hook_result sys_socket(sim::replica &replica,
-                       std::span<const std::uint64_t, 6> args) {
-  auto _t = metrics::sys_socket.start();
+hook_result sys_dup(sim::replica &replica,
+                    std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
+  }
 
-  int domain = args[0];
-  int type = args[1];
-  int proto = args[2];
+  std::error_code err;
+  auto [oldfd] = decode<kind::fd>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
 
-  net::address_family af;
+  return handled{replica.fd_table().dup(oldfd.value, 0, false)};
+}
 
-  switch (domain) {
-  case AF_INET:
-    af = net::address_family::ipv4;
-    break;
-  case AF_UNIX:
-    af = net::address_family::unix_;
-    break;
-  default:
-    spdlog::warn("unsupported socket address family {}", domain);
-    return error{EINVAL};
+// Real fds are left to the kernel, which rejects simulated new fds as out of
+// range. A simulated fd cannot be duplicated onto a real one: the seccomp
+// filter, fixed when the tracee starts, only stops calls on real fds for
+// standard output and error, so the tracee's later calls on that number would
+// bypass the simulation. Those fail with ENOTSUP rather than half work.
+hook_result sys_dup3(sim::replica &replica,
+                     std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
+    return passthrough;
   }
 
-  net::socket_type socket_type;
-
-  std::shared_ptr<sim::file_descriptor> sock;
+  std::error_code err;
+  auto [oldfd, newfd, flags] =
+      decode<kind::fd, kind::fd, kind::flags>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
 
-  switch (type) {
-  case SOCK_STREAM:
-    sock = std::make_shared<net::stream_socket>(af);
-    break;
-  case SOCK_DGRAM:
-    sock = std::make_shared<net::datagram_socket>(af, replica.sim());
-    break;
-  default:
-    spdlog::warn("unsupported socket type {}", type);
+  if ((flags.value & ~O_CLOEXEC) != 0 || oldfd.value == newfd.value) {
     return error{EINVAL};
   }
 
-  auto fd = replica.fd_table().insert(sock);
-  if (fd < 0) {
-    return error{EMFILE};
+  if (!sim::file_descriptor_table::is_simulated(newfd.value)) {
+    spdlog::warn("cannot duplicate simulated fd onto real fd {}",
+                 newfd.value);
+    return error{ENOTSUP};
   }
 
-  return handled{fd};
+  return handled{replica.fd_table().dup_to(oldfd.value, newfd.value,
+                                           (flags.value & O_CLOEXEC) != 0)};
 }
 
-hook_result sys_sendto(sim::replica &replica,
-                       std::span<const std::uint64_t, 6> args) {
-  const int socket_fd = args[0];
-  const uintptr_t buffer = args[1];
-  const size_t length = args[2];
-  const int flags = args[3];
-  const uintptr_t dest_addr = args[4];
-  const size_t dest_len = args[5];
-
-  if (!replica.fd_table().is_simulated(socket_fd))
+hook_result sys_dup2(sim::replica &replica,
+                     std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
     return passthrough;
+  }
 
   std::error_code err;
-  const auto dst_addr = parse_addr(replica, dest_addr, dest_len, err);
-
+  auto [oldfd, newfd] = decode<kind::fd, kind::fd>(replica.runner(), args, err);
   if (err) {
     return error{err.value()};
   }
 
-  auto fd = replica.fd_table().get(socket_fd);
-  if (!fd) {
-    return error{EBADF};
+  // See sys_dup3
+  if (!sim::file_descriptor_table::is_simulated(newfd.value)) {
+    spdlog::warn("cannot duplicate simulated fd onto real fd {}",
+                 newfd.value);
+    return error{ENOTSUP};
   }
 
-  auto socket = std::dynamic_pointer_cast<net::datagram_socket>(fd);
-  if (!socket) {
-    return error{ENOTSOCK};
+  // Unlike dup3, duplicating an fd onto itself just checks that it is open
+  return handled{replica.fd_table().dup_to(oldfd.value, newfd.value, false)};
+}
+
+hook_result sys_pipe2(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args) {
+  std::error_code err;
+  auto [pipefd, flags] =
+      decode<kind::pointer, kind::flags>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
   }
 
-  auto read_data_callback = store_fragment_callback(replica, buffer);
-  return handled{socket->send_to(read_data_callback, length, dst_addr)};
-}
+  if ((flags.value & ~(O_NONBLOCK | O_CLOEXEC)) != 0) {
+    spdlog::warn("unsupported pipe2 flags {}", flags.value);
+    return error{EINVAL};
+  }
 
-hook_result sys_recvfrom(sim::replica &replica,
-                         std::span<const std::uint64_t, 6> args) {
-  const int socket_fd = args[0];
-  const uintptr_t buffer = args[1];
-  const size_t length = args[2];
-  const int flags = args[3];
-  const uintptr_t dest_addr = args[4];
-  const size_t dest_len = args[5];
-
-  if (!replica.fd_table().is_simulated(socket_fd))
-    return passthrough;
+  auto [reader, writer] = sim::make_pipe();
+  reader->set_status_flags(O_RDONLY | (flags.value & O_NONBLOCK));
+  writer->set_status_flags(O_WRONLY | (flags.value & O_NONBLOCK));
+
+  return install_pair(replica, std::move(reader), std::move(writer),
+                      pipefd.addr, (flags.value & O_CLOEXEC) != 0);
+}
 
-  // std::error_code err;
-  // const auto dst_addr = parse_addr(replica, dest_addr, dest_len, err);
+hook_result sys_pipe(sim::replica &replica,
+                     std::span<const std::uint64_t, 6> args) {
+  const std::uint64_t pipe2_args[6] = {args[0], 0};
+  return sys_pipe2(replica, pipe2_args);
+}
 
-  // if (err) {
-  //   return error{err.value()};
-  // }
+hook_result sys_eventfd2(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args) {
+  std::error_code err;
+  auto [initval, flags] =
+      decode<kind::integer, kind::flags>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
 
-  auto fd = replica.fd_table().get(socket_fd);
-  if (!fd) {
-    return error{EBADF};
+  if ((flags.value & ~(EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE)) != 0) {
+    return error{EINVAL};
   }
 
-  auto socket = std::dynamic_pointer_cast<net::datagram_socket>(fd);
-  if (!socket) {
-    return error{ENOTSOCK};
+  // The count starts from the low 32 bits, as initval is an unsigned int
+  auto efd = std::make_shared<sim::eventfd_file_descriptor>(
+      static_cast<unsigned int>(initval.value),
+      (flags.value & EFD_SEMAPHORE) != 0);
+  if ((flags.value & EFD_NONBLOCK) != 0) {
+    efd->set_status_flags(efd->status_flags() | O_NONBLOCK);
   }
 
-  auto write_data_callback = load_fragment_callback(replica, buffer);
-  net::socket_addr addr;
-  auto res = socket->recv_from(write_data_callback, length, &addr);
-  return handled{res};
+  auto fd = replica.fd_table().insert(efd, (flags.value & EFD_CLOEXEC) != 0);
+  if (fd < 0) {
+    return error{EMFILE};
+  }
+  return handled{fd};
 }
 
-hook_result sys_connect(sim::replica &replica,
+hook_result sys_eventfd(sim::replica &replica,
                         std::span<const std::uint64_t, 6> args) {
-  int sockfd = args[0];
-  uintptr_t addr = args[1];
-  size_t addr_len = args[2];
+  const std::uint64_t eventfd2_args[6] = {args[0], 0};
+  return sys_eventfd2(replica, eventfd2_args);
+}
 
-  if (!replica.fd_table().is_simulated(sockfd)) {
+hook_result sys_setsockopt(sim::replica &replica,
+                           std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
     return passthrough;
   }
 
   std::error_code err;
-  auto sock_addr = parse_addr(replica, addr, addr_len, err);
+  auto [fd, level, optname, optval, optlen] =
+      decode<kind::fd, kind::integer, kind::integer, kind::in_buf,
+             kind::length>(replica.runner(), args, err);
   if (err) {
     return error{err.value()};
   }
+  const int name = static_cast<int>(optname.value);
+  const auto len = static_cast<socklen_t>(optlen.value);
 
-  auto sock = replica.fd_table().get(sockfd);
-  if (!sock) {
+  auto fildes = replica.fd_table().borrow(fd.value);
+  if (!fildes) {
     return error{EBADF};
   }
-  auto s = std::dynamic_pointer_cast<net::socket>(sock);
-  if (!s) {
+  if (!fildes->is_socket()) {
     return error{ENOTSOCK};
   }
 
-  auto peer = replica.network().get(sock_addr);
-
-  if (!peer) {
-    return error{ECONNREFUSED};
+  if (level.value == IPPROTO_IP) {
+    return ip_setsockopt(replica, *fildes, name, optval.addr, len);
   }
+  auto &socket = static_cast<net::socket &>(*fildes);
 
-  auto s2 = std::dynamic_pointer_cast<net::stream_socket>(s);
+  if (level.value != SOL_SOCKET) {
+    spdlog::warn("unsupported setsockopt level {}", level.value);
+    return error{ENOPROTOOPT};
+  }
 
-  if (!s2) {
-    return error{EOPNOTSUPP};
+  int value;
+  if (len < sizeof(value)) {
+    return error{EINVAL};
+  }
+  if (0 > replica.runner().read_memory(
+              optval.addr, std::as_writable_bytes(std::span{&value, 1}))) {
+    return error{EFAULT};
   }
 
-  auto peer2 = std::dynamic_pointer_cast<net::stream_socket>(peer);
-  if (!peer2 || peer2->listening()) {
-    return error{ECONNREFUSED};
+  // Negative sizes are treated as zero and end up at the minimum
+  const auto size = static_cast<std::size_t>(std::max(value, 0));
+
+  switch (name) {
+  case SO_SNDBUF:
+  case SO_SNDBUFFORCE:
+    socket.set_send_buffer_size(size, name == SO_SNDBUFFORCE);
+    return handled{0};
+  case SO_RCVBUF:
+  case SO_RCVBUFFORCE:
+    socket.set_recv_buffer_size(size, name == SO_RCVBUFFORCE);
+    return handled{0};
+  case SO_BROADCAST:
+    // Only datagram sockets can broadcast, others accept and ignore it
+    if (fildes->kind() == sim::fd_kind::datagram_socket) {
+      static_cast<net::datagram_socket &>(*fildes).set_broadcast(value != 0);
+    }
+    return handled{0};
+  default:
+    spdlog::warn("unsupported socket option {}", name);
+    return error{ENOPROTOOPT};
   }
-  return handled{s2->connect(peer2)};
 }
 
-hook_result sys_bind(sim::replica &replica,
-                     std::span<const std::uint64_t, 6> args) {
-  int arg_socket_fd = args[0];
-  uintptr_t arg_addr = args[1];
-  size_t arg_addr_len = args[2];
-
-  if (!replica.fd_table().is_simulated(arg_socket_fd)) {
+hook_result sys_getsockopt(sim::replica &replica,
+                           std::span<const std::uint64_t, 6> args) {
+  if (!sim::file_descriptor_table::is_simulated(args[0])) {
     return passthrough;
   }
 
-  auto fd = replica.fd_table().get(arg_socket_fd);
+  std::error_code err;
+  auto [arg_fd, arg_level, arg_optname, arg_optval, arg_optlen] =
+      decode<kind::fd, kind::integer, kind::integer, kind::out_buf,
+             kind::socklen_ptr>(replica.runner(), args, err);
+
+  auto fd = replica.fd_table().borrow(arg_fd.value);
   if (!fd) {
     return error{EBADF};
   }
-
-  auto sock = std::dynamic_pointer_cast<net::socket>(fd);
-  if (!sock) {
+  if (!fd->is_socket()) {
     return error{ENOTSOCK};
   }
-
-  std::error_code err;
-  auto addr = parse_addr(replica, arg_addr, arg_addr_len, err);
-
   if (err) {
     return error{err.value()};
   }
+  const auto &socket = static_cast<const net::socket &>(*fd);
 
-  err = replica.network().bind(addr, sock);
+  if (arg_level.value != SOL_SOCKET) {
+    spdlog::warn("unsupported getsockopt level {}", arg_level.value);
+    return error{ENOPROTOOPT};
+  }
 
-  if (err) {
-    return error{err.value()};
+  int value;
+  switch (arg_optname.value) {
+  case SO_SNDBUF:
+    value = socket.send_buffer_size();
+    break;
+  case SO_RCVBUF:
+    value = socket.recv_buffer_size();
+    break;
+  case SO_TYPE:
+    value = socket.type() == net::socket_type::stream ? SOCK_STREAM
+                                                       : SOCK_DGRAM;
+    break;
+  case SO_ERROR:
+    value = 0;
+    break;
+  case SO_BROADCAST:
+    value = fd->kind() == sim::fd_kind::datagram_socket &&
+            static_cast<const net::datagram_socket &>(*fd).broadcast();
+    break;
+  default:
+    spdlog::warn("unsupported socket option {}", arg_optname.value);
+    return error{ENOPROTOOPT};
   }
 
+  // Like Linux, a short buffer gets a truncated value
+  const auto len = std::min<socklen_t>(arg_optlen.value, sizeof(value));
+
+  transfer_batch out;
+  out.add(arg_optval.addr, &value, len);
+  out.add(arg_optlen.addr, &len, sizeof(len));
+  if (out.write(replica.runner()) < 0) {
+    return error{EFAULT};
+  }
   return handled{0};
 }
 
@@ -378,18 +1992,18 @@ hook_result sys_clock_gettime(sim::replica &replica,
 
 hook_result sys_clock_nanosleep(sim::replica &replica,
                                 std::span<const std::uint64_t, 6> args) {
-  const int arg_clockid = args[0];
-  const int arg_flags = args[1];
-  const uintptr_t arg_request = args[2];
-  const uintptr_t arg_remain = args[3];
-
-  timespec tm;
-
-  auto res = replica.runner().read_memory(
-      arg_request, std::as_writable_bytes(std::span<timespec, 1>{&tm, 1}));
-  if (res < 0) {
-    return error{-res};
+  std::error_code err;
+  auto [clockid, flags, request] =
+      decode<kind::integer, kind::flags, kind::in_timespec>(replica.runner(),
+                                                            args, err);
+  if (!err && request.addr == 0) {
+    err = std::error_code{EFAULT, std::generic_category()};
+  }
+  if (err) {
+    return error{err.value()};
   }
+
+  const auto &tm = request.value;
   auto time_scale = replica.sim().initial_options().time_scale;
 
   auto duration =
@@ -401,10 +2015,13 @@ hook_result sys_clock_nanosleep(sim::replica &replica,
 
 hook_result sys_clock_gettime(sim::replica &replica,
                               std::span<const std::uint64_t, 6> args) {
-  const int arg_clockid = args[0];
-  const uintptr_t arg_res = args[1];
+  std::error_code err;
+  auto [clockid, res_arg] =
+      decode<kind::integer, kind::out_timespec>(replica.runner(), args, err);
+  if (err) {
+    return error{err.value()};
+  }
 
-  auto now = sim::clock::now();
   auto time_scale = replica.sim().initial_options().time_scale;
   auto since_epoch = sim::clock::now() - replica.epoch();
   auto scaled_since_epoch = since_epoch / time_scale;
@@ -420,11 +2037,10 @@ hook_result sys_clock_gettime(sim::replica &replica,
       .tv_nsec = tv_nsec.count(),
   };
 
-  auto res = replica.runner().write_memory(
-      arg_res, std::as_bytes(std::span<timespec>{&tm, 1}));
-
-  if (res < 0) {
-    return error{-res};
+  transfer_batch out;
+  out.add(res_arg.addr, &tm, sizeof(tm));
+  if (out.write(replica.runner()) < 0) {
+    return error{EFAULT};
   }
   return handled{0};
 }
@@ -8,22 +8,84 @@ hook_result sys_write(sim::replica &replica,
                       std::span<const std::uint64_t, 6> args);
 hook_result sys_read(sim::replica &replica,
                      std::span<const std::uint64_t, 6> args);
+hook_result sys_pwrite64(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args);
+hook_result sys_pread64(sim::replica &replica,
+                        std::span<const std::uint64_t, 6> args);
+hook_result sys_writev(sim::replica &replica,
+                       std::span<const std::uint64_t, 6> args);
+hook_result sys_readv(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args);
+hook_result sys_pwritev(sim::replica &replica,
+                        std::span<const std::uint64_t, 6> args);
+hook_result sys_preadv(sim::replica &replica,
+                       std::span<const std::uint64_t, 6> args);
 hook_result sys_close(sim::replica &replica,
                       std::span<const std::uint64_t, 6> args);
 hook_result sys_open(sim::replica &replica,
                      std::span<const std::uint64_t, 6> args);
+hook_result sys_openat(sim::replica &replica,
+                       std::span<const std::uint64_t, 6> args);
+hook_result sys_lseek(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args);
+hook_result sys_fsync(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args);
+hook_result sys_fdatasync(sim::replica &replica,
+                          std::span<const std::uint64_t, 6> args);
+hook_result sys_ftruncate(sim::replica &replica,
+                          std::span<const std::uint64_t, 6> args);
+hook_result sys_fstat(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args);
+hook_result sys_newfstatat(sim::replica &replica,
+                           std::span<const std::uint64_t, 6> args);
+hook_result sys_unlink(sim::replica &replica,
+                       std::span<const std::uint64_t, 6> args);
+hook_result sys_unlinkat(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args);
 hook_result sys_socket(sim::replica &replica,
                        std::span<const std::uint64_t, 6> args);
+hook_result sys_socketpair(sim::replica &replica,
+                           std::span<const std::uint64_t, 6> args);
 hook_result sys_sendto(sim::replica &replica,
                        std::span<const std::uint64_t, 6> args);
 hook_result sys_recvfrom(sim::replica &replica,
                          std::span<const std::uint64_t, 6> args);
+hook_result sys_sendmsg(sim::replica &replica,
+                        std::span<const std::uint64_t, 6> args);
+hook_result sys_recvmsg(sim::replica &replica,
+                        std::span<const std::uint64_t, 6> args);
+hook_result sys_sendmmsg(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args);
+hook_result sys_recvmmsg(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args);
 hook_result sys_connect(sim::replica &replica,
                         std::span<const std::uint64_t, 6> args);
 hook_result sys_read(sim::replica &replica,
                      std::span<const std::uint64_t, 6> args);
+hook_result sys_shutdown(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args);
 hook_result sys_bind(sim::replica &replica,
                      std::span<const std::uint64_t, 6> args);
+hook_result sys_fcntl(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args);
+hook_result sys_dup(sim::replica &replica,
+                    std::span<const std::uint64_t, 6> args);
+hook_result sys_dup2(sim::replica &replica,
+                     std::span<const std::uint64_t, 6> args);
+hook_result sys_dup3(sim::replica &replica,
+                     std::span<const std::uint64_t, 6> args);
+hook_result sys_pipe(sim::replica &replica,
+                     std::span<const std::uint64_t, 6> args);
+hook_result sys_pipe2(sim::replica &replica,
+                      std::span<const std::uint64_t, 6> args);
+hook_result sys_eventfd(sim::replica &replica,
+                        std::span<const std::uint64_t, 6> args);
+hook_result sys_eventfd2(sim::replica &replica,
+                         std::span<const std::uint64_t, 6> args);
+hook_result sys_setsockopt(sim::replica &replica,
+                           std::span<const std::uint64_t, 6> args);
+hook_result sys_getsockopt(sim::replica &replica,
+                           std::span<const std::uint64_t, 6> args);
 hook_result sys_clock_gettime(sim::replica &replica,
                               std::span<const std::uint64_t, 6> args);
 hook_result sys_clock_nanosleep(sim::replica &replica,
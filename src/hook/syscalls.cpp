@@ -1,704 +1,541 @@
 #include "hook/syscalls.hpp"
 
+#include <sys/syscall.h>
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+#include "hook/impls.hpp"
+
 namespace redstone::hook {
+namespace {
+using enum arg_kind;
+
+constexpr std::pair<std::uint64_t, std::string_view> names[] = {
+    {0, "read"},
+    {1, "write"},
+    {2, "open"},
+    {3, "close"},
+    {4, "stat"},
+    {5, "fstat"},
+    {6, "lstat"},
+    {7, "poll"},
+    {8, "lseek"},
+    {9, "mmap"},
+    {10, "mprotect"},
+    {11, "munmap"},
+    {12, "brk"},
+    {13, "rt_sigaction"},
+    {14, "rt_sigprocmask"},
+    {15, "rt_sigreturn"},
+    {16, "ioctl"},
+    {17, "pread64"},
+    {18, "pwrite64"},
+    {19, "readv"},
+    {20, "writev"},
+    {21, "access"},
+    {22, "pipe"},
+    {23, "select"},
+    {24, "sched_yield"},
+    {25, "mremap"},
+    {26, "msync"},
+    {27, "mincore"},
+    {28, "madvise"},
+    {29, "shmget"},
+    {30, "shmat"},
+    {31, "shmctl"},
+    {32, "dup"},
+    {33, "dup2"},
+    {34, "pause"},
+    {35, "nanosleep"},
+    {36, "getitimer"},
+    {37, "alarm"},
+    {38, "setitimer"},
+    {39, "getpid"},
+    {40, "sendfile"},
+    {41, "socket"},
+    {42, "connect"},
+    {43, "accept"},
+    {44, "sendto"},
+    {45, "recvfrom"},
+    {46, "sendmsg"},
+    {47, "recvmsg"},
+    {48, "shutdown"},
+    {49, "bind"},
+    {50, "listen"},
+    {51, "getsockname"},
+    {52, "getpeername"},
+    {53, "socketpair"},
+    {54, "setsockopt"},
+    {55, "getsockopt"},
+    {56, "clone"},
+    {57, "fork"},
+    {58, "vfork"},
+    {59, "execve"},
+    {60, "exit"},
+    {61, "wait4"},
+    {62, "kill"},
+    {63, "uname"},
+    {64, "semget"},
+    {65, "semop"},
+    {66, "semctl"},
+    {67, "shmdt"},
+    {68, "msgget"},
+    {69, "msgsnd"},
+    {70, "msgrcv"},
+    {71, "msgctl"},
+    {72, "fcntl"},
+    {73, "flock"},
+    {74, "fsync"},
+    {75, "fdatasync"},
+    {76, "truncate"},
+    {77, "ftruncate"},
+    {78, "getdents"},
+    {79, "getcwd"},
+    {80, "chdir"},
+    {81, "fchdir"},
+    {82, "rename"},
+    {83, "mkdir"},
+    {84, "rmdir"},
+    {85, "creat"},
+    {86, "link"},
+    {87, "unlink"},
+    {88, "symlink"},
+    {89, "readlink"},
+    {90, "chmod"},
+    {91, "fchmod"},
+    {92, "chown"},
+    {93, "fchown"},
+    {94, "lchown"},
+    {95, "umask"},
+    {96, "gettimeofday"},
+    {97, "getrlimit"},
+    {98, "getrusage"},
+    {99, "sysinfo"},
+    {100, "times"},
+    {101, "ptrace"},
+    {102, "getuid"},
+    {103, "syslog"},
+    {104, "getgid"},
+    {105, "setuid"},
+    {106, "setgid"},
+    {107, "geteuid"},
+    {108, "getegid"},
+    {109, "setpgid"},
+    {110, "getppid"},
+    {111, "getpgrp"},
+    {112, "setsid"},
+    {113, "setreuid"},
+    {114, "setregid"},
+    {115, "getgroups"},
+    {116, "setgroups"},
+    {117, "setresuid"},
+    {118, "getresuid"},
+    {119, "setresgid"},
+    {120, "getresgid"},
+    {121, "getpgid"},
+    {122, "setfsuid"},
+    {123, "setfsgid"},
+    {124, "getsid"},
+    {125, "capget"},
+    {126, "capset"},
+    {127, "rt_sigpending"},
+    {128, "rt_sigtimedwait"},
+    {129, "rt_sigqueueinfo"},
+    {130, "rt_sigsuspend"},
+    {131, "sigaltstack"},
+    {132, "utime"},
+    {133, "mknod"},
+    {134, "uselib"},
+    {135, "personality"},
+    {136, "ustat"},
+    {137, "statfs"},
+    {138, "fstatfs"},
+    {139, "sysfs"},
+    {140, "getpriority"},
+    {141, "setpriority"},
+    {142, "sched_setparam"},
+    {143, "sched_getparam"},
+    {144, "sched_setscheduler"},
+    {145, "sched_getscheduler"},
+    {146, "sched_get_priority_max"},
+    {147, "sched_get_priority_min"},
+    {148, "sched_rr_get_interval"},
+    {149, "mlock"},
+    {150, "munlock"},
+    {151, "mlockall"},
+    {152, "munlockall"},
+    {153, "vhangup"},
+    {154, "modify_ldt"},
+    {155, "pivot_root"},
+    {156, "_sysctl"},
+    {157, "prctl"},
+    {158, "arch_prctl"},
+    {159, "adjtimex"},
+    {160, "setrlimit"},
+    {161, "chroot"},
+    {162, "sync"},
+    {163, "acct"},
+    {164, "settimeofday"},
+    {165, "mount"},
+    {166, "umount2"},
+    {167, "swapon"},
+    {168, "swapoff"},
+    {169, "reboot"},
+    {170, "sethostname"},
+    {171, "setdomainname"},
+    {172, "iopl"},
+    {173, "ioperm"},
+    {174, "create_module"},
+    {175, "init_module"},
+    {176, "delete_module"},
+    {177, "get_kernel_syms"},
+    {178, "query_module"},
+    {179, "quotactl"},
+    {180, "nfsservctl"},
+    {181, "getpmsg"},
+    {182, "putpmsg"},
+    {183, "afs_syscall"},
+    {184, "tuxcall"},
+    {185, "security"},
+    {186, "gettid"},
+    {187, "readahead"},
+    {188, "setxattr"},
+    {189, "lsetxattr"},
+    {190, "fsetxattr"},
+    {191, "getxattr"},
+    {192, "lgetxattr"},
+    {193, "fgetxattr"},
+    {194, "listxattr"},
+    {195, "llistxattr"},
+    {196, "flistxattr"},
+    {197, "removexattr"},
+    {198, "lremovexattr"},
+    {199, "fremovexattr"},
+    {200, "tkill"},
+    {201, "time"},
+    {202, "futex"},
+    {203, "sched_setaffinity"},
+    {204, "sched_getaffinity"},
+    {205, "set_thread_area"},
+    {206, "io_setup"},
+    {207, "io_destroy"},
+    {208, "io_getevents"},
+    {209, "io_submit"},
+    {210, "io_cancel"},
+    {211, "get_thread_area"},
+    {212, "lookup_dcookie"},
+    {213, "epoll_create"},
+    {214, "epoll_ctl_old"},
+    {215, "epoll_wait_old"},
+    {216, "remap_file_pages"},
+    {217, "getdents64"},
+    {218, "set_tid_address"},
+    {219, "restart_syscall"},
+    {220, "semtimedop"},
+    {221, "fadvise64"},
+    {222, "timer_create"},
+    {223, "timer_settime"},
+    {224, "timer_gettime"},
+    {225, "timer_getoverrun"},
+    {226, "timer_delete"},
+    {227, "clock_settime"},
+    {228, "clock_gettime"},
+    {229, "clock_getres"},
+    {230, "clock_nanosleep"},
+    {231, "exit_group"},
+    {232, "epoll_wait"},
+    {233, "epoll_ctl"},
+    {234, "tgkill"},
+    {235, "utimes"},
+    {236, "vserver"},
+    {237, "mbind"},
+    {238, "set_mempolicy"},
+    {239, "get_mempolicy"},
+    {240, "mq_open"},
+    {241, "mq_unlink"},
+    {242, "mq_timedsend"},
+    {243, "mq_timedreceive"},
+    {244, "mq_notify"},
+    {245, "mq_getsetattr"},
+    {246, "kexec_load"},
+    {247, "waitid"},
+    {248, "add_key"},
+    {249, "request_key"},
+    {250, "keyctl"},
+    {251, "ioprio_set"},
+    {252, "ioprio_get"},
+    {253, "inotify_init"},
+    {254, "inotify_add_watch"},
+    {255, "inotify_rm_watch"},
+    {256, "migrate_pages"},
+    {257, "openat"},
+    {258, "mkdirat"},
+    {259, "mknodat"},
+    {260, "fchownat"},
+    {261, "futimesat"},
+    {262, "newfstatat"},
+    {263, "unlinkat"},
+    {264, "renameat"},
+    {265, "linkat"},
+    {266, "symlinkat"},
+    {267, "readlinkat"},
+    {268, "fchmodat"},
+    {269, "faccessat"},
+    {270, "pselect6"},
+    {271, "ppoll"},
+    {272, "unshare"},
+    {273, "set_robust_list"},
+    {274, "get_robust_list"},
+    {275, "splice"},
+    {276, "tee"},
+    {277, "sync_file_range"},
+    {278, "vmsplice"},
+    {279, "move_pages"},
+    {280, "utimensat"},
+    {281, "epoll_pwait"},
+    {282, "signalfd"},
+    {283, "timerfd_create"},
+    {284, "eventfd"},
+    {285, "fallocate"},
+    {286, "timerfd_settime"},
+    {287, "timerfd_gettime"},
+    {288, "accept4"},
+    {289, "signalfd4"},
+    {290, "eventfd2"},
+    {291, "epoll_create1"},
+    {292, "dup3"},
+    {293, "pipe2"},
+    {294, "inotify_init1"},
+    {295, "preadv"},
+    {296, "pwritev"},
+    {297, "rt_tgsigqueueinfo"},
+    {298, "perf_event_open"},
+    {299, "recvmmsg"},
+    {300, "fanotify_init"},
+    {301, "fanotify_mark"},
+    {302, "prlimit64"},
+    {303, "name_to_handle_at"},
+    {304, "open_by_handle_at"},
+    {305, "clock_adjtime"},
+    {306, "syncfs"},
+    {307, "sendmmsg"},
+    {308, "setns"},
+    {309, "getcpu"},
+    {310, "process_vm_readv"},
+    {311, "process_vm_writev"},
+    {312, "kcmp"},
+    {313, "finit_module"},
+    {314, "sched_setattr"},
+    {315, "sched_getattr"},
+    {316, "renameat2"},
+    {317, "seccomp"},
+    {318, "getrandom"},
+    {319, "memfd_create"},
+    {320, "kexec_file_load"},
+    {321, "bpf"},
+    {322, "execveat"},
+    {323, "userfaultfd"},
+    {324, "membarrier"},
+    {325, "mlock2"},
+    {326, "copy_file_range"},
+    {327, "preadv2"},
+    {328, "pwritev2"},
+    {329, "pkey_mprotect"},
+    {330, "pkey_alloc"},
+    {331, "pkey_free"},
+    {332, "statx"},
+    {333, "io_pgetevents"},
+    {334, "rseq"},
+    {424, "pidfd_send_signal"},
+    {425, "io_uring_setup"},
+    {426, "io_uring_enter"},
+    {427, "io_uring_register"},
+    {428, "open_tree"},
+    {429, "move_mount"},
+    {430, "fsopen"},
+    {431, "fsconfig"},
+    {432, "fsmount"},
+    {433, "fspick"},
+    {434, "pidfd_open"},
+    {435, "clone3"},
+};
+
+struct signature {
+  std::uint64_t num;
+  hook impl;
+  std::array<arg_kind, 6> args;
+};
+
+constexpr signature simulated[] = {
+    {SYS_read, sys_read, {fd, out_buf, length}},
+    {SYS_write, sys_write, {fd, in_buf, length}},
+    {SYS_pread64, sys_pread64, {fd, out_buf, length, integer}},
+    {SYS_pwrite64, sys_pwrite64, {fd, in_buf, length, integer}},
+    {SYS_readv, sys_readv, {fd, pointer, integer}},
+    {SYS_writev, sys_writev, {fd, pointer, integer}},
+    {SYS_preadv, sys_preadv, {fd, pointer, integer, integer, integer}},
+    {SYS_pwritev, sys_pwritev, {fd, pointer, integer, integer, integer}},
+    {SYS_close, sys_close, {fd}},
+    {SYS_open, sys_open, {path, flags, integer}},
+    {SYS_openat, sys_openat, {dirfd, path, flags, integer}},
+    {SYS_lseek, sys_lseek, {fd, integer, integer}},
+    {SYS_fsync, sys_fsync, {fd}},
+    {SYS_fdatasync, sys_fdatasync, {fd}},
+    {SYS_ftruncate, sys_ftruncate, {fd, integer}},
+    {SYS_fstat, sys_fstat, {fd, pointer}},
+    {SYS_newfstatat, sys_newfstatat, {dirfd, path, pointer, flags}},
+    {SYS_unlink, sys_unlink, {path}},
+    {SYS_unlinkat, sys_unlinkat, {dirfd, path, flags}},
+    {SYS_socket, sys_socket, {integer, flags, integer}},
+    {SYS_socketpair, sys_socketpair, {integer, flags, integer, pointer}},
+    {SYS_sendto,
+     sys_sendto,
+     {fd, in_buf, length, flags, in_sockaddr, socklen}},
+    {SYS_recvfrom,
+     sys_recvfrom,
+     {fd, out_buf, length, flags, out_sockaddr, pointer}},
+    {SYS_sendmsg, sys_sendmsg, {fd, pointer, flags}},
+    {SYS_recvmsg, sys_recvmsg, {fd, pointer, flags}},
+    {SYS_sendmmsg, sys_sendmmsg, {fd, pointer, integer, flags}},
+    {SYS_recvmmsg, sys_recvmmsg, {fd, pointer, integer, flags, in_timespec}},
+    {SYS_connect, sys_connect, {fd, in_sockaddr, socklen}},
+    {SYS_shutdown, sys_shutdown, {fd, integer}},
+    {SYS_bind, sys_bind, {fd, in_sockaddr, socklen}},
+    {SYS_fcntl, sys_fcntl, {fd, integer, integer}},
+    {SYS_dup, sys_dup, {fd}},
+    {SYS_dup2, sys_dup2, {fd, fd}},
+    {SYS_dup3, sys_dup3, {fd, fd, flags}},
+    {SYS_pipe, sys_pipe, {pointer}},
+    {SYS_pipe2, sys_pipe2, {pointer, flags}},
+    {SYS_eventfd, sys_eventfd, {integer}},
+    {SYS_eventfd2, sys_eventfd2, {integer, flags}},
+    {SYS_setsockopt, sys_setsockopt, {fd, integer, integer, in_buf, length}},
+    {SYS_getsockopt,
+     sys_getsockopt,
+     {fd, integer, integer, out_buf, socklen_ptr}},
+    {SYS_clock_gettime, sys_clock_gettime, {integer, out_timespec}},
+    {SYS_clock_nanosleep,
+     sys_clock_nanosleep,
+     {integer, flags, in_timespec, out_timespec}},
+};
+
+// Run on the host without comment
+constexpr std::uint64_t passthroughs[] = {
+    SYS_exit,
+    SYS_exit_group,
+    SYS_mmap,
+    SYS_mprotect,
+    SYS_munmap,
+    SYS_rt_sigaction,
+    SYS_set_tid_address,
+    SYS_set_robust_list,
+    SYS_rt_sigprocmask,
+    SYS_prlimit64,
+    SYS_brk,
+    SYS_arch_prctl,
+    SYS_execve,
+};
+
+// "syscall_<nr>", for numbers missing from `names`
+constexpr std::size_t fallback_length = 12;
+
+consteval std::array<std::array<char, fallback_length>, syscall_count>
+build_fallback_names() {
+  std::array<std::array<char, fallback_length>, syscall_count> out{};
+
+  for (std::size_t num = 0; num < syscall_count; ++num) {
+    std::size_t len = 0;
+    for (char c : std::string_view{"syscall_"}) {
+      out[num][len++] = c;
+    }
+
+    char digits[4] = {};
+    std::size_t count = 0;
+    for (auto n = num; count == 0 || n != 0; n /= 10) {
+      digits[count++] = static_cast<char>('0' + n % 10);
+    }
+    while (count != 0) {
+      out[num][len++] = digits[--count];
+    }
+  }
+  return out;
+}
+
+constexpr auto fallback_names = build_fallback_names();
+
+consteval std::array<syscall_info, syscall_count> build_table() {
+  std::array<syscall_info, syscall_count> table{};
+
+  for (std::size_t num = 0; num < syscall_count; ++num) {
+    table[num].name = fallback_names[num].data();
+  }
+  for (auto [num, name] : names) {
+    table[num].name = name;
+  }
+  for (auto &sig : simulated) {
+    table[sig.num].args = sig.args;
+    table[sig.num].impl = sig.impl;
+  }
+  for (auto num : passthroughs) {
+    table[num].passthrough = true;
+  }
+  return table;
+}
+
+constexpr auto table = build_table();
+constexpr syscall_info unknown{};
+} // namespace
+
+std::span<const syscall_info, syscall_count> syscall_table() { return table; }
+
+const syscall_info &lookup_syscall(std::uint64_t num) {
+  return num < table.size() ? table[num] : unknown;
+}
+
 std::string_view syscall_name(int num) {
-  switch (num) {
-  case 0:
-    return "read";
-  case 1:
-    return "write";
-  case 2:
-    return "open";
-  case 3:
-    return "close";
-  case 4:
-    return "stat";
-  case 5:
-    return "fstat";
-  case 6:
-    return "lstat";
-  case 7:
-    return "poll";
-  case 8:
-    return "lseek";
-  case 9:
-    return "mmap";
-  case 10:
-    return "mprotect";
-  case 11:
-    return "munmap";
-  case 12:
-    return "brk";
-  case 13:
-    return "rt_sigaction";
-  case 14:
-    return "rt_sigprocmask";
-  case 15:
-    return "rt_sigreturn";
-  case 16:
-    return "ioctl";
-  case 17:
-    return "pread64";
-  case 18:
-    return "pwrite64";
-  case 19:
-    return "readv";
-  case 20:
-    return "writev";
-  case 21:
-    return "access";
-  case 22:
-    return "pipe";
-  case 23:
-    return "select";
-  case 24:
-    return "sched_yield";
-  case 25:
-    return "mremap";
-  case 26:
-    return "msync";
-  case 27:
-    return "mincore";
-  case 28:
-    return "madvise";
-  case 29:
-    return "shmget";
-  case 30:
-    return "shmat";
-  case 31:
-    return "shmctl";
-  case 32:
-    return "dup";
-  case 33:
-    return "dup2";
-  case 34:
-    return "pause";
-  case 35:
-    return "nanosleep";
-  case 36:
-    return "getitimer";
-  case 37:
-    return "alarm";
-  case 38:
-    return "setitimer";
-  case 39:
-    return "getpid";
-  case 40:
-    return "sendfile";
-  case 41:
-    return "socket";
-  case 42:
-    return "connect";
-  case 43:
-    return "accept";
-  case 44:
-    return "sendto";
-  case 45:
-    return "recvfrom";
-  case 46:
-    return "sendmsg";
-  case 47:
-    return "recvmsg";
-  case 48:
-    return "shutdown";
-  case 49:
-    return "bind";
-  case 50:
-    return "listen";
-  case 51:
-    return "getsockname";
-  case 52:
-    return "getpeername";
-  case 53:
-    return "socketpair";
-  case 54:
-    return "setsockopt";
-  case 55:
-    return "getsockopt";
-  case 56:
-    return "clone";
-  case 57:
-    return "fork";
-  case 58:
-    return "vfork";
-  case 59:
-    return "execve";
-  case 60:
-    return "exit";
-  case 61:
-    return "wait4";
-  case 62:
-    return "kill";
-  case 63:
-    return "uname";
-  case 64:
-    return "semget";
-  case 65:
-    return "semop";
-  case 66:
-    return "semctl";
-  case 67:
-    return "shmdt";
-  case 68:
-    return "msgget";
-  case 69:
-    return "msgsnd";
-  case 70:
-    return "msgrcv";
-  case 71:
-    return "msgctl";
-  case 72:
-    return "fcntl";
-  case 73:
-    return "flock";
-  case 74:
-    return "fsync";
-  case 75:
-    return "fdatasync";
-  case 76:
-    return "truncate";
-  case 77:
-    return "ftruncate";
-  case 78:
-    return "getdents";
-  case 79:
-    return "getcwd";
-  case 80:
-    return "chdir";
-  case 81:
-    return "fchdir";
-  case 82:
-    return "rename";
-  case 83:
-    return "mkdir";
-  case 84:
-    return "rmdir";
-  case 85:
-    return "creat";
-  case 86:
-    return "link";
-  case 87:
-    return "unlink";
-  case 88:
-    return "symlink";
-  case 89:
-    return "readlink";
-  case 90:
-    return "chmod";
-  case 91:
-    return "fchmod";
-  case 92:
-    return "chown";
-  case 93:
-    return "fchown";
-  case 94:
-    return "lchown";
-  case 95:
-    return "umask";
-  case 96:
-    return "gettimeofday";
-  case 97:
-    return "getrlimit";
-  case 98:
-    return "getrusage";
-  case 99:
-    return "sysinfo";
-  case 100:
-    return "times";
-  case 101:
-    return "ptrace";
-  case 102:
-    return "getuid";
-  case 103:
-    return "syslog";
-  case 104:
-    return "getgid";
-  case 105:
-    return "setuid";
-  case 106:
-    return "setgid";
-  case 107:
-    return "geteuid";
-  case 108:
-    return "getegid";
-  case 109:
-    return "setpgid";
-  case 110:
-    return "getppid";
-  case 111:
-    return "getpgrp";
-  case 112:
-    return "setsid";
-  case 113:
-    return "setreuid";
-  case 114:
-    return "setregid";
-  case 115:
-    return "getgroups";
-  case 116:
-    return "setgroups";
-  case 117:
-    return "setresuid";
-  case 118:
-    return "getresuid";
-  case 119:
-    return "setresgid";
-  case 120:
-    return "getresgid";
-  case 121:
-    return "getpgid";
-  case 122:
-    return "setfsuid";
-  case 123:
-    return "setfsgid";
-  case 124:
-    return "getsid";
-  case 125:
-    return "capget";
-  case 126:
-    return "capset";
-  case 127:
-    return "rt_sigpending";
-  case 128:
-    return "rt_sigtimedwait";
-  case 129:
-    return "rt_sigqueueinfo";
-  case 130:
-    return "rt_sigsuspend";
-  case 131:
-    return "sigaltstack";
-  case 132:
-    return "utime";
-  case 133:
-    return "mknod";
-  case 134:
-    return "uselib";
-  case 135:
-    return "personality";
-  case 136:
-    return "ustat";
-  case 137:
-    return "statfs";
-  case 138:
-    return "fstatfs";
-  case 139:
-    return "sysfs";
-  case 140:
-    return "getpriority";
-  case 141:
-    return "setpriority";
-  case 142:
-    return "sched_setparam";
-  case 143:
-    return "sched_getparam";
-  case 144:
-    return "sched_setscheduler";
-  case 145:
-    return "sched_getscheduler";
-  case 146:
-    return "sched_get_priority_max";
-  case 147:
-    return "sched_get_priority_min";
-  case 148:
-    return "sched_rr_get_interval";
-  case 149:
-    return "mlock";
-  case 150:
-    return "munlock";
-  case 151:
-    return "mlockall";
-  case 152:
-    return "munlockall";
-  case 153:
-    return "vhangup";
-  case 154:
-    return "modify_ldt";
-  case 155:
-    return "pivot_root";
-  case 156:
-    return "_sysctl";
-  case 157:
-    return "prctl";
-  case 158:
-    return "arch_prctl";
-  case 159:
-    return "adjtimex";
-  case 160:
-    return "setrlimit";
-  case 161:
-    return "chroot";
-  case 162:
-    return "sync";
-  case 163:
-    return "acct";
-  case 164:
-    return "settimeofday";
-  case 165:
-    return "mount";
-  case 166:
-    return "umount2";
-  case 167:
-    return "swapon";
-  case 168:
-    return "swapoff";
-  case 169:
-    return "reboot";
-  case 170:
-    return "sethostname";
-  case 171:
-    return "setdomainname";
-  case 172:
-    return "iopl";
-  case 173:
-    return "ioperm";
-  case 174:
-    return "create_module";
-  case 175:
-    return "init_module";
-  case 176:
-    return "delete_module";
-  case 177:
-    return "get_kernel_syms";
-  case 178:
-    return "query_module";
-  case 179:
-    return "quotactl";
-  case 180:
-    return "nfsservctl";
-  case 181:
-    return "getpmsg";
-  case 182:
-    return "putpmsg";
-  case 183:
-    return "afs_syscall";
-  case 184:
-    return "tuxcall";
-  case 185:
-    return "security";
-  case 186:
-    return "gettid";
-  case 187:
-    return "readahead";
-  case 188:
-    return "setxattr";
-  case 189:
-    return "lsetxattr";
-  case 190:
-    return "fsetxattr";
-  case 191:
-    return "getxattr";
-  case 192:
-    return "lgetxattr";
-  case 193:
-    return "fgetxattr";
-  case 194:
-    return "listxattr";
-  case 195:
-    return "llistxattr";
-  case 196:
-    return "flistxattr";
-  case 197:
-    return "removexattr";
-  case 198:
-    return "lremovexattr";
-  case 199:
-    return "fremovexattr";
-  case 200:
-    return "tkill";
-  case 201:
-    return "time";
-  case 202:
-    return "futex";
-  case 203:
-    return "sched_setaffinity";
-  case 204:
-    return "sched_getaffinity";
-  case 205:
-    return "set_thread_area";
-  case 206:
-    return "io_setup";
-  case 207:
-    return "io_destroy";
-  case 208:
-    return "io_getevents";
-  case 209:
-    return "io_submit";
-  case 210:
-    return "io_cancel";
-  case 211:
-    return "get_thread_area";
-  case 212:
-    return "lookup_dcookie";
-  case 213:
-    return "epoll_create";
-  case 214:
-    return "epoll_ctl_old";
-  case 215:
-    return "epoll_wait_old";
-  case 216:
-    return "remap_file_pages";
-  case 217:
-    return "getdents64";
-  case 218:
-    return "set_tid_address";
-  case 219:
-    return "restart_syscall";
-  case 220:
-    return "semtimedop";
-  case 221:
-    return "fadvise64";
-  case 222:
-    return "timer_create";
-  case 223:
-    return "timer_settime";
-  case 224:
-    return "timer_gettime";
-  case 225:
-    return "timer_getoverrun";
-  case 226:
-    return "timer_delete";
-  case 227:
-    return "clock_settime";
-  case 228:
-    return "clock_gettime";
-  case 229:
-    return "clock_getres";
-  case 230:
-    return "clock_nanosleep";
-  case 231:
-    return "exit_group";
-  case 232:
-    return "epoll_wait";
-  case 233:
-    return "epoll_ctl";
-  case 234:
-    return "tgkill";
-  case 235:
-    return "utimes";
-  case 236:
-    return "vserver";
-  case 237:
-    return "mbind";
-  case 238:
-    return "set_mempolicy";
-  case 239:
-    return "get_mempolicy";
-  case 240:
-    return "mq_open";
-  case 241:
-    return "mq_unlink";
-  case 242:
-    return "mq_timedsend";
-  case 243:
-    return "mq_timedreceive";
-  case 244:
-    return "mq_notify";
-  case 245:
-    return "mq_getsetattr";
-  case 246:
-    return "kexec_load";
-  case 247:
-    return "waitid";
-  case 248:
-    return "add_key";
-  case 249:
-    return "request_key";
-  case 250:
-    return "keyctl";
-  case 251:
-    return "ioprio_set";
-  case 252:
-    return "ioprio_get";
-  case 253:
-    return "inotify_init";
-  case 254:
-    return "inotify_add_watch";
-  case 255:
-    return "inotify_rm_watch";
-  case 256:
-    return "migrate_pages";
-  case 257:
-    return "openat";
-  case 258:
-    return "mkdirat";
-  case 259:
-    return "mknodat";
-  case 260:
-    return "fchownat";
-  case 261:
-    return "futimesat";
-  case 262:
-    return "newfstatat";
-  case 263:
-    return "unlinkat";
-  case 264:
-    return "renameat";
-  case 265:
-    return "linkat";
-  case 266:
-    return "symlinkat";
-  case 267:
-    return "readlinkat";
-  case 268:
-    return "fchmodat";
-  case 269:
-    return "faccessat";
-  case 270:
-    return "pselect6";
-  case 271:
-    return "ppoll";
-  case 272:
-    return "unshare";
-  case 273:
-    return "set_robust_list";
-  case 274:
-    return "get_robust_list";
-  case 275:
-    return "splice";
-  case 276:
-    return "tee";
-  case 277:
-    return "sync_file_range";
-  case 278:
-    return "vmsplice";
-  case 279:
-    return "move_pages";
-  case 280:
-    return "utimensat";
-  case 281:
-    return "epoll_pwait";
-  case 282:
-    return "signalfd";
-  case 283:
-    return "timerfd_create";
-  case 284:
-    return "eventfd";
-  case 285:
-    return "fallocate";
-  case 286:
-    return "timerfd_settime";
-  case 287:
-    return "timerfd_gettime";
-  case 288:
-    return "accept4";
-  case 289:
-    return "signalfd4";
-  case 290:
-    return "eventfd2";
-  case 291:
-    return "epoll_create1";
-  case 292:
-    return "dup3";
-  case 293:
-    return "pipe2";
-  case 294:
-    return "inotify_init1";
-  case 295:
-    return "preadv";
-  case 296:
-    return "pwritev";
-  case 297:
-    return "rt_tgsigqueueinfo";
-  case 298:
-    return "perf_event_open";
-  case 299:
-    return "recvmmsg";
-  case 300:
-    return "fanotify_init";
-  case 301:
-    return "fanotify_mark";
-  case 302:
-    return "prlimit64";
-  case 303:
-    return "name_to_handle_at";
-  case 304:
-    return "open_by_handle_at";
-  case 305:
-    return "clock_adjtime";
-  case 306:
-    return "syncfs";
-  case 307:
-    return "sendmmsg";
-  case 308:
-    return "setns";
-  case 309:
-    return "getcpu";
-  case 310:
-    return "process_vm_readv";
-  case 311:
-    return "process_vm_writev";
-  case 312:
-    return "kcmp";
-  case 313:
-    return "finit_module";
-  case 314:
-    return "sched_setattr";
-  case 315:
-    return "sched_getattr";
-  case 316:
-    return "renameat2";
-  case 317:
-    return "seccomp";
-  case 318:
-    return "getrandom";
-  case 319:
-    return "memfd_create";
-  case 320:
-    return "kexec_file_load";
-  case 321:
-    return "bpf";
-  case 322:
-    return "execveat";
-  case 323:
-    return "userfaultfd";
-  case 324:
-    return "membarrier";
-  case 325:
-    return "mlock2";
-  case 326:
-    return "copy_file_range";
-  case 327:
-    return "preadv2";
-  case 328:
-    return "pwritev2";
-  case 329:
-    return "pkey_mprotect";
-  case 330:
-    return "pkey_alloc";
-  case 331:
-    return "pkey_free";
-  case 332:
-    return "statx";
-  case 333:
-    return "io_pgetevents";
-  case 334:
-    return "rseq";
-  case 424:
-    return "pidfd_send_signal";
-  case 425:
-    return "io_uring_setup";
-  case 426:
-    return "io_uring_enter";
-  case 427:
-    return "io_uring_register";
-  case 428:
-    return "open_tree";
-  case 429:
-    return "move_mount";
-  case 430:
-    return "fsopen";
-  case 431:
-    return "fsconfig";
-  case 432:
-    return "fsmount";
-  case 433:
-    return "fspick";
-  case 434:
-    return "pidfd_open";
-  case 435:
-    return "clone3";
-  default:
-    return "";
+  return lookup_syscall(static_cast<std::uint64_t>(num)).name;
+}
+} // namespace redstone::hook
+
+fmt::format_context::iterator
+fmt::formatter<redstone::hook::traced_call>::format(
+    const redstone::hook::traced_call &call, fmt::format_context &ctx) const {
+  using redstone::hook::arg_kind;
+
+  const auto &info = redstone::hook::lookup_syscall(call.num);
+
+  auto out = ctx.out();
+  if (info.name.empty()) {
+    out = fmt::format_to(out, "syscall_{}(", call.num);
+  } else {
+    out = fmt::format_to(out, "{}(", info.name);
+  }
+
+  for (std::size_t i = 0; i < info.args.size(); ++i) {
+    const auto kind = info.args[i];
+    if (kind == arg_kind::none) {
+      break;
+    }
+
+    const auto arg = call.args[i];
+    const auto sep = i == 0 ? "" : ", ";
+    switch (kind) {
+    case arg_kind::integer:
+    case arg_kind::fd:
+    case arg_kind::dirfd:
+      out = fmt::format_to(out, "{}{}", sep, static_cast<int>(arg));
+      break;
+    case arg_kind::length:
+    case arg_kind::socklen:
+      out = fmt::format_to(out, "{}{}", sep, arg);
+      break;
+    default:
+      out = fmt::format_to(out, "{}{:#x}", sep, arg);
+      break;
+    }
   }
+  return fmt::format_to(out, ")");
 }
-} // namespace redstone::hook
\ No newline at end of file
@@ -1,7 +1,72 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
 #include <string_view>
 
+#include <fmt/format.h>
+
+#include "hook/hook.hpp"
+
 namespace redstone::hook {
+// How a syscall argument is decoded and traced
+enum class arg_kind : std::uint8_t {
+  none,
+  integer,
+  flags,
+  fd,
+  // An fd or AT_FDCWD that a relative path argument resolves against
+  dirfd,
+  pointer,
+  // A NUL-terminated path
+  path,
+  // Tracee memory the syscall reads or writes, sized by the next argument
+  in_buf,
+  out_buf,
+  length,
+  // A sockaddr sized by the next argument
+  in_sockaddr,
+  out_sockaddr,
+  socklen,
+  // Points to a value-result socklen_t
+  socklen_ptr,
+  in_timespec,
+  out_timespec,
+};
+
+struct syscall_info {
+  std::string_view name;
+  std::array<arg_kind, 6> args{};
+  // Simulates the syscall, or null to run it on the host
+  hook impl = nullptr;
+  // Known to be fine to run on the host
+  bool passthrough = false;
+};
+
+// One past the highest x86-64 syscall number
+inline constexpr std::size_t syscall_count = 436;
+
+// Built at compile time, indexed by syscall number. Numbers without a known
+// name are called syscall_<nr>.
+std::span<const syscall_info, syscall_count> syscall_table();
+
+// Unknown numbers get an empty entry
+const syscall_info &lookup_syscall(std::uint64_t num);
+
 std::string_view syscall_name(int num);
-} // namespace redstone::hook
\ No newline at end of file
+
+// Formats as name(arg, ...), according to the argument kinds
+struct traced_call {
+  std::uint64_t num;
+  std::span<const std::uint64_t, 6> args;
+};
+} // namespace redstone::hook
+
+template <>
+struct fmt::formatter<redstone::hook::traced_call>
+    : fmt::formatter<fmt::string_view> {
+  fmt::format_context::iterator format(const redstone::hook::traced_call &call,
+                                       fmt::format_context &ctx) const;
+};
@@ -4,16 +4,20 @@
 #include <fmt/format.h>
 #include <map>
 #include <memory>
+#include <optional>
 #include <spdlog/spdlog.h>
 #include <stdexcept>
 #include <sys/random.h>
 #include <sys/syscall.h>
 #include <thread>
 #include <toml++/toml.hpp>
+#include <unistd.h>
+#include <utility>
 #include <vector>
 
 #include "hook/hook.hpp"
 #include "metrics.hpp"
+#include "net/stats.hpp"
 #include "sim/machine.hpp"
 #include "sim/simulator.hpp"
 
@@ -33,6 +37,8 @@ struct config_replica {
 struct parsed_config {
   redstone::sim::options options;
   std::vector<config_replica> replicas;
+  // Where to write network counters at the end of the run, if set
+  std::string stats_path;
 };
 
 std::vector<config_replica> parse_replicas(toml::array *arr) {
@@ -67,34 +73,169 @@ std::vector<config_replica> parse_replicas(toml::array *arr) {
   return result;
 }
 
+template <typename Table>
+redstone::net::net_fault_options
+parse_net_faults(Table &&table,
+                 const redstone::net::net_fault_options &defaults) {
+  return {
+      .min_latency = std::chrono::nanoseconds{table["min_latency_ns"].value_or(
+          defaults.min_latency.count())},
+      .max_latency = std::chrono::nanoseconds{table["max_latency_ns"].value_or(
+          defaults.max_latency.count())},
+      .p_drop = table["drop_chance"].value_or(defaults.p_drop),
+      .p_replay = table["replay_chance"].value_or(defaults.p_replay),
+      .bandwidth = table["bandwidth_bytes_per_s"].value_or(defaults.bandwidth),
+      .burst = table["burst_bytes"].value_or(defaults.burst),
+      .queue_limit = table["queue_bytes"].value_or(defaults.queue_limit),
+  };
+}
+
+template <typename Table>
+redstone::net::buffer_options parse_socket_buffers(Table &&table) {
+  const redstone::net::buffer_options defaults;
+  return {
+      .send = table["send_buffer_bytes"].value_or(defaults.send),
+      .recv = table["recv_buffer_bytes"].value_or(defaults.recv),
+      .max = table["max_buffer_bytes"].value_or(defaults.max),
+  };
+}
+
+// Empty if any member is not the index of a machine
+std::optional<std::vector<redstone::net::endpoint_id>>
+parse_endpoints(toml::array *arr, std::size_t endpoints) {
+  std::vector<redstone::net::endpoint_id> result;
+  if (!arr) {
+    return result;
+  }
+
+  for (auto &elem : *arr) {
+    auto index = elem.as_integer();
+    if (!index || index->get() < 0 ||
+        endpoints <= static_cast<std::uint64_t>(index->get())) {
+      return std::nullopt;
+    }
+    result.push_back(static_cast<redstone::net::endpoint_id>(index->get()));
+  }
+  return result;
+}
+
+// Links and partitions refer to machines by their index in the replica list
+redstone::net::topology_options
+parse_topology(toml::node_view<toml::node> net, std::size_t endpoints,
+               const redstone::net::net_fault_options &defaults) {
+  redstone::net::topology_options result{
+      .endpoints = endpoints,
+      .links = {},
+      .partitions = {},
+  };
+
+  if (auto links = net["link"].as_array()) {
+    for (auto &elem : *links) {
+      auto table = elem.as_table();
+      if (!table) {
+        fprintf(stderr, "invalid configuration file\n");
+        continue;
+      }
+
+      result.links.push_back({
+          .from = (*table)["from"].value_or(0u),
+          .to = (*table)["to"].value_or(0u),
+          .bidirectional = (*table)["bidirectional"].value_or(false),
+          .faults = parse_net_faults(*table, defaults),
+      });
+    }
+  }
+
+  if (auto partitions = net["partition"].as_array()) {
+    for (auto &elem : *partitions) {
+      auto table = elem.as_table();
+      if (!table) {
+        fprintf(stderr, "invalid configuration file\n");
+        continue;
+      }
+
+      auto groups = (*table)["groups"].as_array();
+      if (!groups || groups->size() < 1 || 2 < groups->size()) {
+        fprintf(stderr, "partition needs one or two groups\n");
+        continue;
+      }
+
+      auto side_a = parse_endpoints((*groups)[0].as_array(), endpoints);
+      auto side_b = groups->size() == 2
+                        ? parse_endpoints((*groups)[1].as_array(), endpoints)
+                        : std::vector<redstone::net::endpoint_id>{};
+      if (!side_a || !side_b) {
+        fprintf(stderr, "partition groups must list machine indices\n");
+        continue;
+      }
+
+      result.partitions.push_back({
+          .start = std::chrono::nanoseconds{(*table)["start_ns"].value_or(
+              int64_t{0})},
+          .end = std::chrono::nanoseconds{(*table)["end_ns"].value_or(
+              std::chrono::nanoseconds::max().count())},
+          .side_a = std::move(*side_a),
+          .side_b = std::move(*side_b),
+      });
+    }
+  }
+
+  return result;
+}
+
 parsed_config parse_config(const char *path) {
   auto config = toml::parse_file(path);
-  auto min_latency_ns = config["net"]["min_latency_ns"].value_or(0);
-  auto max_latency_ns = config["net"]["max_latency_ns"].value_or(0);
-  auto replay_chance = config["net"]["replay_chance"].value_or(0.0);
-  auto drop_chance = config["net"]["drop_chance"].value_or(0.0);
+
+  auto net_faults = parse_net_faults(config["net"], {});
 
   auto time_scale = config["time"]["scale"].value_or(1.0);
 
   auto replicas = parse_replicas(config["replica"].as_array());
 
+  auto topology = parse_topology(config["net"], replicas.size(), net_faults);
+
   return {
       .options =
           {
-              .net_faults =
-                  {
-                      .min_latency = std::chrono::nanoseconds{min_latency_ns},
-                      .max_latency = std::chrono::nanoseconds{max_latency_ns},
-                      .p_drop = drop_chance,
-                      .p_replay = replay_chance,
-                  },
+              .net_faults = net_faults,
+              .topology = std::move(topology),
+              .socket_buffers = parse_socket_buffers(config["net"]),
               .time_scale = config["time"]["scale"].value_or(1.0),
               .seed = config["seed"].value_or(random_seed()),
+              .capture_path =
+                  config["capture"]["path"].value_or(std::string{}),
+              .output_path = config["output"]["path"].value_or(std::string{}),
+              .disk_root = config["disk"]["root"].value_or(std::string{}),
           },
       .replicas = replicas,
+      .stats_path = config["stats"]["path"].value_or(std::string{}),
   };
 }
 
+// Writes one line per captured stream to `path`: the machine, the stream,
+// its length and its XXH64 digest
+void write_output_digests(
+    const std::string &path,
+    const std::vector<std::unique_ptr<redstone::sim::machine>> &machines) {
+  auto out = std::fopen(path.c_str(), "w");
+  if (!out) {
+    spdlog::error("failed to open digest file {}", path);
+    return;
+  }
+
+  for (auto &m : machines) {
+    auto replica = m->current_replica();
+    for (auto [fd, name] : {std::pair{STDOUT_FILENO, "stdout"},
+                            std::pair{STDERR_FILENO, "stderr"}}) {
+      auto output = replica->output(fd);
+      output->flush();
+      fmt::println(out, "{} {} {} {:016x}", m->id(), name, output->size(),
+                   output->digest());
+    }
+  }
+  std::fclose(out);
+}
+
 int main(int argc, char **argv) {
   spdlog::set_level(spdlog::level::err);
 
@@ -142,6 +283,18 @@ int main(int argc, char **argv) {
       }
     }
   }
+  if (auto &dir = sim.initial_options().output_path; !dir.empty()) {
+    write_output_digests(dir + "/digests", machines);
+  }
+  if (!config.stats_path.empty()) {
+    if (auto out = std::fopen(config.stats_path.c_str(), "w")) {
+      redstone::net::write_stats(out, sim.net(), sim.topology());
+      std::fclose(out);
+    } else {
+      spdlog::error("failed to open stats file {}", config.stats_path);
+    }
+  }
+
   // // for (int i = 1; i < argc; ++i) {
   // //   options.args.push_back(argv[i]);
   // // }
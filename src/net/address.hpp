@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <variant>
+
+namespace redstone::net {
+enum address_family {
+  ipv4,
+  unix_,
+};
+
+struct ipv4_addr {
+  uint16_t port;
+  char octets[4];
+
+  friend bool operator<(const ipv4_addr &lhs, const ipv4_addr &rhs) {
+    if (memcmp(lhs.octets, rhs.octets, 4) < 0)
+      return true;
+    return lhs.port < rhs.port;
+  }
+
+  friend bool operator>(const ipv4_addr &lhs, const ipv4_addr &rhs) {
+    return rhs < lhs;
+  }
+  friend bool operator<=(const ipv4_addr &lhs, const ipv4_addr &rhs) {
+    return !(rhs < lhs);
+  }
+  friend bool operator>=(const ipv4_addr &lhs, const ipv4_addr &rhs) {
+    return !(lhs < rhs);
+  }
+
+  friend bool operator==(const ipv4_addr &lhs, const ipv4_addr &rhs) {
+    return lhs.port == rhs.port && memcmp(lhs.octets, rhs.octets, 4) == 0;
+  }
+  friend bool operator!=(const ipv4_addr &lhs, const ipv4_addr &rhs) {
+    return !(lhs == rhs);
+  }
+};
+
+struct unix_addr {
+  std::string path;
+
+  friend bool operator<(const unix_addr &lhs, const unix_addr &rhs) {
+    return lhs.path < rhs.path;
+  }
+  friend bool operator>(const unix_addr &lhs, const unix_addr &rhs) {
+    return rhs < lhs;
+  }
+  friend bool operator<=(const unix_addr &lhs, const unix_addr &rhs) {
+    return !(rhs < lhs);
+  }
+  friend bool operator>=(const unix_addr &lhs, const unix_addr &rhs) {
+    return !(lhs < rhs);
+  }
+
+  friend bool operator==(const unix_addr &lhs, const unix_addr &rhs) {
+    return lhs.path == rhs.path;
+  }
+  friend bool operator!=(const unix_addr &lhs, const unix_addr &rhs) {
+    return !(lhs == rhs);
+  }
+};
+
+using socket_addr = std::variant<ipv4_addr, unix_addr>;
+
+// Dense id of an interned socket_addr, see network::intern
+using addr_id = std::uint32_t;
+
+// Always interned as 0.0.0.0:0, stands in for unbound sockets
+constexpr addr_id unspecified_addr = 0;
+
+// 255.255.255.255
+inline bool is_broadcast(const socket_addr &addr) {
+  auto ip = std::get_if<ipv4_addr>(&addr);
+  return ip && std::all_of(std::begin(ip->octets), std::end(ip->octets),
+                           [](char c) { return c == '\xff'; });
+}
+
+// 224.0.0.0/4
+inline bool is_multicast(const socket_addr &addr) {
+  auto ip = std::get_if<ipv4_addr>(&addr);
+  return ip && (static_cast<unsigned char>(ip->octets[0]) & 0xf0) == 0xe0;
+}
+} // namespace redstone::net
+
+namespace redstone::net {
+// Finalizer from MurmurHash3, so that every input bit affects every output
+// bit. Shard and bucket selection both depend on well-mixed hashes.
+constexpr uint64_t mix_hash(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+} // namespace redstone::net
+
+template <>
+struct std::hash<redstone::net::unix_addr> {
+  uint64_t operator()(const redstone::net::unix_addr &addr) const {
+    return redstone::net::mix_hash(std::hash<std::string>{}(addr.path));
+  }
+};
+
+template <>
+struct std::hash<redstone::net::ipv4_addr> {
+  uint64_t operator()(const redstone::net::ipv4_addr &addr) const {
+    uint32_t ip;
+    memcpy(&ip, addr.octets, sizeof(ip));
+
+    return redstone::net::mix_hash((uint64_t{ip} << 16) | addr.port);
+  }
+};
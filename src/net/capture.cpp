@@ -0,0 +1,306 @@
+#include "capture.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <system_error>
+#include <variant>
+
+namespace redstone::net {
+namespace {
+constexpr std::uint32_t block_shb = 0x0a0d0d0a;
+constexpr std::uint32_t block_idb = 0x00000001;
+constexpr std::uint32_t block_epb = 0x00000006;
+constexpr std::uint16_t linktype_ipv4 = 228;
+constexpr std::uint16_t opt_endofopt = 0;
+constexpr std::uint16_t opt_comment = 1;
+constexpr std::uint16_t if_tsresol = 9;
+
+constexpr std::size_t ip_header_size = 20;
+constexpr std::size_t max_segment_size = 65535 - ip_header_size - 20;
+
+std::atomic<std::uint64_t> next_capture_id = 1;
+
+template <typename T>
+void put(std::vector<std::byte> &out, T v) {
+  const auto n = out.size();
+  out.resize(n + sizeof(v));
+  std::memcpy(out.data() + n, &v, sizeof(v));
+}
+
+void put_bytes(std::vector<std::byte> &out, std::span<const std::byte> bytes) {
+  out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+void pad(std::vector<std::byte> &out) {
+  out.resize((out.size() + 3) & ~std::size_t{3});
+}
+
+constexpr std::uint32_t padded(std::size_t n) { return (n + 3) & ~3u; }
+
+// Address and port in network byte order
+struct endpoint {
+  std::uint32_t ip;
+  std::uint16_t port;
+};
+
+endpoint to_endpoint(const socket_addr &addr) {
+  if (auto ip = std::get_if<ipv4_addr>(&addr)) {
+    endpoint e{0, ip->port};
+    std::memcpy(&e.ip, ip->octets, sizeof(e.ip));
+    return e;
+  }
+
+  const auto h = std::hash<unix_addr>{}(std::get<unix_addr>(addr));
+  return {htonl(INADDR_LOOPBACK), static_cast<std::uint16_t>(h)};
+}
+
+std::uint16_t ip_checksum(std::span<const std::byte> header) {
+  std::uint32_t sum = 0;
+  for (std::size_t i = 0; i + 1 < header.size(); i += 2) {
+    std::uint16_t word;
+    std::memcpy(&word, header.data() + i, sizeof(word));
+    sum += word;
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return static_cast<std::uint16_t>(~sum);
+}
+
+std::string_view comment_for(capture::event e) {
+  switch (e) {
+  case capture::event::dropped:
+    return "dropped";
+  case capture::event::replayed:
+    return "replayed";
+  default:
+    return {};
+  }
+}
+} // namespace
+
+capture::capture(const std::string &path) : id_{next_capture_id++} {
+  file_ = std::fopen(path.c_str(), "wb");
+  if (!file_) {
+    throw std::system_error{errno, std::generic_category(),
+                            "failed to open capture file " + path};
+  }
+
+  std::vector<std::byte> header;
+
+  // Section header block
+  put(header, block_shb);
+  put(header, std::uint32_t{28});
+  put(header, std::uint32_t{0x1a2b3c4d});
+  put(header, std::uint16_t{1});
+  put(header, std::uint16_t{0});
+  put(header, std::int64_t{-1});
+  put(header, std::uint32_t{28});
+
+  // Interface description block with nanosecond timestamps
+  put(header, block_idb);
+  put(header, std::uint32_t{32});
+  put(header, linktype_ipv4);
+  put(header, std::uint16_t{0});
+  put(header, std::uint32_t{0});
+  put(header, if_tsresol);
+  put(header, std::uint16_t{1});
+  put(header, std::uint8_t{9});
+  pad(header);
+  put(header, opt_endofopt);
+  put(header, std::uint16_t{0});
+  put(header, std::uint32_t{32});
+
+  std::fwrite(header.data(), 1, header.size(), file_);
+
+  writer_ = std::thread{[this] { run(); }};
+}
+
+capture::~capture() {
+  {
+    std::unique_lock lock{mutex_};
+    stopping_ = true;
+    cond_.notify_all();
+  }
+  writer_.join();
+
+  for (auto &buf : buffers_) {
+    std::unique_lock lock{buf->mutex};
+    std::fwrite(buf->bytes.data(), 1, buf->bytes.size(), file_);
+  }
+  std::fclose(file_);
+}
+
+void capture::datagram(event e, std::chrono::nanoseconds time,
+                       const socket_addr &from, const socket_addr &to,
+                       std::span<const std::byte> payload) {
+  const auto src = to_endpoint(from);
+  const auto dst = to_endpoint(to);
+
+  std::vector<std::byte> udp;
+  udp.reserve(8);
+  put(udp, src.port);
+  put(udp, dst.port);
+  put(udp, htons(static_cast<std::uint16_t>(8 + payload.size())));
+  put(udp, std::uint16_t{0});
+
+  record(e, time, from, to, udp, IPPROTO_UDP, payload);
+}
+
+void capture::segment(event e, std::chrono::nanoseconds time,
+                      const socket_addr &from, const socket_addr &to,
+                      std::uint32_t seq, std::span<const std::byte> payload) {
+  const auto src = to_endpoint(from);
+  const auto dst = to_endpoint(to);
+
+  // Larger writes are split like a real connection would
+  do {
+    const auto chunk = payload.first(std::min(payload.size(), max_segment_size));
+
+    std::vector<std::byte> tcp;
+    tcp.reserve(20);
+    put(tcp, src.port);
+    put(tcp, dst.port);
+    put(tcp, htonl(seq));
+    put(tcp, std::uint32_t{0});
+    put(tcp, std::uint8_t{5 << 4});
+    put(tcp, std::uint8_t{0x18}); // PSH | ACK
+    put(tcp, htons(65535));
+    put(tcp, std::uint16_t{0});
+    put(tcp, std::uint16_t{0});
+
+    record(e, time, from, to, tcp, IPPROTO_TCP, chunk);
+
+    seq += chunk.size();
+    payload = payload.subspan(chunk.size());
+  } while (!payload.empty());
+}
+
+void capture::record(event e, std::chrono::nanoseconds time,
+                     const socket_addr &from, const socket_addr &to,
+                     std::span<const std::byte> l4_header,
+                     std::uint8_t protocol,
+                     std::span<const std::byte> payload) {
+  const auto src = to_endpoint(from);
+  const auto dst = to_endpoint(to);
+
+  const auto packet_len = ip_header_size + l4_header.size() + payload.size();
+  const auto comment = comment_for(e);
+
+  std::uint32_t block_len = 32 + padded(packet_len) + 4;
+  if (!comment.empty()) {
+    block_len += 4 + padded(comment.size());
+  }
+
+  const auto ts = static_cast<std::uint64_t>(time.count());
+
+  auto &buf = local();
+  std::unique_lock lock{buf.mutex};
+  auto &out = buf.bytes;
+
+  put(out, block_epb);
+  put(out, block_len);
+  put(out, std::uint32_t{0});
+  put(out, static_cast<std::uint32_t>(ts >> 32));
+  put(out, static_cast<std::uint32_t>(ts));
+  put(out, static_cast<std::uint32_t>(packet_len));
+  put(out, static_cast<std::uint32_t>(packet_len));
+
+  const auto ip_start = out.size();
+  put(out, std::uint8_t{0x45});
+  put(out, std::uint8_t{0});
+  put(out, htons(static_cast<std::uint16_t>(packet_len)));
+  put(out, htons(ip_id_.fetch_add(1, std::memory_order_relaxed)));
+  put(out, htons(0x4000)); // Don't fragment
+  put(out, std::uint8_t{64});
+  put(out, protocol);
+  put(out, std::uint16_t{0});
+  put(out, src.ip);
+  put(out, dst.ip);
+
+  const auto checksum =
+      ip_checksum(std::span{out}.subspan(ip_start, ip_header_size));
+  std::memcpy(out.data() + ip_start + 10, &checksum, sizeof(checksum));
+
+  put_bytes(out, l4_header);
+  put_bytes(out, payload);
+  pad(out);
+
+  if (!comment.empty()) {
+    put(out, opt_comment);
+    put(out, static_cast<std::uint16_t>(comment.size()));
+    put_bytes(out, std::as_bytes(std::span{comment}));
+    pad(out);
+  }
+  put(out, opt_endofopt);
+  put(out, std::uint16_t{0});
+  put(out, block_len);
+
+  if (out.size() < flush_threshold) {
+    return;
+  }
+
+  std::vector<std::byte> chunk;
+  chunk.reserve(flush_threshold + block_len);
+  std::swap(chunk, out);
+  lock.unlock();
+
+  submit(std::move(chunk));
+}
+
+capture::thread_buffer &capture::local() {
+  struct cached {
+    std::uint64_t owner = 0;
+    thread_buffer *buffer = nullptr;
+  };
+  thread_local cached cache;
+
+  if (cache.owner == id_) {
+    return *cache.buffer;
+  }
+
+  auto buf = std::make_unique<thread_buffer>();
+  buf->bytes.reserve(flush_threshold);
+
+  std::unique_lock lock{mutex_};
+  cache = {id_, buf.get()};
+  buffers_.push_back(std::move(buf));
+  return *cache.buffer;
+}
+
+void capture::submit(std::vector<std::byte> chunk) {
+  std::unique_lock lock{mutex_};
+  pending_.push_back(std::move(chunk));
+  cond_.notify_one();
+}
+
+void capture::run() {
+  std::vector<std::vector<std::byte>> chunks;
+
+  std::unique_lock lock{mutex_};
+
+  for (;;) {
+    while (pending_.empty() && !stopping_) {
+      cond_.wait(lock);
+    }
+
+    std::swap(chunks, pending_);
+    const bool stopping = stopping_;
+    lock.unlock();
+
+    for (auto &chunk : chunks) {
+      std::fwrite(chunk.data(), 1, chunk.size(), file_);
+    }
+    chunks.clear();
+
+    if (stopping) {
+      return;
+    }
+    lock.lock();
+  }
+}
+} // namespace redstone::net
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "socket.hpp"
+
+namespace redstone::net {
+// Writes simulated traffic to a pcapng file, with virtual timestamps and
+// synthesized IPv4/UDP/TCP headers. Unix sockets show up as 127.0.0.1 with a
+// port derived from their path.
+//
+// Each tracer thread appends records to its own buffer; full buffers are
+// written out by a background thread, so recording never touches the file.
+class capture {
+public:
+  enum class event {
+    delivered,
+    dropped,
+    replayed,
+  };
+
+  explicit capture(const std::string &path);
+  ~capture();
+
+  capture(const capture &) = delete;
+  capture &operator=(const capture &) = delete;
+
+  void datagram(event e, std::chrono::nanoseconds time, const socket_addr &from,
+                const socket_addr &to, std::span<const std::byte> payload);
+
+  void segment(event e, std::chrono::nanoseconds time, const socket_addr &from,
+               const socket_addr &to, std::uint32_t seq,
+               std::span<const std::byte> payload);
+
+private:
+  struct thread_buffer {
+    std::mutex mutex;
+    std::vector<std::byte> bytes;
+  };
+
+  static constexpr std::size_t flush_threshold = 256 * 1024;
+
+  void record(event e, std::chrono::nanoseconds time, const socket_addr &from,
+              const socket_addr &to, std::span<const std::byte> l4_header,
+              std::uint8_t protocol, std::span<const std::byte> payload);
+
+  thread_buffer &local();
+  void submit(std::vector<std::byte> chunk);
+  void run();
+
+  const std::uint64_t id_;
+  std::FILE *file_ = nullptr;
+  std::atomic<std::uint16_t> ip_id_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<std::vector<std::byte>> pending_;
+  std::vector<std::unique_ptr<thread_buffer>> buffers_;
+  bool stopping_ = false;
+  std::thread writer_;
+};
+} // namespace redstone::net
@@ -1,119 +1,487 @@
 #include "datagram_socket.hpp"
+#include "sim/scratch.hpp"
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <fmt/format.h>
 #include <memory>
+#include <memory_resource>
 #include <random>
+#include <utility>
+#include <sys/socket.h>
 #include <vector>
 
 namespace redstone::net {
-void datagram_pipe::send(std::vector<std::byte> data, socket_addr from) {
-  assert(data.size() < max_udp_packet_size);
+datagram_pipe::~datagram_pipe() {
+  auto node = inbox_.load(std::memory_order_acquire);
+  while (node) {
+    delete std::exchange(node, node->next);
+  }
+}
 
-  if (fault_options_.should_drop(rng_))
-    return;
+void datagram_pipe::send(payload data, addr_id from, addr_id to,
+                         std::size_t capacity, const route &link,
+                         std::chrono::nanoseconds now,
+                         random::xoshiro256_star_star &rng) {
+  const datagram dgram{std::move(data), from};
+  send_batch({&dgram, 1}, to, capacity, link, now, rng);
+}
 
-  const auto now = std::chrono::steady_clock::now();
-  const auto latency = fault_options_.latency(rng_);
-  const auto arrival = now + latency;
+void datagram_pipe::send_batch(std::span<const datagram> batch, addr_id to,
+                               std::size_t capacity, const route &link,
+                               std::chrono::nanoseconds now,
+                               random::xoshiro256_star_star &rng) {
+  const auto &faults = link.faults();
+  const auto real_now = std::chrono::steady_clock::now();
 
-  packet p{
-      .arrival = arrival,
-      .bytes = std::move(data),
-      .from = std::move(from),
+  // Delays are in virtual time, arrivals in real time
+  auto to_real = [this](std::chrono::nanoseconds d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d *
+                                                                time_scale_);
   };
 
-  std::vector<packet> replays;
-  const auto replay_count = fault_options_.replay_count(rng_);
-  replays.reserve(replay_count);
+  struct pending {
+    packet p;
+    // Virtual arrival time, for the capture
+    std::chrono::nanoseconds at;
+    capture::event kind;
+  };
+
+  std::pmr::vector<pending> ready{&sim::scratch()};
+  ready.reserve(batch.size());
+
+  auto link_stats = link.stats();
+
+  for (auto &[data, from] : batch) {
+    assert(data->size() < max_udp_packet_size);
 
-  while (replays.size() < replay_count) {
-    replays.push_back(p);
-    replays.back().arrival = now + fault_options_.latency(rng_) * 2;
+    // Arrival = enqueue + queueing + serialization + propagation
+    const auto sent = link.transmit(data->size(), now);
+    const bool lost = sent && faults.should_drop(rng);
+
+    if (link_stats) {
+      link_stats->packets.add();
+      link_stats->bytes.add(data->size());
+      if (!sent) {
+        link_stats->dropped_queue.add();
+      } else if (lost) {
+        link_stats->dropped_fault.add();
+      }
+    }
+
+    if (!sent || lost) {
+      if (capture_)
+        capture_->datagram(capture::event::dropped, now, net_->address(from),
+                           net_->address(to), *data);
+      continue;
+    }
+
+    const auto latency = faults.latency(rng);
+
+    if (link_stats) {
+      const auto delay = (*sent + latency).count();
+      link_stats->latency_total_ns.add(delay);
+      link_stats->latency_max_ns.max(delay);
+    }
+
+    packet p{
+        .arrival = real_now + to_real(*sent + latency),
+        .bytes = data,
+        .from = from,
+    };
+
+    const auto original = ready.size();
+    ready.push_back({std::move(p), now + *sent + latency,
+                     capture::event::delivered});
+
+    const auto replay_count = faults.replay_count(rng);
+    if (link_stats) {
+      link_stats->replays.add(replay_count);
+    }
+
+    for (std::size_t i = 0; i < replay_count; ++i) {
+      packet replay = ready[original].p;
+      const auto delay = *sent + faults.latency(rng) * 2;
+      replay.arrival = real_now + to_real(delay);
+      ready.push_back({std::move(replay), now + delay,
+                       capture::event::replayed});
+    }
   }
 
-  std::unique_lock lock{mutex_};
+  if (ready.empty())
+    return;
+
+  auto node = std::make_unique<batch_node>();
+  node->packets.reserve(ready.size());
+
+  for (auto &[p, at, kind] : ready) {
+    // Like Linux, datagrams are dropped once the receive buffer is full.
+    // Packets still in flight count too, they are held in memory all the same.
+    const auto size = p.bytes->size() + datagram_overhead;
+
+    auto queued = queued_bytes_.load(std::memory_order_relaxed);
+    do {
+      if (capacity <= queued) {
+        kind = capture::event::dropped;
+        at = now;
+        break;
+      }
+    } while (!queued_bytes_.compare_exchange_weak(queued, queued + size,
+                                                  std::memory_order_relaxed));
+
+    if (capture_)
+      capture_->datagram(kind, at, net_->address(p.from), net_->address(to),
+                         *p.bytes);
+
+    if (kind == capture::event::dropped) {
+      if (stats_)
+        stats_->dropped_buffer.add();
+      continue;
+    }
 
-  packets_.push(std::move(p));
-  for (auto &replay : replays) {
-    packets_.push(std::move(replay));
+    if (stats_) {
+      stats_->queued_bytes.add(p.bytes->size());
+      stats_->peak_queued_bytes.max(stats_->queued_bytes.get());
+    }
+    node->packets.push_back(std::move(p));
   }
 
-  cond_.notify_one();
-  lock.unlock();
+  if (!node->packets.empty())
+    push(node.release());
 }
 
-std::pair<std::vector<std::byte>, socket_addr> datagram_pipe::recv() {
-  std::unique_lock lock{mutex_};
+void datagram_pipe::push(batch_node *node) {
+  node->next = inbox_.load(std::memory_order_relaxed);
+  while (!inbox_.compare_exchange_weak(node->next, node)) {
+  }
 
-  while (true) {
-    if (packets_.empty()) {
-      cond_.wait(lock);
-      continue;
+  // Pairs with wait_ready: either the receiver sees the node before going
+  // to sleep, or it is already waiting by the time the mutex is free
+  if (waiting_.load()) {
+    std::unique_lock lock{mutex_};
+    cond_.notify_one();
+  }
+}
+
+void datagram_pipe::drain() {
+  auto node = inbox_.exchange(nullptr, std::memory_order_acquire);
+
+  // Restore send order, so that packets with equal arrival times from one
+  // sender are received in order
+  batch_node *oldest = nullptr;
+  while (node) {
+    auto next = node->next;
+    node->next = oldest;
+    oldest = node;
+    node = next;
+  }
+
+  while (oldest) {
+    std::unique_ptr<batch_node> owned{oldest};
+    for (auto &p : owned->packets) {
+      p.seq = next_seq_++;
+      packets_.push_back(std::move(p));
+      std::push_heap(packets_.begin(), packets_.end());
     }
+    oldest = owned->next;
+  }
+}
 
-    auto &p = packets_.top();
+bool datagram_pipe::wait_ready(std::unique_lock<std::mutex> &lock,
+                               bool nonblocking) {
+  while (true) {
+    drain();
 
-    if (p.arrival > std::chrono::steady_clock::now()) {
-      cond_.wait_until(lock, p.arrival);
-      continue;
+    const auto now = std::chrono::steady_clock::now();
+    if (!packets_.empty() && packets_.front().arrival <= now) {
+      return true;
+    }
+    if (nonblocking || closed_) {
+      return false;
     }
 
-    auto data = std::move(p.bytes);
-    auto addr = std::move(p.from);
-    packets_.pop();
-    return {data, addr};
+    waiting_.store(true);
+    if (inbox_.load() == nullptr) {
+      if (packets_.empty()) {
+        cond_.wait(lock);
+      } else {
+        cond_.wait_until(lock, packets_.front().arrival);
+      }
+    }
+    waiting_.store(false, std::memory_order_relaxed);
+  }
+}
+
+datagram datagram_pipe::pop_ready() {
+  std::pop_heap(packets_.begin(), packets_.end());
+  auto data = std::move(packets_.back().bytes);
+  auto addr = packets_.back().from;
+  packets_.pop_back();
+  queued_bytes_.fetch_sub(data->size() + datagram_overhead,
+                          std::memory_order_relaxed);
+  if (stats_) {
+    stats_->queued_bytes.sub(data->size());
+    stats_->received_packets.add();
+    stats_->received_bytes.add(data->size());
   }
+  return {std::move(data), addr};
 }
 
-void datagram_socket::deliver(std::vector<std::byte> dgram, socket_addr addr) {
+void datagram_pipe::close() {
+  std::scoped_lock lock{mutex_};
+  closed_ = true;
+  cond_.notify_all();
+}
+
+std::optional<datagram> datagram_pipe::recv(bool nonblocking) {
   std::unique_lock lock{mutex_};
-  inbound_.send(std::move(dgram), std::move(addr));
+
+  if (!wait_ready(lock, nonblocking)) {
+    return std::nullopt;
+  }
+  return pop_ready();
+}
+
+std::size_t datagram_pipe::recv_batch(std::pmr::vector<datagram> &out,
+                                      std::size_t max, std::size_t min) {
+  std::unique_lock lock{mutex_};
+
+  std::size_t n = 0;
+
+  while (n < max && wait_ready(lock, min <= n)) {
+    out.push_back(pop_ready());
+    n++;
+  }
+  return n;
+}
+
+void datagram_socket::deliver(payload dgram, addr_id from, addr_id to,
+                              const route &link, std::chrono::nanoseconds now,
+                              random::xoshiro256_star_star &rng) {
+  inbound_.send(std::move(dgram), from, to, recv_buffer_size(), link, now,
+                rng);
+}
+
+void datagram_socket::deliver_batch(std::span<const datagram> batch,
+                                    addr_id to, const route &link,
+                                    std::chrono::nanoseconds now,
+                                    random::xoshiro256_star_star &rng) {
+  inbound_.send_batch(batch, to, recv_buffer_size(), link, now, rng);
 }
 
-std::int64_t datagram_socket::send_to(
+std::int64_t datagram_socket::send(
     tl::function_ref<int(std::span<std::byte>)> read_data_callback,
-    std::size_t bytes, const socket_addr &dst) {
-  auto sock = net_->get(dst);
-  if (!sock) {
-    return -EHOSTUNREACH;
+    std::size_t bytes, int flags, const socket_addr *dst) {
+  if (!dst) {
+    return -EDESTADDRREQ;
   }
 
-  auto dgram_sock = std::dynamic_pointer_cast<datagram_socket>(sock);
-  if (!dgram_sock) {
-    return -ECONNREFUSED;
+  // Datagram sends never block, so MSG_DONTWAIT needs no handling here.
+  if (max_udp_packet_size < bytes) {
+    return -EMSGSIZE;
   }
 
-  std::vector<std::byte> buf{bytes, std::byte{}};
-  auto res = read_data_callback(buf);
+  std::pmr::vector<std::byte> staged(bytes, &sim::scratch());
+  auto res = read_data_callback(staged);
   if (res < 0) {
     return res;
   }
 
-  dgram_sock->deliver(buf, {});
+  outgoing_datagram dgram{
+      .bytes = staged,
+      .dst = *dst,
+  };
+  res = send_batch({&dgram, 1}, flags);
+  if (res < 0) {
+    return res;
+  }
   return bytes;
 }
 
-std::int64_t datagram_socket::recv_from(
+std::int64_t datagram_socket::send_batch(std::span<outgoing_datagram> batch,
+                                         int flags) {
+  std::size_t sent = 0;
+  std::pmr::vector<datagram> run{&sim::scratch()};
+  std::pmr::vector<std::shared_ptr<datagram_socket>> receivers{
+      &sim::scratch()};
+
+  // Like Linux, sending from an unbound IPv4 socket binds an ephemeral port
+  // first, so that receivers can reply
+  if (local_addr() == unspecified_addr && get_af() == address_family::ipv4) {
+    addr_id id;
+    if (auto err = net_->bind_ephemeral(host_, {}, shared_from_this(), id)) {
+      return -err.value();
+    }
+  }
+
+  std::scoped_lock lock{send_mutex_};
+  const auto now = sim_->elapsed();
+
+  while (sent < batch.size()) {
+    const auto &dst = batch[sent].dst;
+
+    receivers.clear();
+    addr_id to = unspecified_addr;
+    auto err = resolve(dst, to, receivers);
+    if (err == 0 && max_udp_packet_size < batch[sent].bytes.size()) {
+      err = -EMSGSIZE;
+    }
+
+    if (err < 0) {
+      if (sent == 0) {
+        return err;
+      }
+      break;
+    }
+
+    run.clear();
+    while (sent < batch.size() && batch[sent].dst == dst &&
+           batch[sent].bytes.size() <= max_udp_packet_size) {
+      const auto bytes = batch[sent].bytes;
+      run.emplace_back(std::make_shared<const std::vector<std::byte>>(
+                           bytes.begin(), bytes.end()),
+                       local_addr());
+      sent++;
+    }
+
+    if (auto stats = this->stats()) {
+      stats->sent_packets.add(run.size());
+      for (auto &[data, from] : run) {
+        stats->sent_bytes.add(data->size());
+      }
+    }
+
+    // Receivers share the payloads, but sample faults separately
+    for (auto &receiver : receivers) {
+      deliver_to(*receiver, run, to, now);
+    }
+  }
+
+  return sent;
+}
+
+std::int64_t datagram_socket::resolve(
+    const socket_addr &dst, addr_id &id,
+    std::pmr::vector<std::shared_ptr<datagram_socket>> &out) {
+  // Every address with a receiver was interned when it was bound or joined.
+  // Senders mostly talk to one peer, and an address keeps its id, so the
+  // last destination found skips the lookup.
+  std::optional<addr_id> found;
+  if (last_dst_ && last_dst_->first == dst) {
+    found = last_dst_->second;
+  } else if ((found = net_->find(dst))) {
+    last_dst_.emplace(dst, *found);
+  }
+
+  if (is_broadcast(dst) || is_multicast(dst)) {
+    if (is_broadcast(dst) && !broadcast()) {
+      return -EACCES;
+    }
+
+    // Like real multicast, a group without members silently loses everything
+    auto members = found ? net_->members(*found) : nullptr;
+    if (!members) {
+      return 0;
+    }
+
+    id = *found;
+    out.reserve(members->size());
+    for (auto &member : *members) {
+      // Only datagram sockets join groups
+      if (auto sock = member.lock()) {
+        out.push_back(std::static_pointer_cast<datagram_socket>(sock));
+      }
+    }
+    return 0;
+  }
+
+  auto sock = found ? net_->get(*found) : nullptr;
+  if (!sock) {
+    return -EHOSTUNREACH;
+  }
+  if (sock->kind() != sim::fd_kind::datagram_socket) {
+    return -ECONNREFUSED;
+  }
+  id = *found;
+  out.push_back(std::static_pointer_cast<datagram_socket>(std::move(sock)));
+  return 0;
+}
+
+void datagram_socket::deliver_to(datagram_socket &receiver,
+                                 std::span<const datagram> run,
+                                 addr_id dst, std::chrono::nanoseconds now) {
+  const auto &topology = sim_->topology();
+
+  // A partitioned link silently loses everything sent over it
+  if (topology.partitioned(host_, receiver.host_, now)) {
+    if (auto stats = topology.link(host_, receiver.host_).stats()) {
+      stats->packets.add(run.size());
+      stats->dropped_partition.add(run.size());
+    }
+    if (auto cap = sim_->capture()) {
+      for (auto &[data, from] : run) {
+        cap->datagram(capture::event::dropped, now, net_->address(from),
+                      net_->address(dst), *data);
+      }
+    }
+    return;
+  }
+
+  receiver.deliver_batch(run, dst, topology.link(host_, receiver.host_), now,
+                         rng_);
+}
+
+std::int64_t datagram_socket::recv(
     tl::function_ref<int(std::span<const std::byte>)> write_data_callback,
-    std::size_t bytes, socket_addr *dst) {
-  auto [data, addr] = inbound_.recv();
+    std::size_t bytes, int flags, std::optional<addr_id> *from) {
+  auto packet = inbound_.recv(nonblocking() || (flags & MSG_DONTWAIT) != 0);
+  if (!packet) {
+    return -EAGAIN;
+  }
+
+  auto &[data, addr] = *packet;
 
-  if (dst) {
-    *dst = addr;
+  if (from) {
+    *from = addr;
   }
 
-  if (bytes < data.size()) {
-    data.resize(bytes);
+  std::span<const std::byte> out = *data;
+  out = out.first(std::min(bytes, out.size()));
+
+  write_data_callback(out);
+  return out.size();
+}
+
+int datagram_socket::bind(const socket_addr &addr) {
+  if (auto err = net_->bind(host_, addr, shared_from_this())) {
+    return -err.value();
   }
+  return 0;
+}
 
-  write_data_callback(data);
-  return data.size();
+std::int64_t datagram_socket::recv_batch(std::pmr::vector<datagram> &out,
+                                         std::size_t max, int flags,
+                                         bool wait_for_all) {
+  std::size_t min = wait_for_all ? max : 1;
+  if (nonblocking() || (flags & MSG_DONTWAIT) != 0) {
+    min = 0;
+  }
+
+  auto n = inbound_.recv_batch(out, max, min);
+  if (n == 0 && max != 0) {
+    return -EAGAIN;
+  }
+  return n;
 }
 
-datagram_socket::datagram_socket(address_family af, sim::simulator &sim)
-    : socket{af, socket_type::stream}, net_{&sim.net()},
-      inbound_{sim.initial_options().net_faults} {
-  inbound_.seed(sim.rng());
+datagram_socket::datagram_socket(address_family af, sim::simulator &sim,
+                                 endpoint_id host)
+    : socket{sim::fd_kind::datagram_socket, af, socket_type::datagram,
+             sim.initial_options().socket_buffers,
+             sim.net().track(socket_type::datagram, host)},
+      inbound_{sim.initial_options().time_scale, &sim.net(), sim.capture(),
+               stats()},
+      net_{&sim.net()}, sim_{&sim}, host_{host} {
+  rng_.seed_from(sim.rng());
 }
-} // namespace redstone::net
\ No newline at end of file
+} // namespace redstone::net
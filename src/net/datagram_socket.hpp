@@ -1,45 +1,108 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
-#include <queue>
+#include <optional>
 #include <span>
+#include <utility>
 #include <vector>
 
+#include "capture.hpp"
 #include "fault.hpp"
 #include "network.hpp"
 #include "random/xoshiro.hpp"
 #include "sim/simulator.hpp"
 #include "socket.hpp"
+#include "stats.hpp"
+#include "topology.hpp"
 
 namespace redstone::net {
-// A one-way UDP stream
+constexpr std::size_t max_udp_packet_size =
+    std::numeric_limits<uint16_t>::max() - 128;
+
+// Receive buffer space charged per datagram on top of its payload, so that
+// empty datagrams cannot queue up without bound
+constexpr std::size_t datagram_overhead = 256;
+
+// Datagram contents never change once sent, so replays and every receiver
+// of a broadcast share one buffer
+using payload = std::shared_ptr<const std::vector<std::byte>>;
+
+// A received datagram and the interned address it was sent from
+using datagram = std::pair<payload, addr_id>;
+
+// A datagram waiting to be sent to `dst`. The sender stages its contents,
+// usually in the scratch arena, and sending copies them into a payload.
+struct outgoing_datagram {
+  std::span<const std::byte> bytes;
+  socket_addr dst;
+};
+
+// The receive side of a UDP socket. Any number of senders can enqueue
+// concurrently without locking, while a single receiver reads.
 class datagram_pipe {
 public:
-  explicit datagram_pipe(const net_fault_options &fault_options)
-      : fault_options_{fault_options} {}
+  // Every packet is recorded to `capture` and counted in `stats`, if given.
+  // Captured addresses are looked up in `net`, which is required with a
+  // capture.
+  explicit datagram_pipe(double time_scale, const network *net = nullptr,
+                         capture *capture = nullptr,
+                         socket_stats *stats = nullptr)
+      : time_scale_{time_scale}, net_{net}, capture_{capture}, stats_{stats} {
+  }
 
-  void send(std::vector<std::byte> packet, socket_addr from);
-  std::pair<std::vector<std::byte>, socket_addr> recv();
+  ~datagram_pipe();
 
-  template <typename Rng>
-  void seed(Rng &rng) {
-    rng_.seed_from(rng);
-  }
+  datagram_pipe(const datagram_pipe &) = delete;
+  datagram_pipe &operator=(const datagram_pipe &) = delete;
+
+  // Enqueues a packet sent to `to` at virtual time `now`, applying the
+  // queueing and faults of the link it travels over. Faults are sampled from
+  // the sender's `rng`. The packet is dropped if `capacity` bytes are
+  // already queued.
+  void send(payload packet, addr_id from, addr_id to, std::size_t capacity,
+            const route &link, std::chrono::nanoseconds now,
+            random::xoshiro256_star_star &rng);
+
+  // Like send, but hands the whole batch to the receiver at once
+  void send_batch(std::span<const datagram> batch, addr_id to,
+                  std::size_t capacity, const route &link,
+                  std::chrono::nanoseconds now,
+                  random::xoshiro256_star_star &rng);
+
+  // Waits for the next packet to arrive. If `nonblocking` is set and no
+  // packet has arrived yet, returns std::nullopt instead of waiting.
+  std::optional<datagram> recv(bool nonblocking);
+
+  // Appends up to `max` arrived packets to `out`, waiting until at least
+  // `min` are available. Returns the number of packets received.
+  std::size_t recv_batch(std::pmr::vector<datagram> &out, std::size_t max,
+                         std::size_t min);
+
+  // Wakes the receiver, and makes every later wait return at once
+  void close();
 
 private:
   struct packet {
     std::chrono::steady_clock::time_point arrival;
-    std::vector<std::byte> bytes;
+    payload bytes;
     mutable std::size_t consumed = 0;
-    socket_addr from;
+    addr_id from = unspecified_addr;
+    // Keeps packets with equal arrival times in send order
+    std::uint64_t seq = 0;
 
     friend bool operator<(const packet &lhs, const packet &rhs) {
       // Flip ordering
-      return lhs.arrival > rhs.arrival;
+      if (lhs.arrival != rhs.arrival)
+        return lhs.arrival > rhs.arrival;
+      return lhs.seq > rhs.seq;
     }
 
     friend bool operator>(const packet &lhs, const packet &rhs) {
@@ -55,41 +118,113 @@ private:
     }
 
     std::span<const std::byte> remaining() const {
-      std::span<const std::byte> data = bytes;
+      std::span<const std::byte> data = *bytes;
       return data.subspan(consumed);
     }
   };
 
+  // Senders push whole batches onto a lock-free stack, newest first. The
+  // receiver takes the stack and moves it into packets_ before looking for
+  // the next arrival.
+  struct batch_node {
+    std::vector<packet> packets;
+    batch_node *next = nullptr;
+  };
+
+  std::atomic<batch_node *> inbox_ = nullptr;
+  // Payload plus overhead of every accepted packet not yet received
+  std::atomic<std::size_t> queued_bytes_ = 0;
+  // Set while the receiver sleeps, so that senders only lock to wake it
+  std::atomic<bool> waiting_ = false;
+
+  // Only accessed by the receiver
   std::mutex mutex_;
   std::condition_variable cond_;
-  std::priority_queue<packet> packets_;
+  // A heap by arrival, front() is the next packet due
+  std::vector<packet> packets_;
+  std::uint64_t next_seq_ = 0;
+  bool closed_ = false;
 
-  const net_fault_options fault_options_{};
+  const double time_scale_;
+  const network *const net_;
+  capture *const capture_;
+  socket_stats *const stats_;
 
-  // Only accessed by writer
-  random::xoshiro256_star_star rng_;
+  void push(batch_node *node);
+  void drain();
 
-  void send_packet(std::span<const std::byte> packet);
-  packet recv_packet();
+  bool wait_ready(std::unique_lock<std::mutex> &lock, bool nonblocking);
+  datagram pop_ready();
 };
 
 class datagram_socket : public socket {
 public:
-  explicit datagram_socket(address_family af, sim::simulator &sim);
+  explicit datagram_socket(address_family af, sim::simulator &sim,
+                           endpoint_id host);
 
-  std::int64_t
-  send_to(tl::function_ref<int(std::span<std::byte>)> read_data_callback,
-          std::size_t bytes, const socket_addr &dst);
+  endpoint_id host() const { return host_; }
+
+  // SO_BROADCAST, required to send to the broadcast address
+  bool broadcast() const { return broadcast_.load(std::memory_order_relaxed); }
+  void set_broadcast(bool enabled) {
+    broadcast_.store(enabled, std::memory_order_relaxed);
+  }
+
+  // Datagram sockets are never connected, so `dst` is required
+  std::int64_t send(tl::function_ref<int(std::span<std::byte>)> load,
+                    std::size_t bytes, int flags,
+                    const socket_addr *dst) override;
+
+  std::int64_t recv(tl::function_ref<int(std::span<const std::byte>)> store,
+                    std::size_t bytes, int flags,
+                    std::optional<addr_id> *from) override;
+
+  int bind(const socket_addr &addr) override;
 
-  std::int64_t recv_from(
-      tl::function_ref<int(std::span<const std::byte>)> write_data_callback,
-      std::size_t bytes, socket_addr *dst);
+  // A hook still waiting for a datagram returns, as nothing can receive it
+  void closed() override { inbound_.close(); }
 
-  void deliver(std::vector<std::byte> dgram, socket_addr addr);
+  // Sends the datagrams in order, delivering each run of datagrams to the
+  // same destination as one batch. Broadcast and multicast runs go to every
+  // group member, sharing their payloads. Returns how many were sent, or an
+  // error if the first one failed.
+  std::int64_t send_batch(std::span<outgoing_datagram> batch, int flags);
+
+  // Receives up to `max` datagrams into `out`. Blocking sockets wait for one
+  // datagram, or for all `max` of them if `wait_for_all` is set. Returns the
+  // number received.
+  std::int64_t recv_batch(std::pmr::vector<datagram> &out, std::size_t max,
+                          int flags, bool wait_for_all);
+
+  // Called by senders, sampling faults from the sender's `rng`
+  void deliver(payload dgram, addr_id from, addr_id to, const route &link,
+               std::chrono::nanoseconds now,
+               random::xoshiro256_star_star &rng);
+  void deliver_batch(std::span<const datagram> batch, addr_id to,
+                     const route &link, std::chrono::nanoseconds now,
+                     random::xoshiro256_star_star &rng);
 
 private:
+  // Finds the sockets that a datagram to `dst` reaches, and the id of `dst`
+  std::int64_t
+  resolve(const socket_addr &dst, addr_id &id,
+          std::pmr::vector<std::shared_ptr<datagram_socket>> &out);
+
+  void deliver_to(datagram_socket &receiver, std::span<const datagram> run,
+                  addr_id dst, std::chrono::nanoseconds now);
+
   datagram_pipe inbound_;
-  std::mutex mutex_;
   network *net_;
+  sim::simulator *sim_;
+  endpoint_id host_;
+  std::atomic<bool> broadcast_ = false;
+
+  // Held while sending, as the threads and processes of the owning replica
+  // may share the socket. Guards the members below.
+  std::mutex send_mutex_;
+  // Samples faults of outgoing datagrams
+  random::xoshiro256_star_star rng_;
+  // The last destination resolved and its id
+  std::optional<std::pair<socket_addr, addr_id>> last_dst_;
 };
 } // namespace redstone::net
\ No newline at end of file
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <cstdio>
+#include <limits>
 #include <random>
 
 #include "random/rng.hpp"
@@ -13,6 +15,20 @@ struct net_fault_options {
   double p_drop = 0.0;
   double p_replay = 0.0;
 
+  // Bytes per second of virtual time, or 0 for an unlimited link
+  std::uint64_t bandwidth = 0;
+  // Bytes that may leave back to back before the link rate applies
+  std::uint64_t burst = 0;
+  // Bytes that may wait for the link before further packets are dropped
+  std::uint64_t queue_limit = std::numeric_limits<std::uint64_t>::max();
+
+  // Virtual time needed to put `bytes` on the wire
+  std::chrono::nanoseconds serialization(std::uint64_t bytes) const {
+    constexpr std::uint64_t ns_per_s = 1'000'000'000;
+    return std::chrono::nanoseconds{bytes / bandwidth * ns_per_s +
+                                    bytes % bandwidth * ns_per_s / bandwidth};
+  }
+
   template <typename Rng>
   std::chrono::nanoseconds latency(Rng &&rng) const {
     return random::gen_range(rng, min_latency,
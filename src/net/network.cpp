@@ -1,39 +1,354 @@
 #include "network.hpp"
+#include "random/splitmix.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cassert>
 #include <cerrno>
+#include <stdexcept>
 #include <system_error>
 
 namespace redstone::net {
-std::error_code network::bind(socket_addr addr, std::shared_ptr<socket> sock) {
-  std::unique_lock lock{mutex_};
+network::network(std::uint64_t seed)
+    : chunks_{new std::atomic<entry *>[max_chunks]{}}, seed_{seed} {
+  for (auto &shard : shards_) {
+    shard.current = std::make_unique<const address_map>();
+    shard.map.store(shard.current.get(), std::memory_order_release);
+  }
+  groups_.store(std::make_shared<const group_map>());
 
-  auto &slot = map_[addr];
+  [[maybe_unused]] auto id = intern(ipv4_addr{});
+  assert(id == unspecified_addr);
+}
 
-  if (slot.lock() != nullptr) {
-    return std::error_code{EADDRNOTAVAIL, std::generic_category()};
+network::~network() {
+  for (std::size_t i = 0; i < max_chunks; ++i) {
+    delete[] chunks_[i].load(std::memory_order_relaxed);
+  }
+}
+
+network::shard &network::shard_for(const socket_addr &addr) const {
+  // unordered_map buckets on the low bits of the hash, so pick shards with
+  // the high bits to keep the two independent.
+  const std::uint64_t h = std::hash<socket_addr>{}(addr);
+  return shards_[h >> (64 - shard_bits)];
+}
+
+// Lookups bump readers before loading the map, and interning swaps the map
+// before reclaim() checks readers. All of it is seq_cst, so either the lookup
+// sees the new map or reclaim() sees the lookup.
+void network::reclaim(shard &shard, std::unique_lock<std::mutex> &lock) {
+  assert(lock.owns_lock());
+  if (shard.readers.load(std::memory_order_seq_cst) != 0) {
+    return;
+  }
+  shard.retired.clear();
+  shard.retired_pending.store(false, std::memory_order_seq_cst);
+}
+
+network::entry &network::allocate(addr_id id) {
+  auto &chunk = chunks_[id >> chunk_bits];
+
+  // Interning in different shards can race for the same chunk
+  auto entries = chunk.load(std::memory_order_acquire);
+  if (!entries) {
+    auto fresh = new entry[chunk_size];
+    if (chunk.compare_exchange_strong(entries, fresh,
+                                      std::memory_order_acq_rel)) {
+      entries = fresh;
+    } else {
+      delete[] fresh;
+    }
+  }
+  return entries[id & (chunk_size - 1)];
+}
+
+addr_id network::intern(const socket_addr &addr) {
+  if (auto id = find(addr)) {
+    return *id;
+  }
+
+  auto &shard = shard_for(addr);
+  std::unique_lock lock{shard.mutex};
+
+  const auto &current = *shard.current;
+  if (auto it = current.find(addr); it != current.end()) {
+    return it->second;
+  }
+
+  const auto id = next_id_.fetch_add(1, std::memory_order_relaxed);
+  if (max_chunks * chunk_size <= id) {
+    throw std::length_error{"too many socket addresses"};
   }
 
-  slot = sock;
+  // The entry is filled in before the id is published with the map
+  allocate(id).addr = addr;
+
+  auto next = std::make_unique<address_map>(current);
+  next->emplace(addr, id);
+
+  shard.map.store(next.get(), std::memory_order_seq_cst);
+  shard.retired.push_back(std::exchange(shard.current, std::move(next)));
+  shard.retired_pending.store(true, std::memory_order_seq_cst);
+  reclaim(shard, lock);
+  return id;
+}
+
+std::optional<addr_id> network::find(const socket_addr &addr) const {
+  auto &shard = shard_for(addr);
+
+  shard.readers.fetch_add(1, std::memory_order_seq_cst);
+  const auto &map = *shard.map.load(std::memory_order_seq_cst);
+  std::optional<addr_id> id;
+  if (auto it = map.find(addr); it != map.end()) {
+    id = it->second;
+  }
+
+  // The last lookup out frees the maps it may have been holding back. If an
+  // intern holds the lock, they wait for a later intern or lookup.
+  if (shard.readers.fetch_sub(1, std::memory_order_seq_cst) == 1 &&
+      shard.retired_pending.load(std::memory_order_seq_cst)) {
+    std::unique_lock lock{shard.mutex, std::try_to_lock};
+    if (lock) {
+      reclaim(shard, lock);
+    }
+  }
+  return id;
+}
+
+std::error_code network::bind(addr_id id, std::shared_ptr<socket> sock) {
+  auto &bound = slot(id).bound;
+
+  auto current = bound.load(std::memory_order_acquire);
+  do {
+    if (!current.expired()) {
+      return std::error_code{EADDRNOTAVAIL, std::generic_category()};
+    }
+  } while (!bound.compare_exchange_weak(current, sock,
+                                        std::memory_order_acq_rel));
+
+  sock->set_local_addr(id);
+  if (auto stats = sock->stats()) {
+    stats->set_addr(id);
+  }
+
+  if (auto ip = std::get_if<ipv4_addr>(&address(id));
+      ip && sock->type() == socket_type::datagram) {
+    ipv4_addr group = *ip;
+    std::fill(std::begin(group.octets), std::end(group.octets), '\xff');
+    join(intern(group), std::move(sock));
+  }
   return {};
 }
 
-void network::clear(const socket_addr &addr, socket *s) {
-  std::unique_lock lock{mutex_};
+std::error_code network::bind(endpoint_id host, const socket_addr &addr,
+                              std::shared_ptr<socket> sock) {
+  if (auto ip = std::get_if<ipv4_addr>(&addr); ip && ip->port == 0) {
+    addr_id id;
+    return bind_ephemeral(host, *ip, std::move(sock), id);
+  }
+  return bind(intern(addr), std::move(sock));
+}
+
+ipv4_addr network::host_addr(endpoint_id host, std::uint16_t port) {
+  assert(host < (1u << 24));
+  ipv4_addr addr{.port = port, .octets = {}};
+  addr.octets[1] = static_cast<char>(host >> 16);
+  addr.octets[2] = static_cast<char>(host >> 8);
+  addr.octets[3] = static_cast<char>(host);
+  return addr;
+}
 
-  auto it = map_.find(addr);
+port_allocator &network::ports_for(endpoint_id host) {
+  std::unique_lock lock{ports_mutex_};
 
-  if (it == map_.end()) {
-    return;
+  auto &ports = ports_[host];
+  if (!ports) {
+    // Independent of the order hosts first bind in
+    ports = std::make_unique<port_allocator>(
+        random::split_mix{seed_ ^ mix_hash(host)}.next());
   }
+  return *ports;
+}
 
-  auto p = it->second.lock();
-  if (p != nullptr && p.get() != s)
-    return;
+std::error_code network::bind_ephemeral(endpoint_id host, ipv4_addr ip,
+                                        std::shared_ptr<socket> sock,
+                                        addr_id &id) {
+  if (std::all_of(std::begin(ip.octets), std::end(ip.octets),
+                  [](char c) { return c == 0; })) {
+    ip = host_addr(host, 0);
+  }
+
+  auto &ports = ports_for(host);
+
+  // Ports in the range can also be bound explicitly, possibly by other
+  // hosts. Those are skipped, and stay free in this host's allocator.
+  for (auto tries = port_allocator::port_count; tries != 0; --tries) {
+    auto port = ports.allocate();
+    if (!port) {
+      break;
+    }
+
+    ip.port = htons(*port);
 
-  map_.erase(it);
+    // Taken ports were interned when they were bound, so checking them does
+    // not intern anything. Only the port the socket ends up with is.
+    if (auto taken = find(ip); taken && get(*taken)) {
+      ports.release(*port);
+      continue;
+    }
+
+    id = intern(ip);
+    if (!bind(id, sock)) {
+      sock->set_port_lease(port_lease{&ports, *port});
+      return {};
+    }
+    ports.release(*port);
+  }
+  return std::error_code{EADDRINUSE, std::generic_category()};
+}
+
+void network::clear(addr_id id, socket *s) {
+  auto &bound = slot(id).bound;
+
+  auto current = bound.load(std::memory_order_acquire);
+  do {
+    auto p = current.lock();
+    if (p != nullptr && p.get() != s)
+      return;
+  } while (!bound.compare_exchange_weak(current, std::weak_ptr<socket>{},
+                                        std::memory_order_acq_rel));
+}
+
+std::error_code network::join(addr_id group, std::shared_ptr<socket> sock) {
+  std::unique_lock lock{groups_mutex_};
+
+  auto current = groups_.load(std::memory_order_acquire);
+
+  auto members = std::make_shared<member_list>();
+  if (auto it = current->find(group); it != current->end()) {
+    members->reserve(it->second->size() + 1);
+
+    for (auto &m : *it->second) {
+      auto s = m.lock();
+      if (s == sock) {
+        return std::error_code{EADDRINUSE, std::generic_category()};
+      }
+      // Drop members that have gone away while copying
+      if (s) {
+        members->push_back(m);
+      }
+    }
+  }
+  members->push_back(std::move(sock));
+
+  auto next = std::make_shared<group_map>(*current);
+  (*next)[group] = std::move(members);
+
+  groups_.store(std::move(next), std::memory_order_release);
+  return {};
+}
+
+std::error_code network::leave(addr_id group, socket *sock) {
+  std::unique_lock lock{groups_mutex_};
+
+  auto current = groups_.load(std::memory_order_acquire);
+
+  auto it = current->find(group);
+  if (it == current->end()) {
+    return std::error_code{EADDRNOTAVAIL, std::generic_category()};
+  }
+
+  auto members = std::make_shared<member_list>();
+  bool found = false;
+
+  for (auto &m : *it->second) {
+    auto s = m.lock();
+    if (s.get() == sock) {
+      found = true;
+    } else if (s) {
+      members->push_back(m);
+    }
+  }
+
+  if (!found) {
+    return std::error_code{EADDRNOTAVAIL, std::generic_category()};
+  }
+
+  auto next = std::make_shared<group_map>(*current);
+  if (members->empty()) {
+    next->erase(group);
+  } else {
+    (*next)[group] = std::move(members);
+  }
+
+  groups_.store(std::move(next), std::memory_order_release);
+  return {};
+}
+
+std::shared_ptr<socket_stats> network::track(socket_type type,
+                                            endpoint_id host) {
+  auto &shard = sockets_[host % socket_shard_count];
+  auto entry = std::make_unique<tracked_socket>(type, host);
+  auto stats = &entry->stats;
+
+  std::uint64_t seq;
+  {
+    std::lock_guard lock{shard.mutex};
+    seq = shard.next_seq++;
+    shard.open.emplace(seq, std::move(entry));
+  }
+  return {stats, [this, &shard, seq](socket_stats *) { untrack(shard, seq); }};
 }
 
-std::shared_ptr<socket> network::get(const socket_addr &addr) {
-  std::unique_lock lock{mutex_};
-  return map_[addr].lock();
+void network::untrack(socket_shard &shard, std::uint64_t seq) {
+  std::lock_guard lock{shard.mutex};
+  auto it = shard.open.find(seq);
+  assert(it != shard.open.end());
+
+  const auto &[type, host, s] = *it->second;
+  auto &closed = shard.closed[{host, type}];
+  closed.sockets++;
+  closed.sent_packets += s.sent_packets.get();
+  closed.sent_bytes += s.sent_bytes.get();
+  closed.received_packets += s.received_packets.get();
+  closed.received_bytes += s.received_bytes.get();
+  closed.blocked_sends += s.blocked_sends.get();
+  closed.peak_queued_bytes =
+      std::max(closed.peak_queued_bytes, s.peak_queued_bytes.get());
+  closed.dropped_buffer += s.dropped_buffer.get();
+
+  shard.open.erase(it);
+}
+
+void network::for_each_open(
+    tl::function_ref<void(const tracked_socket &)> fn) const {
+  for (auto &shard : sockets_) {
+    std::lock_guard lock{shard.mutex};
+    for (auto &[seq, entry] : shard.open) {
+      fn(*entry);
+    }
+  }
+}
+
+void network::for_each_closed(
+    tl::function_ref<void(endpoint_id, socket_type, const closed_sockets &)>
+        fn) const {
+  for (auto &shard : sockets_) {
+    std::lock_guard lock{shard.mutex};
+    for (auto &[key, closed] : shard.closed) {
+      fn(key.first, key.second, closed);
+    }
+  }
+}
+
+std::shared_ptr<const network::member_list>
+network::members(addr_id group) const {
+  auto groups = groups_.load(std::memory_order_acquire);
+
+  auto it = groups->find(group);
+  if (it == groups->end()) {
+    return nullptr;
+  }
+  return it->second;
 }
-} // namespace redstone::net
\ No newline at end of file
+} // namespace redstone::net
@@ -1,23 +1,194 @@
 #pragma once
 
+#include "ports.hpp"
 #include "socket.hpp"
+#include "stats.hpp"
+#include "topology.hpp"
+#include <array>
+#include <atomic>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <tl/function_ref.hpp>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace redstone::net {
 class network {
 public:
-  network() = default;
+  // `seed` decides the order in which each host hands out ephemeral ports
+  explicit network(std::uint64_t seed = 0);
+  ~network();
 
-  std::error_code bind(socket_addr addr, std::shared_ptr<socket>);
+  network(const network &) = delete;
+  network &operator=(const network &) = delete;
 
-  void clear(const socket_addr &addr, socket *s);
+  // Addresses are interned into dense ids the first time they are bound or
+  // connected to, and everything past the syscall boundary carries ids
+  // instead of addresses. An address keeps its id after it is unbound, and
+  // binding it again reuses the id, so ephemeral ports handed out again do
+  // not take new ones. Ids never move to another address, since packets in
+  // flight and cached lookups may still hold them.
+  addr_id intern(const socket_addr &addr);
 
-  std::shared_ptr<socket> get(const socket_addr &addr);
+  // The id of an address that has been interned, if any
+  std::optional<addr_id> find(const socket_addr &addr) const;
+
+  const socket_addr &address(addr_id id) const { return slot(id).addr; }
+
+  // Binds `sock` to `id` and records it as the socket's local address
+  std::error_code bind(addr_id id, std::shared_ptr<socket> sock);
+
+  // Binds `sock`, a socket on `host`, to `addr`. IPv4 port 0 asks for an
+  // ephemeral port.
+  std::error_code bind(endpoint_id host, const socket_addr &addr,
+                       std::shared_ptr<socket> sock);
+
+  // Binds `sock` to a free ephemeral port of `host` on `ip`, storing the
+  // address in `id`. Only the chosen address is interned. The port, along
+  // with its id, goes back to the host when the socket closes.
+  // The wildcard address stands for the host's own, see host_addr.
+  std::error_code bind_ephemeral(endpoint_id host, ipv4_addr ip,
+                                 std::shared_ptr<socket> sock, addr_id &id);
+
+  // Hosts have no configured addresses, so ephemeral ports on 0.0.0.0 would
+  // collide across hosts. Those binds use 0.x.y.z instead, the RFC 1122
+  // "this host" form, numbered by endpoint.
+  static ipv4_addr host_addr(endpoint_id host, std::uint16_t port);
+
+  void clear(addr_id id, socket *s);
+
+  std::shared_ptr<socket> get(addr_id id) const {
+    return slot(id).bound.load(std::memory_order_acquire).lock();
+  }
+
+  std::shared_ptr<socket> get(const socket_addr &addr) const {
+    auto id = find(addr);
+    return id ? get(*id) : nullptr;
+  }
+
+  // Broadcast and multicast groups are keyed by the id of the group address
+  // and port. Only datagram sockets are members; every IPv4 datagram socket
+  // joins the broadcast group of its port when it binds.
+  using member_list = std::vector<std::weak_ptr<socket>>;
+
+  std::error_code join(addr_id group, std::shared_ptr<socket> sock);
+  std::error_code leave(addr_id group, socket *sock);
+
+  // Current members of `group`, possibly including closed sockets
+  std::shared_ptr<const member_list> members(addr_id group) const;
+
+  struct tracked_socket {
+    socket_type type;
+    endpoint_id host;
+    socket_stats stats;
+  };
+
+  // The counters of every closed socket of one host and type, added up
+  struct closed_sockets {
+    std::uint64_t sockets = 0;
+    std::uint64_t sent_packets = 0;
+    std::uint64_t sent_bytes = 0;
+    std::uint64_t received_packets = 0;
+    std::uint64_t received_bytes = 0;
+    std::uint64_t blocked_sends = 0;
+    std::uint64_t peak_queued_bytes = 0;
+    std::uint64_t dropped_buffer = 0;
+  };
+
+  // Counters for a new socket on `host`. They are listed with the open
+  // sockets until the socket closes, and then folded into the totals of its
+  // host and type.
+  std::shared_ptr<socket_stats> track(socket_type type, endpoint_id host);
+
+  void for_each_open(tl::function_ref<void(const tracked_socket &)> fn) const;
+  void for_each_closed(
+      tl::function_ref<void(endpoint_id, socket_type, const closed_sockets &)>
+          fn) const;
 
 private:
-  std::mutex mutex_;
-  std::unordered_map<socket_addr, std::weak_ptr<socket>> map_;
+  struct entry {
+    socket_addr addr;
+    std::atomic<std::weak_ptr<socket>> bound;
+  };
+
+  // Entries live in fixed-size chunks that never move, so readers index
+  // them without locks. Chunks are allocated on first use.
+  static constexpr std::size_t chunk_bits = 12;
+  static constexpr std::size_t chunk_size = std::size_t{1} << chunk_bits;
+  static constexpr std::size_t max_chunks = std::size_t{1} << 14;
+
+  std::unique_ptr<std::atomic<entry *>[]> chunks_;
+  std::atomic<addr_id> next_id_ = 0;
+
+  entry &slot(addr_id id) const {
+    return chunks_[id >> chunk_bits].load(
+        std::memory_order_acquire)[id & (chunk_size - 1)];
+  }
+
+  entry &allocate(addr_id id);
+
+  // The address to id map is spread over shards by address hash. Each shard
+  // publishes an immutable map through a raw pointer, and interning
+  // serializes on the shard mutex and swaps in a copy. Lookups count
+  // themselves on the shard while they read the map, and a replaced map is
+  // retired until no lookup is counted, as the fd table retires descriptors.
+  using address_map = std::unordered_map<socket_addr, addr_id>;
+
+  struct alignas(64) shard {
+    // Lookups between loading `map` and finishing with it
+    std::atomic<std::size_t> readers = 0;
+    std::atomic<bool> retired_pending = false;
+    std::atomic<const address_map *> map = nullptr;
+
+    // Guards the members below, and serializes interning
+    std::mutex mutex;
+    // Owns `map`
+    std::unique_ptr<const address_map> current;
+    // Replaced while lookups may have been reading them
+    std::vector<std::unique_ptr<const address_map>> retired;
+  };
+
+  static constexpr std::size_t shard_bits = 6;
+
+  // Lookups only count themselves, so a const network still updates them
+  mutable std::array<shard, std::size_t{1} << shard_bits> shards_;
+
+  shard &shard_for(const socket_addr &addr) const;
+
+  // Frees the retired maps once no lookup is counted. Lookups only try the
+  // lock, so that they never block.
+  static void reclaim(shard &shard, std::unique_lock<std::mutex> &lock);
+
+  // Membership changes rarely, so all groups share one copy-on-write map
+  using group_map =
+      std::unordered_map<addr_id, std::shared_ptr<const member_list>>;
+
+  std::mutex groups_mutex_;
+  std::atomic<std::shared_ptr<const group_map>> groups_;
+
+  const std::uint64_t seed_;
+  std::mutex ports_mutex_;
+  std::unordered_map<endpoint_id, std::unique_ptr<port_allocator>> ports_;
+
+  port_allocator &ports_for(endpoint_id host);
+
+  // Sockets are tracked in shards by host, so that machines opening and
+  // closing sockets do not contend. Open sockets are kept in creation order
+  // within a shard.
+  struct alignas(64) socket_shard {
+    mutable std::mutex mutex;
+    std::uint64_t next_seq = 0;
+    std::map<std::uint64_t, std::unique_ptr<tracked_socket>> open;
+    std::map<std::pair<endpoint_id, socket_type>, closed_sockets> closed;
+  };
+
+  static constexpr std::size_t socket_shard_count = 64;
+
+  std::array<socket_shard, socket_shard_count> sockets_;
+
+  void untrack(socket_shard &shard, std::uint64_t seq);
 };
-} // namespace redstone::net
\ No newline at end of file
+} // namespace redstone::net
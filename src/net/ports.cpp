@@ -0,0 +1,50 @@
+#include "ports.hpp"
+#include <bit>
+#include <cassert>
+
+namespace redstone::net {
+port_allocator::port_allocator(std::uint64_t seed)
+    : next_{seed % port_count} {
+  // Padding past the end of the range is never handed out
+  if (port_count % 64 != 0) {
+    used_.back() = ~std::uint64_t{0} << (port_count % 64);
+  }
+}
+
+std::optional<std::uint16_t> port_allocator::allocate() {
+  std::unique_lock lock{mutex_};
+
+  if (free_ == 0) {
+    return std::nullopt;
+  }
+
+  // Wraps around to the start of next_'s word at most once
+  auto i = next_;
+  for (std::size_t n = 0; n <= words; ++n) {
+    const auto w = i / 64;
+    const auto avail = ~used_[w] & (~std::uint64_t{0} << (i % 64));
+
+    if (avail != 0) {
+      i = w * 64 + std::countr_zero(avail);
+      used_[w] |= std::uint64_t{1} << (i % 64);
+      free_--;
+      next_ = (i + 1) % port_count;
+      return first_port + i;
+    }
+
+    i = (w + 1) % words * 64;
+  }
+
+  assert(false && "free_ out of sync with used_");
+  return std::nullopt;
+}
+
+void port_allocator::release(std::uint16_t port) {
+  assert(first_port <= port && port <= last_port);
+  const std::size_t i = port - first_port;
+
+  std::unique_lock lock{mutex_};
+  used_[i / 64] &= ~(std::uint64_t{1} << (i % 64));
+  free_++;
+}
+} // namespace redstone::net
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace redstone::net {
+// Hands out the ephemeral ports of one host, like Linux with the default
+// net.ipv4.ip_local_port_range. Ports are in host byte order.
+class port_allocator {
+public:
+  static constexpr std::uint16_t first_port = 32768;
+  static constexpr std::uint16_t last_port = 60999;
+  static constexpr std::size_t port_count = last_port - first_port + 1;
+
+  // The first search starts at an offset derived from `seed`, so every host
+  // walks the range in a different but reproducible order
+  explicit port_allocator(std::uint64_t seed);
+
+  // The next free port after the previously allocated one, or std::nullopt
+  // if every port is taken
+  std::optional<std::uint16_t> allocate();
+
+  void release(std::uint16_t port);
+
+private:
+  static constexpr std::size_t words = (port_count + 63) / 64;
+
+  std::mutex mutex_;
+  // One bit per port, set while it is allocated
+  std::array<std::uint64_t, words> used_{};
+  std::size_t next_;
+  std::size_t free_ = port_count;
+};
+
+// Releases an ephemeral port when the socket holding it goes away
+class port_lease {
+public:
+  port_lease() = default;
+  port_lease(port_allocator *owner, std::uint16_t port)
+      : owner_{owner}, port_{port} {}
+
+  port_lease(port_lease &&other) noexcept
+      : owner_{std::exchange(other.owner_, nullptr)}, port_{other.port_} {}
+
+  port_lease &operator=(port_lease &&other) noexcept {
+    std::swap(owner_, other.owner_);
+    std::swap(port_, other.port_);
+    return *this;
+  }
+
+  ~port_lease() {
+    if (owner_) {
+      owner_->release(port_);
+    }
+  }
+
+private:
+  port_allocator *owner_ = nullptr;
+  std::uint16_t port_ = 0;
+};
+} // namespace redstone::net
@@ -1,108 +1,129 @@
 #pragma once
 
+#include "address.hpp"
+#include "ports.hpp"
 #include "sim/file_descriptor.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
-#include <cstring>
-#include <functional>
+#include <memory>
+#include <optional>
 #include <span>
-#include <string>
-#include <variant>
 
 namespace redstone::net {
-enum address_family {
-  ipv4,
-  unix_,
+struct socket_stats;
+
+enum class socket_type {
+  stream,
+  datagram,
+};
+
+// Socket buffer sizes in bytes, as reported by SO_SNDBUF/SO_RCVBUF
+struct buffer_options {
+  std::size_t send = 212992;
+  std::size_t recv = 212992;
+  // Upper bound for setsockopt, like net.core.wmem_max/rmem_max
+  std::size_t max = 4 << 20;
 };
 
-struct ipv4_addr {
-  uint16_t port;
-  char octets[4];
+class socket : public sim::file_descriptor,
+               public std::enable_shared_from_this<socket> {
+public:
+  explicit socket(sim::fd_kind kind, address_family af, socket_type ty,
+                  const buffer_options &buffers = {},
+                  std::shared_ptr<socket_stats> stats = nullptr)
+      : file_descriptor{kind}, af_{af}, type_{ty}, send_buffer_{buffers.send},
+        recv_buffer_{buffers.recv}, max_buffer_{buffers.max},
+        stats_{std::move(stats)} {}
 
-  friend bool operator<(const ipv4_addr &lhs, const ipv4_addr &rhs) {
-    if (memcmp(lhs.octets, rhs.octets, 4) < 0)
-      return true;
-    return lhs.port < rhs.port;
-  }
+  address_family get_af() const { return af_; }
+  socket_type type() const { return type_; }
 
-  friend bool operator>(const ipv4_addr &lhs, const ipv4_addr &rhs) {
-    return rhs < lhs;
-  }
-  friend bool operator<=(const ipv4_addr &lhs, const ipv4_addr &rhs) {
-    return !(rhs < lhs);
+  // read(2) and write(2) on a socket are recv and send without flags
+  std::int64_t read(tl::function_ref<int(std::span<const std::byte>)> store,
+                    std::size_t bytes) override {
+    return recv(store, bytes, 0, nullptr);
   }
-  friend bool operator>=(const ipv4_addr &lhs, const ipv4_addr &rhs) {
-    return !(lhs < rhs);
+
+  std::int64_t write(tl::function_ref<int(std::span<std::byte>)> load,
+                     std::size_t bytes) override {
+    return send(load, bytes, 0, nullptr);
   }
 
-  friend bool operator==(const ipv4_addr &lhs, const ipv4_addr &rhs) {
-    return lhs.port == rhs.port && memcmp(lhs.octets, rhs.octets, 4) == 0;
+  // Sends to `dst`, or to the connected peer if `dst` is null. `flags` are
+  // MSG_* flags, as for the calls below.
+  virtual std::int64_t send(tl::function_ref<int(std::span<std::byte>)> load,
+                            std::size_t bytes, int flags,
+                            const socket_addr *dst) {
+    return -EOPNOTSUPP;
   }
-  friend bool operator!=(const ipv4_addr &lhs, const ipv4_addr &rhs) {
-    return !(lhs == rhs);
+
+  // Sockets that receive from many senders store the sender of the data in
+  // `from`, if given
+  virtual std::int64_t
+  recv(tl::function_ref<int(std::span<const std::byte>)> store,
+       std::size_t bytes, int flags, std::optional<addr_id> *from) {
+    return -EOPNOTSUPP;
   }
-};
 
-struct unix_addr {
-  std::string path;
+  virtual int connect(const socket_addr &addr) { return -EOPNOTSUPP; }
 
-  friend bool operator<(const unix_addr &lhs, const unix_addr &rhs) {
-    return lhs.path < rhs.path;
-  }
-  friend bool operator>(const unix_addr &lhs, const unix_addr &rhs) {
-    return rhs < lhs;
-  }
-  friend bool operator<=(const unix_addr &lhs, const unix_addr &rhs) {
-    return !(rhs < lhs);
-  }
-  friend bool operator>=(const unix_addr &lhs, const unix_addr &rhs) {
-    return !(lhs < rhs);
-  }
+  virtual int bind(const socket_addr &addr) { return -EOPNOTSUPP; }
 
-  friend bool operator==(const unix_addr &lhs, const unix_addr &rhs) {
-    return lhs.path == rhs.path;
-  }
-  friend bool operator!=(const unix_addr &lhs, const unix_addr &rhs) {
-    return !(lhs == rhs);
-  }
-};
+  // Shuts down reading, writing or both as shutdown(2) does, waking anyone
+  // blocked on them
+  virtual int shutdown(int how) { return -EOPNOTSUPP; }
 
-using socket_addr = std::variant<ipv4_addr, unix_addr>;
+  // Traffic counters, null for sockets that are not tracked
+  socket_stats *stats() const { return stats_.get(); }
 
-enum class socket_type {
-  stream,
-  datagram,
-};
+  // The bound address, set by network::bind. Unbound sockets send from
+  // unspecified_addr. Only used by the owning replica.
+  addr_id local_addr() const { return local_addr_; }
+  void set_local_addr(addr_id addr) { local_addr_ = addr; }
 
-class socket : public sim::file_descriptor {
-public:
-  explicit socket(address_family af, socket_type ty) : af_{af}, type_{ty} {}
+  // Holds the ephemeral port the socket was bound to, if any
+  void set_port_lease(port_lease lease) { port_ = std::move(lease); }
 
-  address_family get_af() const { return af_; }
+  std::size_t send_buffer_size() const {
+    return send_buffer_.load(std::memory_order_relaxed);
+  }
+  std::size_t recv_buffer_size() const {
+    return recv_buffer_.load(std::memory_order_relaxed);
+  }
+
+  // Like Linux, the requested size is doubled to leave room for bookkeeping
+  // and clamped to the configured maximum unless `force` is set
+  void set_send_buffer_size(std::size_t bytes, bool force) {
+    send_buffer_.store(clamp_buffer(bytes, force, min_send_buffer),
+                       std::memory_order_relaxed);
+  }
+  void set_recv_buffer_size(std::size_t bytes, bool force) {
+    recv_buffer_.store(clamp_buffer(bytes, force, min_recv_buffer),
+                       std::memory_order_relaxed);
+  }
 
 private:
+  static constexpr std::size_t min_send_buffer = 4608;
+  static constexpr std::size_t min_recv_buffer = 2304;
+
+  std::size_t clamp_buffer(std::size_t bytes, bool force,
+                           std::size_t min) const {
+    if (!force) {
+      bytes = std::min(bytes, max_buffer_);
+    }
+    return std::max(bytes * 2, min);
+  }
+
   address_family af_;
   socket_type type_;
+  std::atomic<std::size_t> send_buffer_;
+  std::atomic<std::size_t> recv_buffer_;
+  const std::size_t max_buffer_;
+  std::shared_ptr<socket_stats> stats_;
+  addr_id local_addr_ = unspecified_addr;
+  port_lease port_;
 };
 } // namespace redstone::net
-
-template <>
-struct std::hash<redstone::net::unix_addr> {
-  uint64_t operator()(const redstone::net::unix_addr &addr) const {
-    return std::hash<std::string>{}(addr.path);
-  }
-};
-
-template <>
-struct std::hash<redstone::net::ipv4_addr> {
-  uint64_t operator()(const redstone::net::ipv4_addr &addr) const {
-    const auto h1 = std::hash<char>{}(addr.octets[0]);
-    const auto h2 = std::hash<char>{}(addr.octets[1]);
-    const auto h3 = std::hash<char>{}(addr.octets[2]);
-    const auto h4 = std::hash<char>{}(addr.octets[3]);
-    const auto h5 = std::hash<uint16_t>{}(addr.port);
-
-    return h1 ^ (h2 << 1) ^ (h3 << 2) ^ (h4 << 3) ^ (h5 << 4);
-  }
-};
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include "socket_pair.hpp"
+
+#include <sys/socket.h>
+
+namespace redstone::net {
+std::int64_t paired_socket::recv(
+    tl::function_ref<int(std::span<const std::byte>)> write_data_callback,
+    std::size_t bytes, int flags, std::optional<addr_id> *from) {
+  return in_->read(write_data_callback, bytes,
+                   nonblocking() || (flags & MSG_DONTWAIT) != 0);
+}
+
+std::int64_t paired_socket::send(
+    tl::function_ref<int(std::span<std::byte>)> read_data_callback,
+    std::size_t bytes, int flags, const socket_addr *dst) {
+  return out_->write(read_data_callback, bytes,
+                     nonblocking() || (flags & MSG_DONTWAIT) != 0);
+}
+
+// Closing the ends of the channels, as closing the socket does, makes the
+// peer's writes fail with EPIPE and its reads see the end of the stream
+int paired_socket::shutdown(int how) {
+  if (how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR) {
+    return -EINVAL;
+  }
+  if (how != SHUT_WR) {
+    in_->close_reader();
+  }
+  if (how != SHUT_RD) {
+    out_->close_writer();
+  }
+  return 0;
+}
+
+std::pair<std::shared_ptr<paired_socket>, std::shared_ptr<paired_socket>>
+make_socket_pair(const buffer_options &buffers) {
+  auto a_to_b = std::make_shared<sim::pipe_channel>(buffers.recv);
+  auto b_to_a = std::make_shared<sim::pipe_channel>(buffers.recv);
+  return {std::make_shared<paired_socket>(b_to_a, a_to_b, buffers),
+          std::make_shared<paired_socket>(a_to_b, b_to_a, buffers)};
+}
+} // namespace redstone::net
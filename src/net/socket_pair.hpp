@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <tl/function_ref.hpp>
+#include <utility>
+
+#include "sim/pipe.hpp"
+#include "socket.hpp"
+
+namespace redstone::net {
+// One end of a socketpair(2), a connected unix stream socket that never
+// leaves the replica. Each direction is a pipe channel.
+class paired_socket final : public socket {
+public:
+  paired_socket(std::shared_ptr<sim::pipe_channel> in,
+                std::shared_ptr<sim::pipe_channel> out,
+                const buffer_options &buffers)
+      : socket{sim::fd_kind::socket_pair, address_family::unix_,
+               socket_type::stream, buffers},
+        in_{std::move(in)}, out_{std::move(out)} {}
+
+  // Also on destruction, for ends that never had an fd
+  ~paired_socket() override { closed(); }
+
+  void closed() final {
+    in_->close_reader();
+    out_->close_writer();
+  }
+
+  std::int64_t read(tl::function_ref<int(std::span<const std::byte>)> store,
+                    std::size_t bytes) final {
+    return in_->read(store, bytes, nonblocking());
+  }
+
+  std::int64_t write(tl::function_ref<int(std::span<std::byte>)> load,
+                     std::size_t bytes) final {
+    return out_->write(load, bytes, nonblocking());
+  }
+
+  std::int64_t
+  recv(tl::function_ref<int(std::span<const std::byte>)> write_data_callback,
+       std::size_t bytes, int flags, std::optional<addr_id> *from) final;
+
+  // Always sends to the other end, ignoring `dst`
+  std::int64_t
+  send(tl::function_ref<int(std::span<std::byte>)> read_data_callback,
+       std::size_t bytes, int flags, const socket_addr *dst) final;
+
+  // Both ends are connected from the start
+  int connect(const socket_addr &addr) final { return -EISCONN; }
+
+  int shutdown(int how) final;
+
+  short poll() const final {
+    return in_->reader_events() | out_->writer_events();
+  }
+
+private:
+  std::shared_ptr<sim::pipe_channel> in_;
+  std::shared_ptr<sim::pipe_channel> out_;
+};
+
+// Returns both ends of a new socketpair, each buffering up to the configured
+// receive buffer size
+std::pair<std::shared_ptr<paired_socket>, std::shared_ptr<paired_socket>>
+make_socket_pair(const buffer_options &buffers);
+} // namespace redstone::net
@@ -0,0 +1,123 @@
+#include "stats.hpp"
+#include "network.hpp"
+#include "topology.hpp"
+
+#include <arpa/inet.h>
+#include <fmt/format.h>
+#include <string>
+#include <variant>
+
+namespace redstone::net {
+namespace {
+std::string json_string(std::string_view s) {
+  std::string out = "\"";
+  for (char c : s) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        out += fmt::format("\\u{:04x}", c);
+      } else {
+        out += c;
+      }
+    }
+  }
+  out += '"';
+  return out;
+}
+
+std::string describe(const socket_addr &addr) {
+  if (auto ip = std::get_if<ipv4_addr>(&addr)) {
+    auto o = [&](int i) { return static_cast<unsigned char>(ip->octets[i]); };
+    return fmt::format("{}.{}.{}.{}:{}", o(0), o(1), o(2), o(3),
+                       ntohs(ip->port));
+  }
+  return std::get<unix_addr>(addr).path;
+}
+
+const char *type_name(socket_type type) {
+  return type == socket_type::stream ? "stream" : "datagram";
+}
+} // namespace
+
+void write_stats(std::FILE *out, const network &net, const topology &topo) {
+  fmt::print(out, "{{\n  \"links\": [");
+
+  const char *sep = "\n";
+  for (endpoint_id src = 0; src < topo.endpoints(); ++src) {
+    for (endpoint_id dst = 0; dst < topo.endpoints(); ++dst) {
+      auto s = topo.stats(src, dst);
+      if (!s) {
+        continue;
+      }
+
+      const auto delivered = s->packets.get() - s->dropped_fault.get() -
+                             s->dropped_queue.get() -
+                             s->dropped_partition.get();
+      const auto mean_latency =
+          delivered != 0 ? s->latency_total_ns.get() / delivered : 0;
+
+      fmt::print(out,
+                 "{}    {{\"from\": {}, \"to\": {}, \"packets\": {}, "
+                 "\"bytes\": {}, \"dropped_fault\": {}, "
+                 "\"dropped_queue\": {}, \"dropped_partition\": {}, "
+                 "\"replays\": {}, \"mean_latency_ns\": {}, "
+                 "\"max_latency_ns\": {}, \"peak_queue_bytes\": {}}}",
+                 sep, src, dst, s->packets.get(), s->bytes.get(),
+                 s->dropped_fault.get(), s->dropped_queue.get(),
+                 s->dropped_partition.get(), s->replays.get(), mean_latency,
+                 s->latency_max_ns.get(), s->peak_queue_bytes.get());
+      sep = ",\n";
+    }
+  }
+
+  fmt::print(out, "\n  ],\n  \"sockets\": [");
+
+  sep = "\n";
+  net.for_each_open([&](const network::tracked_socket &socket) {
+    const auto &[type, host, s] = socket;
+    const auto id = s.addr.load(std::memory_order_relaxed);
+    const auto addr = id != unspecified_addr
+                          ? json_string(describe(net.address(id)))
+                          : std::string{"null"};
+
+    fmt::print(out,
+               "{}    {{\"type\": \"{}\", \"host\": {}, \"addr\": {}, "
+               "\"sent_packets\": {}, \"sent_bytes\": {}, "
+               "\"received_packets\": {}, \"received_bytes\": {}, "
+               "\"blocked_sends\": {}, \"queued_bytes\": {}, "
+               "\"peak_queued_bytes\": {}, \"dropped_buffer\": {}}}",
+               sep, type_name(type), host, addr, s.sent_packets.get(),
+               s.sent_bytes.get(), s.received_packets.get(),
+               s.received_bytes.get(), s.blocked_sends.get(),
+               s.queued_bytes.get(), s.peak_queued_bytes.get(),
+               s.dropped_buffer.get());
+    sep = ",\n";
+  });
+
+  // Closed sockets are only kept as totals per host and type
+  fmt::print(out, "\n  ],\n  \"closed_sockets\": [");
+
+  sep = "\n";
+  net.for_each_closed([&](endpoint_id host, socket_type type,
+                          const network::closed_sockets &s) {
+    fmt::print(out,
+               "{}    {{\"type\": \"{}\", \"host\": {}, \"sockets\": {}, "
+               "\"sent_packets\": {}, \"sent_bytes\": {}, "
+               "\"received_packets\": {}, \"received_bytes\": {}, "
+               "\"blocked_sends\": {}, \"peak_queued_bytes\": {}, "
+               "\"dropped_buffer\": {}}}",
+               sep, type_name(type), host, s.sockets, s.sent_packets,
+               s.sent_bytes, s.received_packets, s.received_bytes,
+               s.blocked_sends, s.peak_queued_bytes, s.dropped_buffer);
+    sep = ",\n";
+  });
+
+  fmt::print(out, "\n  ]\n}}\n");
+}
+} // namespace redstone::net
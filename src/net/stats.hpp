@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+#include "socket.hpp"
+
+namespace redstone::net {
+class network;
+class topology;
+
+// A relaxed event counter. Counters are grouped by the thread that updates
+// them and each group starts a cache line, so updates stay uncontended.
+class counter {
+public:
+  void add(std::uint64_t n = 1) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  void sub(std::uint64_t n) { value_.fetch_sub(n, std::memory_order_relaxed); }
+
+  void max(std::uint64_t n) {
+    auto current = value_.load(std::memory_order_relaxed);
+    while (current < n && !value_.compare_exchange_weak(
+                              current, n, std::memory_order_relaxed)) {
+    }
+  }
+
+  std::uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<std::uint64_t> value_ = 0;
+};
+
+// Traffic over one directed link, updated by the sending machine
+struct alignas(64) link_stats {
+  counter packets;
+  counter bytes;
+  counter dropped_fault;
+  counter dropped_queue;
+  counter dropped_partition;
+  counter replays;
+  // Queueing, serialization and propagation delay in virtual time
+  counter latency_total_ns;
+  counter latency_max_ns;
+  counter peak_queue_bytes;
+};
+
+struct socket_stats {
+  // Updated by the owning replica. Packets are datagrams, or calls that
+  // moved data for stream sockets.
+  alignas(64) counter sent_packets;
+  counter sent_bytes;
+  counter received_packets;
+  counter received_bytes;
+  // Stream writes that had to wait for buffer space
+  counter blocked_sends;
+
+  // Updated by senders to this socket
+  alignas(64) counter queued_bytes;
+  counter peak_queued_bytes;
+  counter dropped_buffer;
+
+  // Set once, when the socket is first bound
+  alignas(64) std::atomic<addr_id> addr = unspecified_addr;
+
+  void set_addr(addr_id id) {
+    addr_id expected = unspecified_addr;
+    addr.compare_exchange_strong(expected, id, std::memory_order_relaxed);
+  }
+};
+
+// Writes every link and socket counter to `out` as one JSON document
+void write_stats(std::FILE *out, const network &net, const topology &topo);
+} // namespace redstone::net
@@ -1,33 +1,81 @@
 #include "stream_socket.hpp"
 #include "fault.hpp"
 #include "random/xoshiro.hpp"
+#include "sim/scratch.hpp"
 
 #include <algorithm>
 #include <cerrno>
 #include <cstddef>
+#include <memory_resource>
+#include <sys/socket.h>
 #include <vector>
 
 namespace redstone::net {
+void stream_socket::inbound::push(std::span<const std::byte> bytes) {
+  if (buffer->capacity() - buffer->size() < bytes.size()) {
+    const auto size = buffer->size();
+    auto grown = std::make_unique<sim::byte_ring>(size + bytes.size());
+    pop(grown->writable().first.first(size));
+    grown->commit(size);
+    buffer = std::move(grown);
+  }
+
+  auto [first, second] = buffer->writable();
+  const auto split = std::min(first.size(), bytes.size());
+  std::copy_n(bytes.begin(), split, first.begin());
+  std::copy(bytes.begin() + split, bytes.end(), second.begin());
+  buffer->commit(bytes.size());
+}
+
+void stream_socket::inbound::pop(std::span<std::byte> out) {
+  auto [first, second] = buffer->readable();
+  const auto split = std::min(first.size(), out.size());
+  std::copy_n(first.begin(), split, out.begin());
+  std::copy_n(second.begin(), out.size() - split, out.begin() + split);
+  buffer->consume(out.size());
+}
+
+stream_socket::~stream_socket() { shutdown(SHUT_RDWR); }
+
+void stream_socket::closed() { shutdown(SHUT_RDWR); }
+
 std::int64_t stream_socket::recv(
     tl::function_ref<int(std::span<const std::byte>)> write_data_callback,
-    std::size_t bytes) {
-  std::unique_lock lock{mutex_};
+    std::size_t bytes, int flags, std::optional<addr_id> *from) {
+  const bool nonblocking =
+      this->nonblocking() || (flags & MSG_DONTWAIT) != 0;
+
+  auto &in = *inbound_;
+  std::unique_lock lock{in.mutex};
 
   for (;;) {
-    if (buffer_.empty()) {
-      cond_.wait(lock);
+    if (in.buffer->size() == 0) {
+      if (!in.reader || (in.connected && in.writers == 0)) {
+        return 0;
+      }
+      if (nonblocking) {
+        return -EAGAIN;
+      }
+      in.cond.wait(lock);
       continue;
     }
 
-    const auto n = std::min(bytes, buffer_.size());
+    const auto n = std::min(bytes, in.buffer->size());
+
+    // Copied out under the lock and into the tracee without it
+    std::pmr::vector<std::byte> tmp(n, &sim::scratch());
+    in.pop(tmp);
+
+    // Wake writers waiting for buffer space
+    in.cond.notify_all();
 
-    std::vector<std::byte> tmp;
-    tmp.reserve(n);
-    while (tmp.size() < n) {
-      tmp.push_back(buffer_.front());
-      buffer_.pop();
+    if (auto stats = this->stats()) {
+      stats->queued_bytes.sub(n);
+      stats->received_packets.add();
+      stats->received_bytes.add(n);
     }
 
+    lock.unlock();
     auto res = write_data_callback(tmp);
     if (res < 0) {
       return res;
@@ -38,35 +86,172 @@ std::int64_t stream_socket::recv(
 
 std::int64_t stream_socket::send(
     tl::function_ref<int(std::span<std::byte>)> read_data_callback,
-    std::size_t bytes) {
-  auto peer = peer_.lock();
+    std::size_t bytes, int flags, const socket_addr *dst) {
+  const bool nonblocking =
+      this->nonblocking() || (flags & MSG_DONTWAIT) != 0;
 
-  std::unique_lock lock{peer->mutex_};
+  if (!peer_) {
+    return -ENOTCONN;
+  }
+
+  auto &out = *peer_;
+  std::unique_lock lock{out.mutex};
 
   std::size_t sent = 0;
+  std::pmr::vector<std::byte> buf{&sim::scratch()};
+  // Loaded from the tracee but not queued yet
+  std::span<const std::byte> pending;
 
-  std::vector<std::byte> buf{bytes, std::byte{}};
+  for (;;) {
+    // Checked again after every wait, the peer may close meanwhile
+    if (!out.reader || write_shutdown_) {
+      if (sent == 0) {
+        return -EPIPE;
+      }
+      break;
+    }
+    if (sent == bytes) {
+      break;
+    }
+
+    // Bytes in flight sit in our send buffer and the peer's receive buffer
+    const auto capacity = send_buffer_size() + out.reader->recv_buffer_size();
+    const auto queued = out.buffer->size();
+
+    if (capacity <= queued) {
+      // Nonblocking writers get a partial write, blocking ones wait for the
+      // reader to make room
+      if (nonblocking) {
+        break;
+      }
+      if (auto stats = this->stats()) {
+        stats->blocked_sends.add();
+      }
+      out.cond.wait(lock);
+      continue;
+    }
+
+    if (pending.empty()) {
+      // Loaded without the lock, then checked again, since other writers
+      // may fill the buffer meanwhile
+      buf.resize(std::min(bytes - sent, capacity - queued));
+      lock.unlock();
+      auto res = read_data_callback(buf);
+      lock.lock();
+      if (res < 0) {
+        if (sent == 0) {
+          return res;
+        }
+        break;
+      }
+      pending = buf;
+      continue;
+    }
+
+    const auto chunk =
+        pending.first(std::min(pending.size(), capacity - queued));
+    pending = pending.subspan(chunk.size());
+    out.push(chunk);
+
+    out.cond.notify_all();
+
+    if (auto stats = out.reader->stats()) {
+      stats->queued_bytes.add(chunk.size());
+      stats->peak_queued_bytes.max(stats->queued_bytes.get());
+    }
 
-  auto res = read_data_callback(buf);
-  if (res < 0)
-    return res;
+    if (auto cap = sim_->capture()) {
+      const auto seq = seq_.fetch_add(chunk.size(), std::memory_order_relaxed);
+      const auto &net = sim_->net();
+      cap->segment(capture::event::delivered, sim_->elapsed(),
+                   net.address(local_addr()), net.address(peer_addr_), seq,
+                   chunk);
+    }
 
-  for (auto byte : buf)
-    peer->buffer_.push(byte);
+    sent += chunk.size();
+  }
 
-  peer->cond_.notify_all();
+  if (sent == 0 && bytes != 0) {
+    return -EAGAIN;
+  }
 
-  return res;
+  if (auto stats = this->stats()) {
+    stats->sent_packets.add();
+    stats->sent_bytes.add(sent);
+  }
+  return sent;
 }
 
-int stream_socket::connect(std::shared_ptr<stream_socket> other) {
+int stream_socket::connect(const socket_addr &addr) {
   if (listening_) {
     return -EOPNOTSUPP;
   }
+
+  auto &net = sim_->net();
+
+  auto id = net.find(addr);
+  auto peer = id ? net.get(*id) : nullptr;
+  if (!peer || peer->kind() != sim::fd_kind::stream_socket) {
+    return -ECONNREFUSED;
+  }
+
+  if (peer_) {
+    return -EISCONN;
+  }
+
+  auto other = std::static_pointer_cast<stream_socket>(std::move(peer));
+  if (other->listening()) {
+    return -ECONNREFUSED;
+  }
   if (get_af() != other->get_af()) {
     return -EAFNOSUPPORT;
   }
-  peer_ = other;
+  if (local_addr() == unspecified_addr && get_af() == address_family::ipv4) {
+    addr_id local;
+    if (auto err = net.bind_ephemeral(host_, {}, shared_from_this(), local)) {
+      return -err.value();
+    }
+  }
+  {
+    std::lock_guard lock{other->inbound_->mutex};
+    other->inbound_->writers++;
+    other->inbound_->connected = true;
+  }
+  peer_ = other->inbound_;
+  peer_addr_ = *id;
+  return 0;
+}
+
+int stream_socket::bind(const socket_addr &addr) {
+  if (auto err = sim_->net().bind(host_, addr, shared_from_this())) {
+    return -err.value();
+  }
+  return 0;
+}
+
+// Both directions wake anyone blocked on them. Shutting down reading fails
+// the peer's further writes with EPIPE rather than discarding them.
+int stream_socket::shutdown(int how) {
+  if (how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR) {
+    return -EINVAL;
+  }
+
+  if (how != SHUT_WR) {
+    std::lock_guard lock{inbound_->mutex};
+    if (!peer_ && !inbound_->connected) {
+      return -ENOTCONN;
+    }
+    inbound_->reader = nullptr;
+    inbound_->cond.notify_all();
+  }
+  if (how != SHUT_RD && peer_) {
+    std::lock_guard lock{peer_->mutex};
+    if (!write_shutdown_) {
+      write_shutdown_ = true;
+      peer_->writers--;
+    }
+    peer_->cond.notify_all();
+  }
   return 0;
 }
 } // namespace redstone::net
@@ -1,41 +1,92 @@
 #pragma once
 
 #include "sim/file_descriptor.hpp"
+#include "sim/ring.hpp"
+#include "sim/simulator.hpp"
 #include "socket.hpp"
+#include "stats.hpp"
 
+#include <atomic>
 #include <condition_variable>
 #include <cstddef>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <span>
 #include <tl/function_ref.hpp>
 
 namespace redstone::net {
 class stream_socket : public socket {
 public:
-  explicit stream_socket(address_family af) : socket{af, socket_type::stream} {}
+  explicit stream_socket(address_family af, sim::simulator &sim,
+                         endpoint_id host)
+      : socket{sim::fd_kind::stream_socket, af, socket_type::stream,
+               sim.initial_options().socket_buffers,
+               sim.net().track(socket_type::stream, host)},
+        inbound_{std::make_shared<inbound>(this)}, sim_{&sim}, host_{host} {}
 
-  explicit stream_socket(address_family af, std::shared_ptr<stream_socket> peer)
-      : socket{af, socket_type::stream}, peer_{peer} {}
+  // Also shuts down on destruction, for sockets that never had an fd
+  ~stream_socket() override;
+
+  // Shuts down both directions, so that the peer sees the end of the stream
+  // and EPIPE
+  void closed() override;
 
   std::int64_t
   recv(tl::function_ref<int(std::span<const std::byte>)> write_data_callback,
-       std::size_t bytes);
+       std::size_t bytes, int flags, std::optional<addr_id> *from) override;
 
+  // Sends to the connected peer, ignoring `dst` like TCP does. Fails with
+  // EPIPE once the peer has closed or shut down reading.
   std::int64_t
   send(tl::function_ref<int(std::span<std::byte>)> read_data_callback,
-       std::size_t bytes);
+       std::size_t bytes, int flags, const socket_addr *dst) override;
+
+  // Connects to the stream socket bound to `addr`. Unbound IPv4 sockets get
+  // an ephemeral port first.
+  int connect(const socket_addr &addr) override;
+
+  int bind(const socket_addr &addr) override;
 
-  int connect(std::shared_ptr<stream_socket> other);
+  int shutdown(int how) override;
 
   bool listening() const { return listening_; }
 
 private:
-  std::weak_ptr<stream_socket> peer_;
-  std::queue<std::byte> buffer_;
-  std::condition_variable cond_;
-  std::mutex mutex_;
+  // The receive queue. Writers share it rather than the socket, so that one
+  // blocked on a full queue does not keep the reader from closing.
+  struct inbound {
+    explicit inbound(stream_socket *reader)
+        : buffer{std::make_unique<sim::byte_ring>(reader->recv_buffer_size())},
+          reader{reader} {}
+
+    // These require mutex. push() grows the buffer to fit `bytes`, pop()
+    // fills `out` from the front of it.
+    void push(std::span<const std::byte> bytes);
+    void pop(std::span<std::byte> out);
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    // Replaced by a larger one when full, since either end may change its
+    // buffer size. Callers limit what they queue themselves.
+    std::unique_ptr<sim::byte_ring> buffer;
+    // Null once the reader has closed or shut down reading
+    stream_socket *reader;
+    // Connected peers that have not closed or shut down writing. Reads see
+    // the end of the stream once the last of them is gone.
+    std::size_t writers = 0;
+    bool connected = false;
+  };
+
+  std::shared_ptr<inbound> inbound_;
+  // The peer's queue, set by connect
+  std::shared_ptr<inbound> peer_;
+  // Guarded by the peer's mutex
+  bool write_shutdown_ = false;
+  addr_id peer_addr_ = unspecified_addr;
+  sim::simulator *sim_;
+  endpoint_id host_;
+  // Sequence number of the next captured segment
+  std::atomic<std::uint32_t> seq_ = 0;
   bool listening_ = false;
 };
 } // namespace redstone::net
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "topology.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+
+namespace redstone::net {
+topology::topology(const net_fault_options &defaults,
+                   const topology_options &options)
+    : endpoints_{options.endpoints}, profiles_{defaults},
+      profile_(options.endpoints * options.endpoints, 0),
+      side_a_(options.endpoints, 0), side_b_(options.endpoints, 0),
+      stats_{std::make_unique<std::atomic<link_stats *>[]>(profile_.size())} {
+  auto check = [this](endpoint_id id) {
+    if (endpoints_ <= id) {
+      throw std::invalid_argument{"topology: endpoint out of range"};
+    }
+  };
+
+  for (auto &link : options.links) {
+    check(link.from);
+    check(link.to);
+
+    if (std::numeric_limits<std::uint16_t>::max() < profiles_.size()) {
+      throw std::invalid_argument{"topology: too many links"};
+    }
+
+    const auto index = static_cast<std::uint16_t>(profiles_.size());
+    profiles_.push_back(link.faults);
+
+    profile_[link.from * endpoints_ + link.to] = index;
+    if (link.bidirectional) {
+      profile_[link.to * endpoints_ + link.from] = index;
+    }
+  }
+
+  for (auto &profile : profiles_) {
+    if (profile.bandwidth != 0) {
+      idle_at_ =
+          std::make_unique<std::atomic<std::int64_t>[]>(profile_.size());
+      break;
+    }
+  }
+
+  if (max_partitions < options.partitions.size()) {
+    throw std::invalid_argument{"topology: too many partitions"};
+  }
+
+  // (time, ends, bit), so starts sort before ends at the same instant
+  std::vector<std::tuple<std::chrono::nanoseconds, bool, std::uint64_t>>
+      events;
+
+  for (std::size_t i = 0; i < options.partitions.size(); ++i) {
+    auto &p = options.partitions[i];
+    const std::uint64_t bit = std::uint64_t{1} << i;
+
+    for (auto id : p.side_a) {
+      check(id);
+      side_a_[id] |= bit;
+    }
+
+    if (p.side_b.empty()) {
+      for (auto &side : side_b_) {
+        side |= bit;
+      }
+      for (auto id : p.side_a) {
+        side_b_[id] &= ~bit;
+      }
+    } else {
+      for (auto id : p.side_b) {
+        check(id);
+        side_b_[id] |= bit;
+      }
+    }
+
+    events.emplace_back(p.start, false, bit);
+    events.emplace_back(p.end, true, bit);
+  }
+
+  std::sort(events.begin(), events.end());
+
+  std::uint64_t mask = 0;
+
+  for (auto &[time, ends, bit] : events) {
+    if (ends) {
+      mask &= ~bit;
+    } else {
+      mask |= bit;
+    }
+
+    if (!flips_.empty() && flips_.back().first == time) {
+      flips_.back().second = mask;
+    } else {
+      flips_.emplace_back(time, mask);
+    }
+  }
+}
+
+topology::~topology() {
+  for (std::size_t i = 0; stats_ && i < profile_.size(); ++i) {
+    delete stats_[i].load(std::memory_order_relaxed);
+  }
+}
+
+link_stats *topology::stats_for(std::size_t index) const {
+  auto &slot = stats_[index];
+
+  auto stats = slot.load(std::memory_order_acquire);
+  if (stats) {
+    return stats;
+  }
+
+  // Racing senders on a new link may both allocate, only one wins
+  auto fresh = new link_stats{};
+  if (slot.compare_exchange_strong(stats, fresh, std::memory_order_acq_rel)) {
+    return fresh;
+  }
+  delete fresh;
+  return stats;
+}
+
+std::optional<std::chrono::nanoseconds>
+route::transmit(std::uint64_t bytes, std::chrono::nanoseconds now) const {
+  if (idle_at_ == nullptr) {
+    return std::chrono::nanoseconds{0};
+  }
+
+  // A token bucket, tracked as the time at which the link goes idle (GCRA).
+  // Up to `burst` bytes may start before the link is idle, anything beyond
+  // that waits in the queue.
+  const auto burst = faults_->serialization(faults_->burst).count();
+  const auto serialization = faults_->serialization(bytes).count();
+  const auto t = now.count();
+
+  auto idle_at = idle_at_->load(std::memory_order_relaxed);
+  std::int64_t start;
+  double queued;
+
+  do {
+    start = std::max(t, idle_at - burst);
+
+    queued = static_cast<double>(start - t) * 1e-9 *
+             static_cast<double>(faults_->bandwidth);
+    if (static_cast<double>(faults_->queue_limit) <
+        queued + static_cast<double>(bytes)) {
+      return std::nullopt;
+    }
+  } while (!idle_at_->compare_exchange_weak(
+      idle_at, std::max(t, idle_at) + serialization,
+      std::memory_order_relaxed));
+
+  if (stats_) {
+    stats_->peak_queue_bytes.max(static_cast<std::uint64_t>(queued) + bytes);
+  }
+
+  return std::chrono::nanoseconds{start - t + serialization};
+}
+
+std::uint64_t topology::active(std::chrono::nanoseconds now) const {
+  auto it = std::upper_bound(
+      flips_.begin(), flips_.end(), now,
+      [](std::chrono::nanoseconds t, const auto &flip) {
+        return t < flip.first;
+      });
+
+  if (it == flips_.begin()) {
+    return 0;
+  }
+  return std::prev(it)->second;
+}
+} // namespace redstone::net
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "fault.hpp"
+#include "stats.hpp"
+
+namespace redstone::net {
+// Compact id of a simulated machine, assigned in configuration order
+using endpoint_id = std::uint32_t;
+
+struct link_options {
+  endpoint_id from = 0;
+  endpoint_id to = 0;
+  bool bidirectional = false;
+  net_fault_options faults{};
+};
+
+// Cuts every link between two groups of machines for a window of virtual time
+struct partition_options {
+  std::chrono::nanoseconds start{0};
+  std::chrono::nanoseconds end{std::chrono::nanoseconds::max()};
+  std::vector<endpoint_id> side_a;
+  // If empty, every machine not in side_a
+  std::vector<endpoint_id> side_b;
+};
+
+struct topology_options {
+  std::size_t endpoints = 0;
+  std::vector<link_options> links;
+  std::vector<partition_options> partitions;
+};
+
+// A directed link as seen by one sender
+class route {
+public:
+  route(const net_fault_options &faults, std::atomic<std::int64_t> *idle_at,
+        link_stats *stats)
+      : faults_{&faults}, idle_at_{idle_at}, stats_{stats} {}
+
+  const net_fault_options &faults() const { return *faults_; }
+
+  // Null for links outside the configured topology
+  link_stats *stats() const { return stats_; }
+
+  // Queues `bytes` on the link at virtual time `now`. Returns the queueing
+  // plus serialization delay, or std::nullopt if the link's queue is full and
+  // the packet is dropped.
+  std::optional<std::chrono::nanoseconds>
+  transmit(std::uint64_t bytes, std::chrono::nanoseconds now) const;
+
+private:
+  const net_fault_options *faults_;
+  // Virtual time at which everything queued so far has left the sender, or
+  // null for links without a bandwidth limit
+  std::atomic<std::int64_t> *idle_at_;
+  link_stats *stats_;
+};
+
+// Per-link fault parameters and scheduled partitions. The configuration is
+// immutable once built and link queues are updated atomically, so lookups
+// take no locks.
+class topology {
+public:
+  static constexpr std::size_t max_partitions = 64;
+
+  topology() : profiles_{net_fault_options{}} {}
+
+  explicit topology(const net_fault_options &defaults,
+                    const topology_options &options);
+
+  ~topology();
+
+  topology(const topology &) = delete;
+  topology &operator=(const topology &) = delete;
+
+  std::size_t endpoints() const { return endpoints_; }
+
+  // The link packets from `src` to `dst` travel over. Machines outside the
+  // configured topology use the defaults and are never rate limited.
+  route link(endpoint_id src, endpoint_id dst) const {
+    if (endpoints_ <= src || endpoints_ <= dst) {
+      return {profiles_.front(), nullptr, nullptr};
+    }
+    const auto index = src * endpoints_ + dst;
+    const auto &faults = profiles_[profile_[index]];
+    return {faults, faults.bandwidth != 0 ? &idle_at_[index] : nullptr,
+            stats_for(index)};
+  }
+
+  // Counters of the link from `src` to `dst`, or null if it never carried
+  // anything
+  const link_stats *stats(endpoint_id src, endpoint_id dst) const {
+    return stats_[src * endpoints_ + dst].load(std::memory_order_acquire);
+  }
+
+  // Whether an active partition separates `src` and `dst` at virtual time
+  // `now`
+  bool partitioned(endpoint_id src, endpoint_id dst,
+                   std::chrono::nanoseconds now) const {
+    if (flips_.empty() || endpoints_ <= src || endpoints_ <= dst) {
+      return false;
+    }
+    const auto cuts =
+        (side_a_[src] & side_b_[dst]) | (side_b_[src] & side_a_[dst]);
+    return (cuts & active(now)) != 0;
+  }
+
+private:
+  std::size_t endpoints_ = 0;
+
+  // Distinct link parameters, the first being the defaults
+  std::vector<net_fault_options> profiles_;
+  // Dense endpoints x endpoints matrix of indices into profiles_
+  std::vector<std::uint16_t> profile_;
+  // Queue state of each link, only allocated if some link is rate limited
+  std::unique_ptr<std::atomic<std::int64_t>[]> idle_at_;
+
+  // Bit i is set if the endpoint is on that side of partition i
+  std::vector<std::uint64_t> side_a_;
+  std::vector<std::uint64_t> side_b_;
+
+  // Set of active partitions from each instant on, sorted by time
+  std::vector<std::pair<std::chrono::nanoseconds, std::uint64_t>> flips_;
+
+  // Counters of each link, allocated when the link is first used
+  std::unique_ptr<std::atomic<link_stats *>[]> stats_;
+
+  std::uint64_t active(std::chrono::nanoseconds now) const;
+  link_stats *stats_for(std::size_t index) const;
+};
+} // namespace redstone::net
@@ -1,108 +1,346 @@
 #include "sim/file_descriptor.hpp"
-#include "sys/file.hpp"
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <cerrno>
 #include <cstddef>
+#include <fcntl.h>
 #include <memory>
-#include <spdlog/spdlog.h>
-#include <string_view>
 #include <vector>
 
 namespace redstone::sim {
-std::shared_ptr<file_descriptor> file_descriptor_table::get(int fd) {
-  std::unique_lock lock{mutex_};
-  return table_[fd];
+int file_descriptor::stat(struct stat &st) {
+  st = {};
+  switch (kind()) {
+  case fd_kind::pipe:
+    st.st_mode = S_IFIFO | 0600;
+    break;
+  case fd_kind::stream_socket:
+  case fd_kind::datagram_socket:
+  case fd_kind::socket_pair:
+    st.st_mode = S_IFSOCK | 0777;
+    break;
+  default:
+    st.st_mode = 0600;
+    break;
+  }
+  st.st_nlink = 1;
+  st.st_blksize = 4096;
+  return 0;
 }
 
-int file_descriptor_table::close(int fd) {
+file_descriptor_table::file_descriptor_table()
+    : chunks_{new std::atomic<slot *>[max_chunks]{}} {}
+
+file_descriptor_table::~file_descriptor_table() {
+  close_all();
+  for (std::size_t i = 0; i < max_chunks; ++i) {
+    delete[] chunks_[i].load(std::memory_order_relaxed);
+  }
+}
+
+file_descriptor_table::slot *file_descriptor_table::find(int fd) const {
+  if (fd < 0 || !is_simulated(fd)) {
+    return nullptr;
+  }
+
+  const std::size_t index = fd & ~simulated;
+  if (max_chunks <= index >> chunk_bits) {
+    return nullptr;
+  }
+
+  auto chunk = chunks_[index >> chunk_bits].load(std::memory_order_acquire);
+  if (!chunk) {
+    return nullptr;
+  }
+  return &chunk[index & (chunk_size - 1)];
+}
+
+// Borrowers bump entering_ before loading a slot, and count themselves on
+// the descriptor before leaving. Closers clear the slot before reclaim()
+// checks entering_ and then the descriptor's borrows. All of it is seq_cst,
+// so either the borrower sees the cleared slot or reclaim() sees the borrow.
+borrowed_fd file_descriptor_table::borrow(int fd) {
+  auto slot = find(fd);
+  if (!slot) {
+    return {};
+  }
+
+  entering_.fetch_add(1, std::memory_order_seq_cst);
+  auto fildes = slot->fildes.load(std::memory_order_seq_cst);
+  if (fildes) {
+    fildes->borrows_.fetch_add(1, std::memory_order_seq_cst);
+  }
+  leave();
+
+  if (!fildes) {
+    return {};
+  }
+  return {this, fildes};
+}
+
+void file_descriptor_table::leave() {
+  if (entering_.fetch_sub(1, std::memory_order_seq_cst) == 1 &&
+      retired_pending_.load(std::memory_order_seq_cst)) {
+    reclaim();
+  }
+}
+
+void file_descriptor_table::release(file_descriptor *fildes) {
+  // The descriptor may be freed as soon as its count drops
+  if (fildes->borrows_.fetch_sub(1, std::memory_order_seq_cst) == 1 &&
+      retired_pending_.load(std::memory_order_seq_cst)) {
+    reclaim();
+  }
+}
+
+void file_descriptor_table::reclaim() {
+  // Destroyed after unlocking, closing a socket may take other locks
+  std::vector<std::shared_ptr<file_descriptor>> dead;
+
   std::unique_lock lock{mutex_};
-  auto it = table_.find(fd);
-  if (it == table_.end() || !it->second) {
-    return -EBADFD;
+  if (entering_.load(std::memory_order_seq_cst) != 0) {
+    return;
   }
 
-  assert(is_simulated(fd));
-  assert(0 <= fd);
+  auto unused = std::partition(retired_.begin(), retired_.end(), [](auto &f) {
+    return f->borrows_.load(std::memory_order_seq_cst) != 0;
+  });
+  dead.assign(std::make_move_iterator(unused),
+              std::make_move_iterator(retired_.end()));
+  retired_.erase(unused, retired_.end());
+  retired_pending_.store(!retired_.empty(), std::memory_order_seq_cst);
+}
+
+void file_descriptor_table::drop(file_descriptor &fildes) {
+  if (fildes.fds_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    fildes.closed();
+  }
+}
 
-  table_.erase(it);
-  unused_.push_back(fd);
+int file_descriptor_table::close(int fd) {
+  std::shared_ptr<file_descriptor> closing;
+  {
+    std::unique_lock lock{mutex_};
+
+    auto slot = find(fd);
+    if (!slot || !slot->owner) {
+      return -EBADF;
+    }
+    closing = retire(*slot, fd & ~simulated);
+  }
+
+  drop(*closing);
+  closing.reset();
+  reclaim();
   return 0;
 }
 
-int file_descriptor_table::insert(std::shared_ptr<file_descriptor> fildes) {
+int file_descriptor_table::insert(std::shared_ptr<file_descriptor> fildes,
+                                  bool cloexec) {
+  std::unique_lock lock{mutex_};
+
+  auto index = allocate(0);
+  if (index < 0) {
+    return index;
+  }
+  install(index, std::move(fildes), cloexec);
+  return index | simulated;
+}
+
+int file_descriptor_table::dup(int fd, int min_fd, bool cloexec) {
+  if (min_fd < 0) {
+    return -EINVAL;
+  }
+  // Every simulated fd is above the real ones
+  const std::size_t from = is_simulated(min_fd) ? min_fd & ~simulated : 0;
+  if (max_chunks * chunk_size <= from) {
+    return -EINVAL;
+  }
+
   std::unique_lock lock{mutex_};
 
-  int fd = -1;
+  auto slot = find(fd);
+  if (!slot || !slot->owner) {
+    return -EBADF;
+  }
+
+  auto index = allocate(from);
+  if (index < 0) {
+    return index;
+  }
+  install(index, slot->owner, cloexec);
+  return index | simulated;
+}
+
+int file_descriptor_table::dup_to(int fd, int new_fd, bool cloexec) {
+  if (new_fd < 0 || !is_simulated(new_fd)) {
+    return -EBADF;
+  }
+  const std::size_t index = new_fd & ~simulated;
+  if (max_chunks * chunk_size <= index) {
+    return -EBADF;
+  }
+
+  std::shared_ptr<file_descriptor> replaced;
+  {
+    std::unique_lock lock{mutex_};
 
-  if (!unused_.empty()) {
-    fd = unused_.back();
-    unused_.pop_back();
-  } else {
-    if (capacity <= table_.size()) {
-      return -1;
+    auto from = find(fd);
+    if (!from || !from->owner) {
+      return -EBADF;
+    }
+    if (fd == new_fd) {
+      return new_fd;
     }
 
-    fd = static_cast<int>(table_.size());
+    auto &to = emplace(index);
+    if (to.owner) {
+      // Retired rather than destroyed, borrowers may still hold it
+      replaced = retire(to, index);
+    }
 
-    // Simulated bit already set, this should not be a valid fd
-    assert(!is_simulated(fd));
-    fd |= simulated;
+    const std::size_t w = index / 64;
+    if (used_.size() <= w) {
+      used_.resize(w + 1);
+    }
+    used_[w] |= std::uint64_t{1} << (index % 64);
+    install(index, from->owner, cloexec);
   }
 
-  assert(0 <= fd);
-  assert(is_simulated(fd));
+  if (replaced) {
+    drop(*replaced);
+    replaced.reset();
+    reclaim();
+  }
+  return new_fd;
+}
 
-  auto &slot = table_[fd];
-  assert(!slot);
-  slot = std::move(fildes);
-  return fd;
+int file_descriptor_table::fd_flags(int fd) const {
+  std::unique_lock lock{mutex_};
+
+  auto slot = find(fd);
+  if (!slot || !slot->owner) {
+    return -EBADF;
+  }
+  return slot->cloexec ? FD_CLOEXEC : 0;
 }
 
-namespace {
-class stdout_file_descriptor final : public file_descriptor {
-public:
-  stdout_file_descriptor() = default;
+int file_descriptor_table::set_fd_flags(int fd, int flags) {
+  std::unique_lock lock{mutex_};
 
-  std::int64_t write(tl::function_ref<int(std::span<std::byte>)> load,
-                     const std::size_t bytes) final {
-    std::vector buf{8192, std::byte{}};
+  auto slot = find(fd);
+  if (!slot || !slot->owner) {
+    return -EBADF;
+  }
+  slot->cloexec = (flags & FD_CLOEXEC) != 0;
+  return 0;
+}
 
-    std::size_t done = 0;
+void file_descriptor_table::close_on_exec() { close_if(true); }
 
-    fmt::println("output: '{}'", std::string_view{(const char *)buf.data(), 4});
+void file_descriptor_table::close_all() { close_if(false); }
 
-    while (done < bytes) {
-      std::span tmp = buf;
+void file_descriptor_table::close_if(bool only_cloexec) {
+  std::vector<std::shared_ptr<file_descriptor>> closing;
+  {
+    std::unique_lock lock{mutex_};
 
-      if (tmp.size_bytes() > bytes) {
-        tmp = tmp.subspan(0, bytes);
+    for (std::size_t w = 0; w < used_.size(); ++w) {
+      for (auto bits = used_[w]; bits != 0; bits &= bits - 1) {
+        const std::size_t index = w * 64 + std::countr_zero(bits);
+        auto &slot = emplace(index);
+        if (slot.cloexec || !only_cloexec) {
+          closing.push_back(retire(slot, index));
+        }
       }
+    }
+  }
 
-      auto res = load(tmp);
-      if (res < 0) {
-        return res;
-      }
+  for (auto &fildes : closing) {
+    drop(*fildes);
+  }
+  closing.clear();
+  reclaim();
+}
 
-      fmt::println("output: '{}'",
-                   std::string_view{(const char *)tmp.data(), tmp.size()});
+std::shared_ptr<file_descriptor_table> file_descriptor_table::fork() const {
+  auto copy = std::make_shared<file_descriptor_table>();
 
-      fmt::println("output: {}",
-                   std::fwrite(tmp.data(), 1, tmp.size_bytes(), stdout));
+  std::scoped_lock lock{mutex_, copy->mutex_};
 
-      done += tmp.size_bytes();
+  for (std::size_t w = 0; w < used_.size(); ++w) {
+    for (auto bits = used_[w]; bits != 0; bits &= bits - 1) {
+      const std::size_t index = w * 64 + std::countr_zero(bits);
+      auto &slot = *find(static_cast<int>(index) | simulated);
+      copy->install(index, slot.owner, slot.cloexec);
     }
+  }
+  copy->used_ = used_;
+  copy->lowest_free_ = lowest_free_;
+  return copy;
+}
+
+int file_descriptor_table::allocate(std::size_t from) {
+  const std::size_t start = std::max(from, lowest_free_);
 
-    return done;
-  };
+  // Find the lowest clear bit at or above the start, treating the bits
+  // below it in its word as set
+  std::size_t w = start / 64;
+  std::uint64_t below = (std::uint64_t{1} << (start % 64)) - 1;
+  while (w < used_.size() && (used_[w] | below) == ~std::uint64_t{0}) {
+    w++;
+    below = 0;
+  }
+  if (used_.size() <= w) {
+    used_.resize(w + 1);
+  }
+  const std::size_t index = w * 64 + std::countr_one(used_[w] | below);
+
+  if (max_chunks * chunk_size <= index) {
+    return -EMFILE;
+  }
+
+  used_[w] |= std::uint64_t{1} << (index % 64);
+  // Only a search from the hint keeps everything below it in use
+  if (from <= lowest_free_) {
+    lowest_free_ = index + 1;
+  }
+  return static_cast<int>(index);
+}
+
+file_descriptor_table::slot &file_descriptor_table::emplace(std::size_t index) {
+  auto &chunk = chunks_[index >> chunk_bits];
+  if (!chunk.load(std::memory_order_relaxed)) {
+    chunk.store(new slot[chunk_size], std::memory_order_release);
+  }
+  return chunk.load(std::memory_order_relaxed)[index & (chunk_size - 1)];
+}
+
+void file_descriptor_table::install(std::size_t index,
+                                    std::shared_ptr<file_descriptor> fildes,
+                                    bool cloexec) {
+  auto &slot = emplace(index);
+  assert(!slot.owner);
+  fildes->fds_.fetch_add(1, std::memory_order_relaxed);
+  slot.fildes.store(fildes.get(), std::memory_order_seq_cst);
+  slot.owner = std::move(fildes);
+  slot.cloexec = cloexec;
+}
 
-private:
-  sys::file f_;
-};
-} // namespace
+// Borrowers may still be using the descriptor, so it is only freed by a
+// later reclaim()
+std::shared_ptr<file_descriptor>
+file_descriptor_table::retire(slot &slot, std::size_t index) {
+  slot.fildes.store(nullptr, std::memory_order_seq_cst);
+  auto fildes = slot.owner;
+  retired_.push_back(std::move(slot.owner));
+  slot.cloexec = false;
+  retired_pending_.store(true, std::memory_order_seq_cst);
 
-std::shared_ptr<file_descriptor> stdout_fd() {
-  static std::shared_ptr<stdout_file_descriptor> shared =
-      std::make_shared<stdout_file_descriptor>();
-  return shared;
+  used_[index / 64] &= ~(std::uint64_t{1} << (index % 64));
+  lowest_free_ = std::min(lowest_free_, index);
+  return fildes;
 }
 } // namespace redstone::sim
\ No newline at end of file
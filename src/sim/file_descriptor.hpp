@@ -1,19 +1,43 @@
 #pragma once
 
+#include <atomic>
 #include <cerrno>
 #include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
 #include <memory>
 #include <mutex>
+#include <poll.h>
+#include <sys/stat.h>
 #include <span>
 #include <tl/function_ref.hpp>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace redstone::sim {
+/// What a file_descriptor is, so that hooks can pick the few type-specific
+/// paths without RTTI. Sockets come last.
+enum class fd_kind : std::uint8_t {
+  other,
+  pipe,
+  eventfd,
+  file,
+  stream_socket,
+  datagram_socket,
+  socket_pair,
+};
+
+/// An open file description. Fds duplicated from one another share one,
+/// along with its status flags and offset, and it lives until the last of
+/// them is closed.
 class file_descriptor {
 public:
+  explicit file_descriptor(fd_kind kind = fd_kind::other) : kind_{kind} {}
   virtual ~file_descriptor() = default;
 
+  fd_kind kind() const { return kind_; }
+  bool is_socket() const { return fd_kind::stream_socket <= kind_; }
+
   virtual std::int64_t
   read(tl::function_ref<int(std::span<const std::byte>)> store,
        std::size_t bytes) {
@@ -25,29 +49,232 @@ public:
     return -EINVAL;
   };
 
+  /// Whether the descriptor supports positional I/O. Pipes and sockets do
+  /// not, and fail pread/pwrite with ESPIPE.
+  virtual bool seekable() const { return false; }
+
+  virtual std::int64_t
+  pread(tl::function_ref<int(std::span<const std::byte>)> store,
+        std::size_t bytes, std::uint64_t offset) {
+    return -ESPIPE;
+  }
+
+  virtual std::int64_t pwrite(tl::function_ref<int(std::span<std::byte>)> load,
+                              std::size_t bytes, std::uint64_t offset) {
+    return -ESPIPE;
+  }
+
+  /// Moves the offset as lseek(2) does, returning the new one
+  virtual std::int64_t seek(std::int64_t offset, int whence) {
+    return -ESPIPE;
+  }
+
+  /// Makes written data durable, as fsync(2) does
+  virtual int sync() { return -EINVAL; }
+
+  virtual int truncate(std::uint64_t size) { return -EINVAL; }
+
+  /// Fills in `st` as fstat(2) does. The default describes pipes, sockets
+  /// and eventfds by their kind alone.
+  virtual int stat(struct stat &st);
+
+  /// Events that would not block right now, as reported by poll(2)
+  virtual short poll() const { return POLLIN | POLLOUT; }
+
+  /// File status flags as reported by fcntl(F_GETFL)
+  int status_flags() const {
+    return status_flags_.load(std::memory_order_relaxed);
+  }
+
+  void set_status_flags(int flags) {
+    status_flags_.store(flags, std::memory_order_relaxed);
+  }
+
+  bool nonblocking() const { return (status_flags() & O_NONBLOCK) != 0; }
+
+  /// File offset of seekable descriptors
+  std::uint64_t offset() const {
+    return offset_.load(std::memory_order_relaxed);
+  }
+
+  void set_offset(std::uint64_t offset) {
+    offset_.store(offset, std::memory_order_relaxed);
+  }
+
+  /// Called once the last fd referring to the description is closed, in any
+  /// table, so that peers see the end of the stream or EPIPE right away.
+  /// Syscalls still using the description keep it alive until they return.
+  virtual void closed() {}
+
 private:
+  friend class file_descriptor_table;
+
+  const fd_kind kind_;
+  std::atomic<int> status_flags_ = O_RDWR;
+  std::atomic<std::uint64_t> offset_ = 0;
+  // Fds referring to the description, across every table
+  std::atomic<std::uint32_t> fds_ = 0;
+  // Syscalls using the description through a borrowed_fd
+  std::atomic<std::uint32_t> borrows_ = 0;
 };
 
+class file_descriptor_table;
+
+// A descriptor on loan from a file_descriptor_table. It stays alive while
+// borrowed, even if another thread closes its fd. Borrows are counted on the
+// descriptor rather than its shared_ptr, and only hold back freeing that one
+// descriptor.
+class borrowed_fd {
+public:
+  borrowed_fd() = default;
+  borrowed_fd(borrowed_fd &&other) noexcept
+      : table_{std::exchange(other.table_, nullptr)},
+        fildes_{std::exchange(other.fildes_, nullptr)} {}
+  borrowed_fd &operator=(borrowed_fd other) noexcept {
+    std::swap(table_, other.table_);
+    std::swap(fildes_, other.fildes_);
+    return *this;
+  }
+  ~borrowed_fd();
+
+  file_descriptor *get() const { return fildes_; }
+  file_descriptor &operator*() const { return *fildes_; }
+  file_descriptor *operator->() const { return fildes_; }
+  explicit operator bool() const { return fildes_ != nullptr; }
+
+private:
+  friend class file_descriptor_table;
+
+  borrowed_fd(file_descriptor_table *table, file_descriptor *fildes)
+      : table_{table}, fildes_{fildes} {}
+
+  file_descriptor_table *table_ = nullptr;
+  file_descriptor *fildes_ = nullptr;
+};
+
+// Simulated fds carry a high bit to tell them apart from real ones, and
+// index a dense slot array with the rest. Like the kernel, new fds take the
+// lowest free number. Duplicating an fd copies its slot, so both share the
+// descriptor but have their own close-on-exec flag.
+//
+// Slots carry no generation tag. An fd number reused after a close must
+// refer to the new description, as on Linux, so a tag could not turn a stale
+// number away. A syscall racing the close holds the old description through
+// its borrow.
+//
+// Closing the last fd of a description signals its peers at once. The
+// description itself is retired rather than destroyed while borrowed, and
+// freed once its last borrow ends.
 class file_descriptor_table {
 public:
-  file_descriptor_table() = default;
+  file_descriptor_table();
+  ~file_descriptor_table();
+
+  file_descriptor_table(const file_descriptor_table &) = delete;
+  file_descriptor_table &operator=(const file_descriptor_table &) = delete;
+
+  // Set in every simulated fd
+  static constexpr int simulated = 1 << 30;
 
   static bool is_simulated(int fd) { return (fd & simulated) != 0; }
 
-  std::shared_ptr<file_descriptor> get(int fd);
+  // The only lookup. It indexes the slot and loads its raw pointer, never
+  // blocking or touching a shared_ptr, even while another thread opens or
+  // closes fds. Borrows should not outlive the syscall that takes them.
+  borrowed_fd borrow(int fd);
+
+  // Returns 0, or -EBADF if `fd` is not open
   int close(int fd);
-  int insert(std::shared_ptr<file_descriptor> fildes);
+
+  // Returns the new fd, or -EMFILE if the table is full
+  int insert(std::shared_ptr<file_descriptor> fildes, bool cloexec = false);
+
+  // Duplicates `fd` onto the lowest free fd not below `min_fd`, as F_DUPFD
+  // does. Returns the new fd, -EBADF, -EINVAL if `min_fd` is out of range,
+  // or -EMFILE.
+  int dup(int fd, int min_fd, bool cloexec);
+
+  // Duplicates `fd` onto `new_fd`, closing whatever `new_fd` referred to,
+  // as dup2 does. Returns `new_fd`, or -EBADF if either fd is out of range.
+  int dup_to(int fd, int new_fd, bool cloexec);
+
+  // FD_CLOEXEC or 0, as for F_GETFD, or -EBADF
+  int fd_flags(int fd) const;
+
+  // Returns 0, or -EBADF if `fd` is not open
+  int set_fd_flags(int fd, int flags);
+
+  // Closes every fd marked close-on-exec, once the tracee has exec'd
+  void close_on_exec();
+
+  // Closes every fd, once the last task using the table has exited
+  void close_all();
+
+  // The table of a process forked from this one's: the same descriptors
+  // under the same fds, with the same close-on-exec flags
+  std::shared_ptr<file_descriptor_table> fork() const;
 
 private:
-  static constexpr int simulated = 1 << 30;
-  static constexpr int capacity = (1u << 30) - 1;
+  friend class borrowed_fd;
+
+  struct slot {
+    // What borrow() loads
+    std::atomic<file_descriptor *> fildes = nullptr;
+    // Owns `fildes`, guarded by mutex_ and never read by lookups
+    std::shared_ptr<file_descriptor> owner;
+    // Guarded by mutex_
+    bool cloexec = false;
+  };
+
+  // Slots live in chunks that never move once allocated, so lookups index
+  // them without locking
+  static constexpr std::size_t chunk_bits = 10;
+  static constexpr std::size_t chunk_size = std::size_t{1} << chunk_bits;
+  static constexpr std::size_t max_chunks = std::size_t{1} << 10;
 
-  int counter_ = 1 << 30;
+  std::unique_ptr<std::atomic<slot *>[]> chunks_;
 
-  std::mutex mutex_;
-  std::unordered_map<int, std::shared_ptr<file_descriptor>> table_;
-  std::vector<int> unused_;
+  slot *find(int fd) const;
+
+  // These require mutex_. allocate() returns the lowest free index not below
+  // `from`, marked in use, or -EMFILE. retire() returns the descriptor it
+  // took out of the slot, to be passed to drop() once unlocked.
+  int allocate(std::size_t from);
+  slot &emplace(std::size_t index);
+  void install(std::size_t index, std::shared_ptr<file_descriptor> fildes,
+               bool cloexec);
+  std::shared_ptr<file_descriptor> retire(slot &slot, std::size_t index);
+
+  void close_if(bool only_cloexec);
+
+  // Counts one fd fewer on `fildes`, telling it once the last is gone. Not
+  // under mutex_, since it may take the locks of the descriptor's peers.
+  static void drop(file_descriptor &fildes);
+
+  void leave();
+  void release(file_descriptor *fildes);
+  // Frees the retired descriptors that are not borrowed
+  void reclaim();
+
+  // Borrows between loading a slot and counting themselves on the
+  // descriptor. Never held across a syscall, so it only holds back reclaim()
+  // for a moment.
+  std::atomic<std::size_t> entering_ = 0;
+  std::atomic<bool> retired_pending_ = false;
+
+  // Guards everything below, and serializes inserts and closes
+  mutable std::mutex mutex_;
+  // Closed while they may have been borrowed
+  std::vector<std::shared_ptr<file_descriptor>> retired_;
+  // One bit per fd in use
+  std::vector<std::uint64_t> used_;
+  // Every fd below this one is in use
+  std::size_t lowest_free_ = 0;
 };
 
-std::shared_ptr<file_descriptor> stdout_fd();
+inline borrowed_fd::~borrowed_fd() {
+  if (table_) {
+    table_->release(fildes_);
+  }
+}
 } // namespace redstone::sim
\ No newline at end of file
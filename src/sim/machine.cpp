@@ -1,6 +1,14 @@
 #include "machine.hpp"
 
 namespace redstone::sim {
+machine::machine(simulator &sim, runner_options options)
+    : runner_options_{std::move(options)}, sim_{&sim},
+      id_{sim.register_machine()} {
+  if (auto &root = sim.initial_options().disk_root; !root.empty()) {
+    disk_ = std::make_unique<disk::disk>(root);
+  }
+}
+
 void machine::start() {
   runner_options_.machine = this;
   auto handle = runner_(runner_options_);
@@ -3,6 +3,7 @@
 #include <functional>
 #include <memory>
 
+#include "disk/disk.hpp"
 #include "replica.hpp"
 #include "runner.hpp"
 #include "simulator.hpp"
@@ -12,15 +13,19 @@ class simulator;
 
 class machine {
 public:
-  explicit machine(simulator &sim, runner_options options)
-      : sim_{&sim}, runner_options_{std::move(options)} {}
+  explicit machine(simulator &sim, runner_options options);
 
   std::shared_ptr<replica> current_replica() { return current_; }
 
+  net::endpoint_id id() const { return id_; }
+
   void start();
 
   sim::simulator &sim() { return *sim_; }
 
+  // Null unless a disk root is configured. Outlives the machine's replicas.
+  disk::disk *disk() { return disk_.get(); }
+
 private:
   runner_options runner_options_;
   std::shared_ptr<replica> current_;
@@ -28,5 +33,7 @@ private:
       ptrace_run};
   sim::simulator *sim_;
   net::network *net_;
+  net::endpoint_id id_;
+  std::unique_ptr<disk::disk> disk_;
 };
 } // namespace redstone::sim
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "sim/output.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <spdlog/spdlog.h>
+#include <system_error>
+
+namespace redstone::sim {
+output_capture::output_capture(const std::string &path)
+    : file_descriptor{fd_kind::other},
+      file_{sys::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0644)},
+      buf_{new std::byte[buffer_size]} {
+  set_status_flags(O_WRONLY);
+}
+
+output_capture::~output_capture() { flush(); }
+
+std::int64_t
+output_capture::write(tl::function_ref<int(std::span<std::byte>)> load,
+                      std::size_t bytes) {
+  std::unique_lock lock{mutex_};
+
+  // Loads straight into the buffer, a buffer's worth at a time
+  std::size_t done = 0;
+  while (done < bytes) {
+    if (used_ == buffer_size) {
+      flush_locked();
+    }
+
+    std::span chunk{buf_.get() + used_,
+                    std::min(bytes - done, buffer_size - used_)};
+    auto res = load(chunk);
+    if (res < 0) {
+      return done == 0 ? res : done;
+    }
+
+    hash_.update(chunk);
+    used_ += chunk.size();
+    done += chunk.size();
+  }
+  return done;
+}
+
+void output_capture::flush() {
+  std::unique_lock lock{mutex_};
+  flush_locked();
+}
+
+void output_capture::flush_locked() {
+  if (used_ == 0) {
+    return;
+  }
+  if (auto res = file_.write_all({buf_.get(), used_}); res < 0) {
+    spdlog::error("failed to write output log: {}",
+                  std::error_code{-res, std::generic_category()}.message());
+  }
+  used_ = 0;
+}
+
+std::uint64_t output_capture::digest() const {
+  std::unique_lock lock{mutex_};
+  return hash_.digest();
+}
+
+std::uint64_t output_capture::size() const {
+  std::unique_lock lock{mutex_};
+  return hash_.size();
+}
+} // namespace redstone::sim
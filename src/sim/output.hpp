@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+
+#include "hash/xxh64.hpp"
+#include "sim/file_descriptor.hpp"
+#include "sys/file.hpp"
+
+namespace redstone::sim {
+// Captures what a replica writes to its standard output or error. Writes
+// land in a large buffer that goes to a log file whenever it fills, and are
+// hashed as they arrive, so checking a run's output needs neither the
+// terminal nor memory proportional to its size.
+class output_capture final : public file_descriptor {
+public:
+  // Throws std::system_error if the log cannot be created
+  explicit output_capture(const std::string &path);
+  ~output_capture() override;
+
+  std::int64_t write(tl::function_ref<int(std::span<std::byte>)> load,
+                     std::size_t bytes) override;
+
+  // Writes out buffered output
+  void flush();
+
+  // XXH64 of everything written so far
+  std::uint64_t digest() const;
+
+  std::uint64_t size() const;
+
+private:
+  static constexpr std::size_t buffer_size = std::size_t{1} << 20;
+
+  void flush_locked();
+
+  mutable std::mutex mutex_;
+  sys::file file_;
+  std::unique_ptr<std::byte[]> buf_;
+  std::size_t used_ = 0;
+  hash::xxh64 hash_;
+};
+} // namespace redstone::sim
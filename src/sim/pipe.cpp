@@ -0,0 +1,244 @@
+#include "sim/pipe.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <limits.h>
+#include <mutex>
+#include <poll.h>
+
+namespace redstone::sim {
+void pipe_channel::wake(std::atomic<std::uint32_t> &seq) {
+  seq.fetch_add(1, std::memory_order_release);
+  seq.notify_all();
+}
+
+std::int64_t
+pipe_channel::read(tl::function_ref<int(std::span<const std::byte>)> store,
+                   std::size_t bytes, bool nonblocking) {
+  if (bytes == 0) {
+    return 0;
+  }
+
+  for (;;) {
+    const auto seq = readable_seq_.load(std::memory_order_acquire);
+    {
+      std::unique_lock lock{read_mutex_};
+      // Checked before the ring, so data written before the close is not
+      // lost
+      const bool open = writer_open_.load(std::memory_order_acquire);
+
+      auto [first, second] = ring_.readable();
+      if (!first.empty()) {
+        first = first.first(std::min(first.size(), bytes));
+        second = second.first(std::min(second.size(), bytes - first.size()));
+
+        auto res = store(first);
+        if (res < 0) {
+          return res;
+        }
+        if (!second.empty()) {
+          res = store(second);
+          if (res < 0) {
+            second = {};
+          }
+        }
+
+        const auto n = first.size() + second.size();
+        ring_.consume(n);
+        wake(writable_seq_);
+        return n;
+      }
+
+      if (!open) {
+        return 0;
+      }
+    }
+    if (nonblocking) {
+      return -EAGAIN;
+    }
+    readable_seq_.wait(seq, std::memory_order_acquire);
+  }
+}
+
+std::int64_t
+pipe_channel::write(tl::function_ref<int(std::span<std::byte>)> load,
+                    std::size_t bytes, bool nonblocking) {
+  std::size_t done = 0;
+
+  while (done < bytes) {
+    const auto seq = writable_seq_.load(std::memory_order_acquire);
+
+    // The write hook raises SIGPIPE along with the error
+    if (!reader_open_.load(std::memory_order_acquire)) {
+      return done != 0 ? done : -EPIPE;
+    }
+
+    std::unique_lock lock{write_mutex_};
+    auto [first, second] = ring_.writable();
+    const auto space = first.size() + second.size();
+    const auto left = bytes - done;
+
+    // Like Linux, writes of up to PIPE_BUF bytes are never split, nor
+    // interleaved with other writers
+    const bool fits = left <= PIPE_BUF ? left <= space : space != 0;
+    if (!fits) {
+      lock.unlock();
+      if (nonblocking) {
+        return done != 0 ? done : -EAGAIN;
+      }
+      writable_seq_.wait(seq, std::memory_order_acquire);
+      continue;
+    }
+
+    first = first.first(std::min(first.size(), left));
+    second = second.first(std::min(second.size(), left - first.size()));
+
+    auto res = load(first);
+    if (0 <= res && !second.empty()) {
+      res = load(second);
+    }
+    if (res < 0) {
+      return done != 0 ? done : res;
+    }
+
+    const auto n = first.size() + second.size();
+    ring_.commit(n);
+    wake(readable_seq_);
+    done += n;
+  }
+
+  return done;
+}
+
+void pipe_channel::close_reader() {
+  reader_open_.store(false, std::memory_order_release);
+  wake(writable_seq_);
+}
+
+void pipe_channel::close_writer() {
+  writer_open_.store(false, std::memory_order_release);
+  wake(readable_seq_);
+}
+
+short pipe_channel::reader_events() const {
+  short events = 0;
+  if (ring_.size() != 0) {
+    events |= POLLIN;
+  }
+  if (!writer_open_.load(std::memory_order_acquire)) {
+    events |= POLLHUP;
+  }
+  return events;
+}
+
+short pipe_channel::writer_events() const {
+  if (!reader_open_.load(std::memory_order_acquire)) {
+    return POLLERR;
+  }
+  return ring_.capacity() - ring_.size() >= PIPE_BUF ? POLLOUT : 0;
+}
+
+std::pair<std::shared_ptr<pipe_reader>, std::shared_ptr<pipe_writer>>
+make_pipe(std::size_t capacity) {
+  auto channel = std::make_shared<pipe_channel>(capacity);
+  return {std::make_shared<pipe_reader>(channel),
+          std::make_shared<pipe_writer>(channel)};
+}
+
+std::int64_t eventfd_file_descriptor::read(
+    tl::function_ref<int(std::span<const std::byte>)> store,
+    std::size_t bytes) {
+  if (bytes < sizeof(std::uint64_t)) {
+    return -EINVAL;
+  }
+
+  auto count = count_.load(std::memory_order_acquire);
+  std::uint64_t value;
+
+  for (;;) {
+    if (count == closed_count) {
+      return -EBADF;
+    }
+    if (count == 0) {
+      if (nonblocking()) {
+        return -EAGAIN;
+      }
+      count_.wait(0, std::memory_order_acquire);
+      count = count_.load(std::memory_order_acquire);
+      continue;
+    }
+
+    value = semaphore_ ? 1 : count;
+    if (count_.compare_exchange_weak(count, count - value,
+                                     std::memory_order_acq_rel)) {
+      break;
+    }
+  }
+  count_.notify_all();
+
+  auto res = store(std::as_bytes(std::span{&value, 1}));
+  if (res < 0) {
+    return res;
+  }
+  return sizeof(value);
+}
+
+std::int64_t
+eventfd_file_descriptor::write(tl::function_ref<int(std::span<std::byte>)> load,
+                               std::size_t bytes) {
+  if (bytes < sizeof(std::uint64_t)) {
+    return -EINVAL;
+  }
+
+  std::uint64_t value;
+  auto res = load(std::as_writable_bytes(std::span{&value, 1}));
+  if (res < 0) {
+    return res;
+  }
+  if (value == UINT64_MAX) {
+    return -EINVAL;
+  }
+
+  auto count = count_.load(std::memory_order_acquire);
+
+  for (;;) {
+    if (count == closed_count) {
+      return -EBADF;
+    }
+    if (max_count - count < value) {
+      if (nonblocking()) {
+        return -EAGAIN;
+      }
+      count_.wait(count, std::memory_order_acquire);
+      count = count_.load(std::memory_order_acquire);
+      continue;
+    }
+
+    if (count_.compare_exchange_weak(count, count + value,
+                                     std::memory_order_acq_rel)) {
+      break;
+    }
+  }
+  count_.notify_all();
+
+  return sizeof(value);
+}
+
+void eventfd_file_descriptor::closed() {
+  count_.store(closed_count, std::memory_order_release);
+  count_.notify_all();
+}
+
+short eventfd_file_descriptor::poll() const {
+  const auto count = count_.load(std::memory_order_acquire);
+
+  short events = 0;
+  if (count != 0) {
+    events |= POLLIN;
+  }
+  if (count < max_count) {
+    events |= POLLOUT;
+  }
+  return events;
+}
+} // namespace redstone::sim
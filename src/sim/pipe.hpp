@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <tl/function_ref.hpp>
+#include <utility>
+
+#include "file_descriptor.hpp"
+#include "ring.hpp"
+
+namespace redstone::sim {
+// Default pipe capacity on Linux
+constexpr std::size_t pipe_capacity = 64 * 1024;
+
+// One direction of a pipe or socketpair. Threads and forked children may
+// share either end, so each side takes its own lock to remain the ring's
+// single producer or consumer. Blocked ends drop it and sleep on a sequence
+// number that the other end bumps whenever it makes progress or closes.
+class pipe_channel {
+public:
+  explicit pipe_channel(std::size_t capacity) : ring_{capacity} {}
+
+  std::int64_t read(tl::function_ref<int(std::span<const std::byte>)> store,
+                    std::size_t bytes, bool nonblocking);
+
+  std::int64_t write(tl::function_ref<int(std::span<std::byte>)> load,
+                     std::size_t bytes, bool nonblocking);
+
+  void close_reader();
+  void close_writer();
+
+  // poll(2) events for either end
+  short reader_events() const;
+  short writer_events() const;
+
+private:
+  static void wake(std::atomic<std::uint32_t> &seq);
+
+  byte_ring ring_;
+  std::mutex read_mutex_;
+  std::mutex write_mutex_;
+  std::atomic<bool> reader_open_ = true;
+  std::atomic<bool> writer_open_ = true;
+  alignas(64) std::atomic<std::uint32_t> readable_seq_ = 0;
+  alignas(64) std::atomic<std::uint32_t> writable_seq_ = 0;
+};
+
+class pipe_reader final : public file_descriptor {
+public:
+  explicit pipe_reader(std::shared_ptr<pipe_channel> channel)
+      : file_descriptor{fd_kind::pipe}, channel_{std::move(channel)} {}
+  // Also on destruction, for ends that never had an fd
+  ~pipe_reader() override { closed(); }
+
+  void closed() final { channel_->close_reader(); }
+
+  std::int64_t read(tl::function_ref<int(std::span<const std::byte>)> store,
+                    std::size_t bytes) final {
+    return channel_->read(store, bytes, nonblocking());
+  }
+
+  std::int64_t write(tl::function_ref<int(std::span<std::byte>)> load,
+                     std::size_t bytes) final {
+    return -EBADF;
+  }
+
+  short poll() const final { return channel_->reader_events(); }
+
+private:
+  std::shared_ptr<pipe_channel> channel_;
+};
+
+class pipe_writer final : public file_descriptor {
+public:
+  explicit pipe_writer(std::shared_ptr<pipe_channel> channel)
+      : file_descriptor{fd_kind::pipe}, channel_{std::move(channel)} {}
+  // Also on destruction, for ends that never had an fd
+  ~pipe_writer() override { closed(); }
+
+  void closed() final { channel_->close_writer(); }
+
+  std::int64_t read(tl::function_ref<int(std::span<const std::byte>)> store,
+                    std::size_t bytes) final {
+    return -EBADF;
+  }
+
+  std::int64_t write(tl::function_ref<int(std::span<std::byte>)> load,
+                     std::size_t bytes) final {
+    return channel_->write(load, bytes, nonblocking());
+  }
+
+  short poll() const final { return channel_->writer_events(); }
+
+private:
+  std::shared_ptr<pipe_channel> channel_;
+};
+
+// Returns the read and write ends of a new pipe
+std::pair<std::shared_ptr<pipe_reader>, std::shared_ptr<pipe_writer>>
+make_pipe(std::size_t capacity = pipe_capacity);
+
+// An eventfd(2) counter
+class eventfd_file_descriptor final : public file_descriptor {
+public:
+  explicit eventfd_file_descriptor(std::uint64_t initial, bool semaphore)
+      : file_descriptor{fd_kind::eventfd}, count_{initial},
+        semaphore_{semaphore} {}
+
+  std::int64_t read(tl::function_ref<int(std::span<const std::byte>)> store,
+                    std::size_t bytes) final;
+
+  std::int64_t write(tl::function_ref<int(std::span<std::byte>)> load,
+                     std::size_t bytes) final;
+
+  short poll() const final;
+
+  // Wakes any hook still blocked on the counter
+  void closed() final;
+
+private:
+  static constexpr std::uint64_t max_count = UINT64_MAX - 1;
+  // Above any count, so it can stand for a closed counter
+  static constexpr std::uint64_t closed_count = UINT64_MAX;
+
+  std::atomic<std::uint64_t> count_;
+  const bool semaphore_;
+};
+} // namespace redstone::sim
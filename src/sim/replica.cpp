@@ -1,15 +1,30 @@
 #include "replica.hpp"
 #include "machine.hpp"
 #include "simulator.hpp"
+#include <fmt/format.h>
 #include <memory>
 
 namespace redstone::sim {
+thread_local file_descriptor_table *replica::task_fd_table_ = nullptr;
+
 replica::~replica() = default;
 
 replica::replica(std::shared_ptr<runner_handle> handle, machine &m)
-    : handle_{std::move(handle)}, machine_{&m} {}
+    : handle_{std::move(handle)}, machine_{&m} {
+  const auto &dir = m.sim().initial_options().output_path;
+  if (!dir.empty()) {
+    stdout_ = std::make_unique<output_capture>(
+        fmt::format("{}/{}.stdout", dir, m.id()));
+    stderr_ = std::make_unique<output_capture>(
+        fmt::format("{}/{}.stderr", dir, m.id()));
+  }
+}
 
 net::network &replica::network() { return machine_->sim().net(); }
 
 simulator &replica::sim() { return machine_->sim(); }
+
+net::endpoint_id replica::machine_id() const { return machine_->id(); }
+
+disk::disk *replica::disk() { return machine_->disk(); }
 } // namespace redstone::sim
\ No newline at end of file
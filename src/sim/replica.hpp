@@ -2,11 +2,18 @@
 
 #include "file_descriptor.hpp"
 #include "net/network.hpp"
+#include "output.hpp"
+#include "net/topology.hpp"
 #include "runner.hpp"
 
 #include <cassert>
 #include <chrono>
 #include <memory>
+#include <unistd.h>
+
+namespace redstone::disk {
+class disk;
+}
 
 namespace redstone::sim {
 using clock = std::chrono::steady_clock;
@@ -19,7 +26,22 @@ public:
 
   explicit replica(std::shared_ptr<runner_handle> handle, machine &m);
 
-  file_descriptor_table &fd_table() { return fd_table_; }
+  // The fds of the task whose syscall the calling thread simulates. Threads
+  // of a process share a table, and a forked process starts with a copy of
+  // its parent's, so the runner picks one per task with set_task_fd_table().
+  file_descriptor_table &fd_table() {
+    return task_fd_table_ ? *task_fd_table_ : *fd_table_;
+  }
+
+  // The table of the process the replica started with
+  const std::shared_ptr<file_descriptor_table> &initial_fd_table() const {
+    return fd_table_;
+  }
+
+  // Applies to the calling thread only, until set again
+  static void set_task_fd_table(file_descriptor_table *table) {
+    task_fd_table_ = table;
+  }
 
   runner_handle &runner() {
     assert(handle_);
@@ -30,13 +52,35 @@ public:
 
   simulator &sim();
 
+  net::endpoint_id machine_id() const;
+
+  // The machine's disk, or null if it has none
+  disk::disk *disk();
+
   clock::time_point epoch() const { return epoch_; }
 
+  // The capture behind a standard output or error fd, null for any other fd
+  // or if output is not captured
+  output_capture *output(int fd) const {
+    switch (fd) {
+    case STDOUT_FILENO:
+      return stdout_.get();
+    case STDERR_FILENO:
+      return stderr_.get();
+    default:
+      return nullptr;
+    }
+  }
+
 private:
   std::shared_ptr<runner_handle> handle_;
   machine *machine_ = nullptr;
   net::network *net_;
-  file_descriptor_table fd_table_;
+  std::shared_ptr<file_descriptor_table> fd_table_ =
+      std::make_shared<file_descriptor_table>();
+  static thread_local file_descriptor_table *task_fd_table_;
+  std::unique_ptr<output_capture> stdout_;
+  std::unique_ptr<output_capture> stderr_;
   const clock::time_point epoch_ = clock::now();
 };
 } // namespace redstone::sim
\ No newline at end of file
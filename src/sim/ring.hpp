@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <utility>
+
+namespace redstone::sim {
+// A fixed-size single-producer, single-consumer byte queue. Both sides work
+// on the storage in place: the producer fills writable() and then calls
+// commit(), the consumer drains readable() and then calls consume().
+class byte_ring {
+public:
+  using segments = std::pair<std::span<std::byte>, std::span<std::byte>>;
+
+  // Rounds the capacity up to a power of two
+  explicit byte_ring(std::size_t capacity)
+      : mask_{std::bit_ceil(capacity) - 1},
+        buf_{std::make_unique<std::byte[]>(mask_ + 1)} {}
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+  std::size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  // Consumer side
+  segments readable() {
+    const auto head = head_.load(std::memory_order_relaxed);
+    const auto tail = tail_.load(std::memory_order_acquire);
+    return split(head, tail - head);
+  }
+
+  void consume(std::size_t n) {
+    head_.store(head_.load(std::memory_order_relaxed) + n,
+                std::memory_order_release);
+  }
+
+  // Producer side
+  segments writable() {
+    const auto head = head_.load(std::memory_order_acquire);
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    return split(tail, capacity() - (tail - head));
+  }
+
+  void commit(std::size_t n) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + n,
+                std::memory_order_release);
+  }
+
+private:
+  segments split(std::size_t pos, std::size_t n) {
+    const auto start = pos & mask_;
+    const auto first = std::min(n, capacity() - start);
+    return {{&buf_[start], first}, {&buf_[0], n - first}};
+  }
+
+  const std::size_t mask_;
+  std::unique_ptr<std::byte[]> buf_;
+
+  // Free-running positions, only ever increased by their owning side
+  alignas(64) std::atomic<std::size_t> head_ = 0;
+  alignas(64) std::atomic<std::size_t> tail_ = 0;
+};
+} // namespace redstone::sim
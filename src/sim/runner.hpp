@@ -5,6 +5,7 @@
 #include <optional>
 #include <span>
 #include <string>
+#include <sys/uio.h>
 #include <variant>
 #include <vector>
 
@@ -33,11 +34,23 @@ struct runner_result {
 struct runner_handle {
   virtual ~runner_handle() = default;
 
+  /// Sends `signal` to every process of the replica
   virtual void kill(int signal = SIGTERM) = 0;
+  /// Sends `signal` to the task whose syscall the calling thread simulates,
+  /// as the kernel does for SIGPIPE
+  virtual void raise(int signal) = 0;
   virtual void wait() = 0;
   virtual std::optional<sys::child::run_state> state() = 0;
   virtual int write_memory(uintptr_t ptr, std::span<const std::byte> data) = 0;
   virtual int read_memory(uintptr_t ptr, std::span<std::byte> data) = 0;
+
+  /// Scatter-gather transfers between local buffers and tracee memory, with
+  /// the semantics of process_vm_readv/process_vm_writev. Both sides must
+  /// cover the same number of bytes.
+  virtual int read_memory_v(std::span<const iovec> local,
+                            std::span<const iovec> remote) = 0;
+  virtual int write_memory_v(std::span<const iovec> local,
+                             std::span<const iovec> remote) = 0;
 };
 
 std::shared_ptr<runner_handle> ptrace_run(const runner_options &options);
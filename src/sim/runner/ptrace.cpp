@@ -1,6 +1,8 @@
 #include "sim/runner.hpp"
 
 #include <cassert>
+#include <algorithm>
+#include <array>
 #include <cerrno>
 #include <chrono>
 #include <condition_variable>
@@ -11,9 +13,15 @@
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <limits.h>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
 #include <optional>
+#include <pthread.h>
+#include <sched.h>
 #include <span>
 #include <stdexcept>
 #include <sys/auxv.h>
@@ -22,20 +30,26 @@
 #include <sys/reg.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <system_error>
 #include <thread>
 #include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include <spdlog/spdlog.h>
 
+#include "hook/filter.hpp"
 #include "hook/hook.hpp"
 #include "hook/syscalls.hpp"
 #include "sim/machine.hpp"
 #include "sim/replica.hpp"
+#include "sim/scratch.hpp"
 #include "sys/child.hpp"
 #include "sys/file.hpp"
 #include "sys/ptrace.hpp"
@@ -74,7 +88,8 @@ private:
   std::condition_variable cond_;
 };
 namespace {
-sys::child spawn(const runner_options &options) {
+sys::child spawn(const runner_options &options,
+                 const std::vector<sock_filter> &filter) {
   if (options.args.at(0) != options.path) {
     throw std::invalid_argument{
         "spawn: argv[0] must be the same as the provided path"};
@@ -109,55 +124,67 @@ sys::child spawn(const runner_options &options) {
   ::ptrace(PTRACE_TRACEME, pid, 0, 0);
   std::raise(SIGSTOP);
 
+  // Stops for the syscalls the filter picks, once the tracer resumes with
+  // PTRACE_CONT
+  sock_fprog prog{
+      .len = static_cast<unsigned short>(filter.size()),
+      .filter = const_cast<sock_filter *>(filter.data()),
+  };
+  if (::prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0 ||
+      ::prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) != 0) {
+    throw std::system_error{errno, std::generic_category(),
+                            "failed to install seccomp filter"};
+  }
+
   execvp(options.path.c_str(), argv.data());
   throw std::system_error{errno, std::generic_category(), "execvp failed"};
 }
 
-void replace_syscall_with_result(sys::child &child, uint64_t result) {
+// Returns the task's wait status if it died before the result was in place
+std::optional<int> replace_syscall_with_result(sys::child &child,
+                                               uint64_t result) {
   // Overwrite syscall with SYS_gettid (noop, essentially)
   auto regs = sys::ptrace::get_regs(child);
   regs.orig_rax = SYS_gettid;
   regs.rax = SYS_gettid;
   sys::ptrace::set_regs(child, regs);
 
-  // Wait for gettid to finish
+  // Wait for gettid to finish. From a seccomp stop, PTRACE_SYSCALL runs to
+  // the syscall's exit.
   sys::ptrace::syscall(child);
-  child.wait();
+  auto status = child.wait();
+  if (!WIFSTOPPED(status)) {
+    return status;
+  }
 
   // Update return value of 'gettid' to be the result we want
   regs.orig_rax = result;
   regs.rax = result;
 
   sys::ptrace::set_regs(child, regs);
+  return std::nullopt;
 }
 
-void handle_trapped(sys::child &child, replica &replica) {
-  sys::ptrace::syscall_info info;
-
-  sys::ptrace::get_syscall_info(child, &info);
-
-  if (info.op != PTRACE_SYSCALL_INFO_ENTRY) {
-    return;
-  }
-
-  auto hook = hook::get_hook(info.entry.nr);
+// A syscall stopped by the filter, and the hook that simulates it
+struct job {
+  hook::hook hook = nullptr;
+  std::uint64_t nr = 0;
+  std::array<std::uint64_t, 6> args{};
+};
 
-  if (hook == nullptr) {
-    return;
-  }
+struct completion {
+  pid_t tid;
+  struct job job;
+  hook::hook_result result;
+};
 
-  auto result = hook(replica, info.entry.args);
+// The task whose syscall the calling thread simulates
+thread_local pid_t current_task = -1;
 
-  switch (result.kind) {
-  case redstone::hook::hook_result_kind::handled:
-    spdlog::trace("simulated syscall {}, result {}",
-                  hook::syscall_name(info.entry.nr), result.handled);
-    replace_syscall_with_result(child, result.handled);
-    return;
-  case redstone::hook::hook_result_kind::passthrough:
-    return;
-  }
-}
+// Interrupts the tracer's waitpid when a hook finishes on another thread.
+// Its default action is to ignore it, so the no-op handler changes nothing
+// else.
+constexpr int wake_signal = SIGURG;
 
 void remove_vdso(sys::child &child) {
   uintptr_t pos = child.ptrace(PTRACE_PEEKUSER, sizeof(uintptr_t) * RSP,
@@ -182,6 +209,15 @@ void remove_vdso(sys::child &child) {
   }
 }
 
+// Signals sent to the tracee, including SIGPIPE raised by hooks, stop it
+// before delivery and must be passed on when it resumes. Event stops carry
+// their event above the signal, and group-stops have no siginfo.
+bool is_signal_delivery(sys::child &child, int status) {
+  siginfo_t info;
+  return status >> 16 == 0 &&
+         ::ptrace(PTRACE_GETSIGINFO, child.pid(), 0, &info) == 0;
+}
+
 void wait_until_execve(sys::child &child) {
   spdlog::info("waiting until child execve");
 
@@ -199,7 +235,14 @@ void wait_until_execve(sys::child &child) {
 struct ptrace_runner_handle : public runner_handle {
   ptrace_runner_handle() : runner_handle{} {}
 
-  void kill(int signal) final { child.terminate(signal); }
+  void kill(int signal) final {
+    std::scoped_lock lock{mutex};
+    for (auto pid : processes) {
+      ::kill(pid, signal);
+    }
+  }
+
+  void raise(int signal) final { ::syscall(SYS_tkill, current_task, signal); }
 
   void wait() final {
     wait_inner();
@@ -239,32 +282,91 @@ struct ptrace_runner_handle : public runner_handle {
     return saved_state;
   }
 
+  // Hands the result of a hook run on another thread to the tracer, and
+  // interrupts its wait until it takes it. A wakeup may land just before the
+  // tracer blocks, so it repeats.
+  void complete(const completion &done) {
+    std::unique_lock lock{mutex};
+    completed.push_back(done);
+    const auto seq = ++posted;
+
+    while (tracing && taken < seq) {
+      ::pthread_kill(tracer, wake_signal);
+      cond.wait_for(lock, std::chrono::microseconds{100});
+    }
+  }
+
+  std::vector<completion> take_completed() {
+    std::scoped_lock lock{mutex};
+    taken = posted;
+    cond.notify_all();
+    return std::exchange(completed, {});
+  }
+
+  // PEEKDATA returns the word itself, so only errno tells a failure apart
+  // from a word of all ones. Only the tracer may use ptrace, so hooks run on
+  // other threads get -EFAULT.
+  int peek(uintptr_t ptr, long &word) {
+    errno = 0;
+    word = ::ptrace(PTRACE_PEEKDATA, current_task, ptr, 0);
+    return word == -1 && errno != 0 ? -EFAULT : 0;
+  }
+
+  int poke(uintptr_t ptr, long word) {
+    return ::ptrace(PTRACE_POKEDATA, current_task, ptr, word) < 0 ? -EFAULT
+                                                                   : 0;
+  }
+
   int write_memory(uintptr_t ptr, std::span<const std::byte> data) final {
-    unsigned long word;
+    iovec local{const_cast<std::byte *>(data.data()), data.size()};
+    iovec remote{reinterpret_cast<void *>(ptr), data.size()};
+    return transfer_chunk({&local, 1}, {&remote, 1}, true);
+  }
+
+  int read_memory(uintptr_t ptr, std::span<std::byte> data) final {
+    iovec local{data.data(), data.size()};
+    iovec remote{reinterpret_cast<void *>(ptr), data.size()};
+    return transfer_chunk({&local, 1}, {&remote, 1}, false);
+  }
+
+  // Word-at-a-time transfers, for when process_vm_readv/writev are not
+  // available
+  int poke_memory(uintptr_t ptr, std::span<const std::byte> data) {
+    long word;
 
     while (data.size() >= sizeof(long)) {
       memcpy(&word, data.data(), sizeof(word));
-      ::ptrace(PTRACE_POKEDATA, child.pid(), ptr, word);
+      if (auto res = poke(ptr, word); res < 0) {
+        return res;
+      }
       data = data.subspan(sizeof(word));
       ptr += sizeof(long);
     }
     if (!data.empty()) {
-      auto word = ::ptrace(PTRACE_PEEKDATA, child.pid(), ptr, 0);
+      if (auto res = peek(ptr, word); res < 0) {
+        return res;
+      }
       memcpy(&word, data.data(), data.size());
-      ::ptrace(PTRACE_POKEDATA, child.pid(), ptr, word);
+      return poke(ptr, word);
     }
     return 0;
   }
 
-  int read_memory(uintptr_t ptr, std::span<std::byte> data) final {
+  int peek_memory(uintptr_t ptr, std::span<std::byte> data) {
+    long word;
+
     while (data.size() >= sizeof(long)) {
-      auto word = ::ptrace(PTRACE_PEEKDATA, child.pid(), ptr, 0);
+      if (auto res = peek(ptr, word); res < 0) {
+        return res;
+      }
       memcpy(data.data(), &word, sizeof(word));
       data = data.subspan(sizeof(long));
       ptr += sizeof(long);
     }
     if (!data.empty()) {
-      auto word = ::ptrace(PTRACE_PEEKDATA, child.pid(), ptr, 0);
+      if (auto res = peek(ptr, word); res < 0) {
+        return res;
+      }
       memcpy(data.data(), &word, data.size());
     }
     return 0;
@@ -284,22 +386,531 @@ struct ptrace_runner_handle : public runner_handle {
     // return 0;
   }
 
+  int read_memory_v(std::span<const iovec> local,
+                    std::span<const iovec> remote) final {
+    return transfer_v(local, remote, false);
+  }
+
+  int write_memory_v(std::span<const iovec> local,
+                     std::span<const iovec> remote) final {
+    return transfer_v(local, remote, true);
+  }
+
+  // Splits a scatter-gather transfer into pieces that each lie within one
+  // local and one remote segment, and hands them to process_vm_readv/writev
+  // at most IOV_MAX at a time.
+  int transfer_v(std::span<const iovec> local, std::span<const iovec> remote,
+                 bool write) {
+    std::pmr::vector<iovec> local_chunk{&scratch()};
+    std::pmr::vector<iovec> remote_chunk{&scratch()};
+    local_chunk.reserve(std::min<std::size_t>(IOV_MAX, local.size()));
+    remote_chunk.reserve(std::min<std::size_t>(IOV_MAX, remote.size()));
+
+    std::size_t li = 0, ri = 0, loff = 0, roff = 0;
+
+    for (;;) {
+      while (li < local.size() && loff == local[li].iov_len) {
+        li++;
+        loff = 0;
+      }
+      while (ri < remote.size() && roff == remote[ri].iov_len) {
+        ri++;
+        roff = 0;
+      }
+
+      const bool done = li == local.size() || ri == remote.size();
+
+      if (done || local_chunk.size() == IOV_MAX) {
+        auto res = transfer_chunk(local_chunk, remote_chunk, write);
+        if (res < 0) {
+          return res;
+        }
+        local_chunk.clear();
+        remote_chunk.clear();
+      }
+
+      if (done) {
+        return li == local.size() && ri == remote.size() ? 0 : -EINVAL;
+      }
+
+      auto n = std::min(local[li].iov_len - loff, remote[ri].iov_len - roff);
+      local_chunk.push_back(
+          {static_cast<std::byte *>(local[li].iov_base) + loff, n});
+      remote_chunk.push_back(
+          {static_cast<std::byte *>(remote[ri].iov_base) + roff, n});
+      loff += n;
+      roff += n;
+    }
+  }
+
+  int transfer_chunk(std::span<const iovec> local,
+                     std::span<const iovec> remote, bool write) {
+    std::size_t expected = 0;
+    for (auto &piece : local) {
+      expected += piece.iov_len;
+    }
+    if (expected == 0) {
+      return 0;
+    }
+
+    auto res = write ? ::process_vm_writev(current_task, local.data(),
+                                           local.size(), remote.data(),
+                                           remote.size(), 0)
+                     : ::process_vm_readv(current_task, local.data(),
+                                          local.size(), remote.data(),
+                                          remote.size(), 0);
+
+    if (res < 0 && (errno == ENOSYS || errno == EPERM)) {
+      // Fall back to word-at-a-time ptrace transfers
+      for (std::size_t i = 0; i < local.size(); ++i) {
+        auto ptr = reinterpret_cast<uintptr_t>(remote[i].iov_base);
+        auto data = static_cast<std::byte *>(local[i].iov_base);
+        auto res = write ? poke_memory(ptr, {data, local[i].iov_len})
+                         : peek_memory(ptr, {data, local[i].iov_len});
+        if (res < 0) {
+          return res;
+        }
+      }
+      return 0;
+    }
+
+    if (res < 0) {
+      return -errno;
+    }
+    if (static_cast<std::size_t>(res) != expected) {
+      return -EFAULT;
+    }
+    return 0;
+  }
+
   std::mutex mutex;
   std::condition_variable cond;
   std::thread worker;
   std::optional<sys::child::run_state> saved_state;
   sys::child child;
   sys::file memfd;
+  // The thread group ids of the replica's live processes
+  std::vector<pid_t> processes;
+
+  // The worker, which traces every task of the replica
+  pthread_t tracer;
+  // Cleared once the worker stops taking results
+  bool tracing = true;
+  std::vector<completion> completed;
+  std::uint64_t posted = 0;
+  std::uint64_t taken = 0;
 };
 
-template <class... Ts>
-struct overloaded : Ts... {
-  using Ts::operator()...;
+// Runs the hooks of one task while the replica has several, so that a task
+// blocked in a simulated syscall does not hold up the others. Only the tracer
+// may use ptrace, so results go back to it to be installed.
+class task_executor {
+public:
+  task_executor(std::shared_ptr<ptrace_runner_handle> handle, replica &replica,
+                pid_t tid, std::shared_ptr<file_descriptor_table> fds)
+      : thread_{[this, handle = std::move(handle), &replica, tid,
+                 fds = std::move(fds)] {
+          current_task = tid;
+          replica::set_task_fd_table(fds.get());
+
+          while (auto job = next_job()) {
+            auto result = job->hook(replica, job->args);
+            // Nothing a hook allocates from the arena outlives it
+            scratch().reset();
+            handle->complete({tid, *job, result});
+          }
+        }} {}
+
+  // Joins the thread, which uses the replica
+  ~task_executor() {
+    stop();
+    thread_.join();
+  }
+
+  void post(const job &job) {
+    std::scoped_lock lock{mutex_};
+    next_ = job;
+    cond_.notify_one();
+  }
+
+  void stop() {
+    std::scoped_lock lock{mutex_};
+    stopping_ = true;
+    cond_.notify_one();
+  }
+
+private:
+  std::optional<job> next_job() {
+    std::unique_lock lock{mutex_};
+    cond_.wait(lock, [this] { return next_ || stopping_; });
+    if (stopping_) {
+      return std::nullopt;
+    }
+    return std::exchange(next_, std::nullopt);
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::optional<job> next_;
+  bool stopping_ = false;
+  // Last, so that it starts once the members above are ready
+  std::thread thread_;
+};
+
+// A thread or process of the replica
+struct task {
+  pid_t tgid;
+  // Shared by the threads of a process
+  std::shared_ptr<file_descriptor_table> fds;
+  // Started once the replica has a second task
+  std::unique_ptr<task_executor> executor;
+  // Until the SIGSTOP every new tracee starts with
+  bool starting = true;
+  // Stopped while its hook runs on the executor
+  bool busy = false;
 };
 
-// explicit deduction guide (not needed as of C++20)
-template <class... Ts>
-overloaded(Ts...) -> overloaded<Ts...>;
+// The seccomp filter is inherited by every thread and child, and a
+// SECCOMP_RET_TRACE without a tracer fails with ENOSYS, so the worker traces
+// them all. It waits for any of them, and runs their hooks itself while the
+// replica has only one task.
+class tracer {
+public:
+  tracer(std::shared_ptr<ptrace_runner_handle> handle, replica &replica)
+      : handle_{std::move(handle)}, replica_{replica} {}
+
+  // A hook blocked on a descriptor returns once it is closed, so closing the
+  // tables of any tasks left lets every executor be joined
+  ~tracer() {
+    {
+      std::scoped_lock lock{handle_->mutex};
+      handle_->tracing = false;
+    }
+    for (auto &[pid, task] : tasks_) {
+      task.fds->close_all();
+    }
+  }
+
+  void run(sys::child &first) {
+    main_pid_ = first.pid();
+    tasks_.emplace(main_pid_, task{.tgid = main_pid_,
+                                   .fds = replica_.initial_fd_table(),
+                                   .executor = nullptr,
+                                   .starting = false,
+                                   .busy = false});
+    {
+      std::scoped_lock lock{handle_->mutex};
+      handle_->processes.push_back(main_pid_);
+    }
+
+    // Runs until the filter stops a syscall, rather than stopping at every
+    // syscall entry and exit
+    sys::ptrace::cont(first);
+
+    while (!tasks_.empty()) {
+      if (0 < busy_) {
+        for (auto &done : handle_->take_completed()) {
+          guard([&] { on_completion(done); });
+        }
+      }
+
+      int status;
+      const pid_t pid = wait(status);
+      if (pid < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::system_error{errno, std::generic_category(),
+                                "waitpid failed"};
+      }
+
+      if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        on_exit(pid, status);
+      } else if (WIFSTOPPED(status)) {
+        guard([&] { on_stop(pid, status); });
+      }
+    }
+  }
+
+private:
+  pid_t wait(int &status) {
+    if (busy_ == 0) {
+      return ::waitpid(-1, &status, __WALL | __WNOTHREAD);
+    }
+
+    // Executors interrupt the wait once a hook returns
+    sigset_t wake;
+    sigemptyset(&wake);
+    sigaddset(&wake, wake_signal);
+    ::pthread_sigmask(SIG_UNBLOCK, &wake, nullptr);
+    const pid_t pid = ::waitpid(-1, &status, __WALL | __WNOTHREAD);
+    const int err = errno;
+    ::pthread_sigmask(SIG_BLOCK, &wake, nullptr);
+    errno = err;
+    return pid;
+  }
+
+  // A task killed while stopped fails every ptrace request with ESRCH, and
+  // its exit is still to come from waitpid
+  template <typename F>
+  static void guard(F &&f) {
+    try {
+      f();
+    } catch (const std::system_error &err) {
+      if (err.code() != std::error_code{ESRCH, std::generic_category()}) {
+        throw;
+      }
+    }
+  }
+
+  void on_stop(pid_t pid, int status) {
+    if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXEC << 8))) {
+      take_over(pid);
+    }
+
+    auto it = tasks_.find(pid);
+    if (it == tasks_.end()) {
+      // A new task can stop before its parent's clone event names it
+      early_.insert(pid);
+      return;
+    }
+    auto &task = it->second;
+
+    sys::child child{pid, sys::child::stopped{WSTOPSIG(status)}};
+    // Delivered when the task resumes, after a signal-delivery-stop
+    int signal = 0;
+
+    switch (status >> 8) {
+    case SIGTRAP | (PTRACE_EVENT_SECCOMP << 8):
+      if (!trap(child, task)) {
+        return;
+      }
+      break;
+    case SIGTRAP | (PTRACE_EVENT_CLONE << 8):
+    case SIGTRAP | (PTRACE_EVENT_FORK << 8):
+    case SIGTRAP | (PTRACE_EVENT_VFORK << 8):
+      add_task(child, task);
+      break;
+    case SIGTRAP | (PTRACE_EVENT_EXEC << 8):
+      // Past the point of no return, so the exec can no longer fail
+      task.fds->close_on_exec();
+      break;
+    default:
+      if (task.starting && WSTOPSIG(status) == SIGSTOP) {
+        task.starting = false;
+      } else if (is_signal_delivery(child, status)) {
+        signal = WSTOPSIG(status);
+      }
+      break;
+    }
+
+    sys::ptrace::cont(child, signal);
+  }
+
+  // Returns whether the task can resume: false while its hook runs on the
+  // executor, or if it died
+  bool trap(sys::child &child, task &task) {
+    sys::ptrace::syscall_info info;
+
+    sys::ptrace::get_syscall_info(child, &info);
+
+    if (info.op != PTRACE_SYSCALL_INFO_SECCOMP) {
+      return true;
+    }
+
+    job job{.hook = hook::get_hook(info.seccomp.nr), .nr = info.seccomp.nr};
+    if (job.hook == nullptr) {
+      return true;
+    }
+    std::ranges::copy(info.seccomp.args, job.args.begin());
+
+    if (tasks_.size() == 1 && busy_ == 0) {
+      current_task = child.pid();
+      replica::set_task_fd_table(task.fds.get());
+
+      auto result = job.hook(replica_, job.args);
+
+      // Nothing a hook allocates from the arena outlives it
+      scratch().reset();
+      return finish(child, job, result);
+    }
+
+    if (!task.executor) {
+      task.executor = std::make_unique<task_executor>(handle_, replica_,
+                                                      child.pid(), task.fds);
+    }
+    task.executor->post(job);
+    task.busy = true;
+    busy_++;
+    return false;
+  }
+
+  // Returns false if the task died before its result was in place
+  bool finish(sys::child &child, const job &job,
+              const hook::hook_result &result) {
+    switch (result.kind) {
+    case redstone::hook::hook_result_kind::handled: {
+      spdlog::trace("simulated {}, result {}",
+                    hook::traced_call{job.nr, job.args},
+                    static_cast<std::int64_t>(result.handled));
+      const pid_t pid = child.pid();
+      if (auto status = replace_syscall_with_result(child, result.handled)) {
+        on_exit(pid, *status);
+        return false;
+      }
+      return true;
+    }
+    case redstone::hook::hook_result_kind::passthrough:
+      return true;
+    }
+    return true;
+  }
+
+  void on_completion(const completion &done) {
+    auto it = tasks_.find(done.tid);
+    if (it == tasks_.end() || !it->second.busy) {
+      return;
+    }
+    it->second.busy = false;
+    busy_--;
+
+    sys::child child{done.tid, sys::child::stopped{SIGTRAP}};
+    if (finish(child, done.job, done.result)) {
+      sys::ptrace::cont(child);
+    }
+  }
+
+  void add_task(sys::child &parent, task &task) {
+    unsigned long msg;
+    parent.ptrace(PTRACE_GETEVENTMSG, nullptr, &msg);
+    const auto tid = static_cast<pid_t>(msg);
+
+    const auto flags = clone_flags(parent);
+    struct task added {
+      .tgid = flags & CLONE_THREAD ? task.tgid : tid,
+      .fds = flags & CLONE_FILES ? task.fds : task.fds->fork(),
+      .executor = nullptr,
+      .starting = true,
+      .busy = false,
+    };
+
+    if (!(flags & CLONE_THREAD)) {
+      std::scoped_lock lock{handle_->mutex};
+      handle_->processes.push_back(tid);
+    }
+
+    if (early_.erase(tid)) {
+      // Its initial stop came first, so it only waits for this
+      added.starting = false;
+      ::ptrace(PTRACE_CONT, tid, 0, 0);
+    }
+    tasks_.insert_or_assign(tid, std::move(added));
+  }
+
+  // The flags of the clone, fork or vfork that `parent` is stopped in
+  static std::uint64_t clone_flags(sys::child &parent) {
+    auto regs = sys::ptrace::get_regs(parent);
+
+    switch (regs.orig_rax) {
+    case SYS_clone:
+      return regs.rdi;
+    case SYS_clone3: {
+      // The flags lead struct clone_args
+      errno = 0;
+      auto flags = ::ptrace(PTRACE_PEEKDATA, parent.pid(), regs.rdi, 0);
+      return errno == 0 ? flags : 0;
+    }
+    default:
+      return 0;
+    }
+  }
+
+  // A thread other than the leader that execs takes over the leader's pid,
+  // and the other threads are gone without a stop
+  void take_over(pid_t pid) {
+    unsigned long former;
+    if (::ptrace(PTRACE_GETEVENTMSG, pid, 0, &former) != 0 ||
+        static_cast<pid_t>(former) == pid) {
+      return;
+    }
+
+    auto node = tasks_.extract(static_cast<pid_t>(former));
+    if (node.empty()) {
+      return;
+    }
+    forget(pid);
+
+    retire(std::move(node.mapped().executor));
+    node.key() = pid;
+    tasks_.insert(std::move(node));
+  }
+
+  void on_exit(pid_t pid, int status) {
+    early_.erase(pid);
+    auto fds = forget(pid);
+    if (!fds) {
+      return;
+    }
+
+    // As in the kernel, the last task using a table closes its fds on exit
+    const bool shared = std::ranges::any_of(
+        tasks_, [&](auto &entry) { return entry.second.fds == fds; });
+    if (!shared) {
+      fds->close_all();
+    }
+
+    if (pid == main_pid_) {
+      std::scoped_lock lock{handle_->mutex};
+      if (WIFEXITED(status)) {
+        handle_->saved_state = sys::child::exited{WEXITSTATUS(status)};
+      } else {
+        handle_->saved_state = sys::child::terminated{WTERMSIG(status)};
+      }
+    }
+  }
+
+  // Drops a task, along with its process if it led one. Returns its fd
+  // table, or null if it was not known.
+  std::shared_ptr<file_descriptor_table> forget(pid_t pid) {
+    auto it = tasks_.find(pid);
+    if (it == tasks_.end()) {
+      return nullptr;
+    }
+
+    auto &task = it->second;
+    if (task.busy) {
+      busy_--;
+    }
+    retire(std::move(task.executor));
+    if (task.tgid == pid) {
+      std::scoped_lock lock{handle_->mutex};
+      std::erase(handle_->processes, pid);
+    }
+
+    auto fds = std::move(task.fds);
+    tasks_.erase(it);
+    return fds;
+  }
+
+  // The hook of a dead task may still be blocked, so its executor is only
+  // joined along with the tracer
+  void retire(std::unique_ptr<task_executor> executor) {
+    if (executor) {
+      executor->stop();
+      retired_.push_back(std::move(executor));
+    }
+  }
+
+  std::shared_ptr<ptrace_runner_handle> handle_;
+  replica &replica_;
+  pid_t main_pid_ = -1;
+  std::unordered_map<pid_t, task> tasks_;
+  // New tasks that stopped before their parent's clone event
+  std::unordered_set<pid_t> early_;
+  // Tasks whose hook runs on their executor
+  std::size_t busy_ = 0;
+  std::vector<std::unique_ptr<task_executor>> retired_;
+};
 
 struct worker_args {
   std::shared_ptr<ptrace_runner_handle> handle;
@@ -308,17 +919,39 @@ struct worker_args {
 };
 
 void ptrace_worker(worker_args args) {
-  int status;
+  machine *machine = args.options->machine;
+  assert(machine);
+
+  static std::once_flag handler_installed;
+  std::call_once(handler_installed, [] {
+    struct sigaction action {};
+    action.sa_handler = [](int) {};
+    // Without SA_RESTART, so that waitpid returns EINTR
+    ::sigaction(wake_signal, &action, nullptr);
+  });
+
+  // Only unblocked while the tracer waits
+  sigset_t wake;
+  sigemptyset(&wake);
+  sigaddset(&wake, wake_signal);
+  ::pthread_sigmask(SIG_BLOCK, &wake, nullptr);
+  args.handle->tracer = ::pthread_self();
+
+  // Built before forking, the child must not allocate
+  const bool trap_stdio =
+      !machine->sim().initial_options().output_path.empty();
+  const auto filter = hook::build_filter(trap_stdio);
 
   auto &child = args.handle->child;
-  child = spawn(*args.options);
+  child = spawn(*args.options, filter);
   args.handle->memfd = sys::proc_mem(child, O_RDWR);
   assert(args.handle->memfd);
 
-  machine *machine = args.options->machine;
-  assert(machine);
-
-  sys::ptrace::set_options(child, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC);
+  sys::ptrace::set_options(child, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC |
+                                      PTRACE_O_TRACESECCOMP |
+                                      PTRACE_O_TRACECLONE |
+                                      PTRACE_O_TRACEFORK |
+                                      PTRACE_O_TRACEVFORK);
 
   args.barrier->wait();
 
@@ -332,37 +965,7 @@ void ptrace_worker(worker_args args) {
     replica = machine->current_replica();
   }
 
-  for (;;) {
-
-    sys::ptrace::syscall(child);
-    child.wait();
-
-    auto state = child.state().value();
-
-    {
-      std::unique_lock lock{args.handle->mutex};
-      args.handle->saved_state = state;
-    }
-
-    auto should_return =
-        std::visit(overloaded{
-                       [](sys::child::running v) { return false; },
-                       [&replica, &child](sys::child::stopped v) {
-                         if (v.signal == (0x80 | SIGTRAP)) {
-                           assert(replica);
-                           handle_trapped(child, *replica);
-                         }
-                         return false;
-                       },
-                       [](sys::child::terminated v) { return true; },
-                       [](sys::child::exited v) { return true; },
-                   },
-                   state);
-
-    if (should_return) {
-      return;
-    }
-  }
+  tracer{args.handle, *replica}.run(child);
 }
 } // namespace
 
@@ -0,0 +1,52 @@
+#include "sim/scratch.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+
+namespace redstone::sim {
+void scratch_arena::reset() {
+  used_ = 0;
+
+  std::size_t total = 0;
+  for (auto &c : chunks_) {
+    total += c.size;
+  }
+
+  // Merge the chunks of a stop that outgrew the first one, so that the next
+  // such stop fits, but give memory back after unusually large ones
+  const bool merge = 1 < chunks_.size() && total <= max_retained;
+  const bool shrink = max_retained < total;
+  if (!merge && !shrink) {
+    return;
+  }
+
+  const auto size = merge ? total : initial_size;
+  chunks_.clear();
+  chunks_.push_back({std::make_unique_for_overwrite<std::byte[]>(size), size});
+}
+
+void *scratch_arena::do_allocate(std::size_t bytes, std::size_t align) {
+  if (!chunks_.empty()) {
+    auto &last = chunks_.back();
+    void *p = last.data.get() + used_;
+    std::size_t space = last.size - used_;
+    if (std::align(align, bytes, p, space)) {
+      used_ = last.size - space + bytes;
+      return p;
+    }
+  }
+
+  // Grow geometrically, so that a large stop needs few chunks
+  const auto size = std::max({initial_size, bytes + align,
+                              chunks_.empty() ? 0 : 2 * chunks_.back().size});
+  chunks_.push_back({std::make_unique_for_overwrite<std::byte[]>(size), size});
+  used_ = 0;
+  return do_allocate(bytes, align);
+}
+
+scratch_arena &scratch() {
+  thread_local scratch_arena arena;
+  return arena;
+}
+} // namespace redstone::sim
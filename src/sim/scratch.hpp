@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace redstone::sim {
+// A bump allocator for the temporaries of one syscall stop. Deallocation is
+// a no-op, and reset() frees everything at once. The memory is kept across
+// resets, so in the steady state a stop makes no allocator calls at all.
+class scratch_arena final : public std::pmr::memory_resource {
+public:
+  scratch_arena() = default;
+
+  scratch_arena(const scratch_arena &) = delete;
+  scratch_arena &operator=(const scratch_arena &) = delete;
+
+  // Invalidates everything allocated since the last reset
+  void reset();
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t align) override;
+  void do_deallocate(void *, std::size_t, std::size_t) override {}
+  bool do_is_equal(const memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+
+  static constexpr std::size_t initial_size = std::size_t{64} << 10;
+  // Arenas that grew past this after an unusually large stop shrink back
+  static constexpr std::size_t max_retained = std::size_t{4} << 20;
+
+  struct chunk {
+    std::unique_ptr<std::byte[]> data;
+    std::size_t size;
+  };
+
+  // Allocation bumps through the last chunk. Outgrowing it adds a bigger
+  // one, and the next reset merges them all into one.
+  std::vector<chunk> chunks_;
+  std::size_t used_ = 0;
+};
+
+// The calling thread's arena. Tracer threads reset theirs after every
+// syscall stop, so hooks, file descriptors and memory transfers may use it
+// for anything that does not outlive the syscall.
+scratch_arena &scratch();
+} // namespace redstone::sim
@@ -1,31 +1,70 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "machine.hpp"
+#include "net/capture.hpp"
 #include "net/fault.hpp"
+#include "net/topology.hpp"
 #include "random/splitmix.hpp"
 #include "random/xoshiro.hpp"
 
 namespace redstone::sim {
 struct options {
   net::net_fault_options net_faults{};
+  net::topology_options topology{};
+  net::buffer_options socket_buffers{};
   double time_scale = 1.0;
   std::uint64_t seed;
+  // Writes all simulated traffic to this pcapng file, if set
+  std::string capture_path;
+  // Captures each machine's stdout and stderr in this directory, if set
+  std::string output_path;
+  // Files under this directory live on each machine's simulated disk, if set
+  std::string disk_root;
 };
 
 class simulator {
 public:
-  explicit simulator(options &&o) : options_{std::move(o)} {
+  explicit simulator(options &&o)
+      : net_{o.seed}, options_{std::move(o)},
+        topology_{options_.net_faults, options_.topology} {
     random::split_mix seed_source{options_.seed};
     rng_.seed_from(seed_source);
+
+    if (!options_.capture_path.empty()) {
+      capture_ = std::make_unique<net::capture>(options_.capture_path);
+    }
+    if (!options_.output_path.empty()) {
+      std::filesystem::create_directories(options_.output_path);
+    }
   }
 
   net::network &net() { return net_; }
 
+  const net::topology &topology() const { return topology_; }
+
+  // Hands out endpoint ids to machines in creation order
+  net::endpoint_id register_machine() { return next_machine_id_++; }
+
+  // Virtual time elapsed since the simulation started
+  std::chrono::nanoseconds elapsed() const {
+    const auto real = clock::now() - start_;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        real / options_.time_scale);
+  }
+
+  // Null unless traffic capture is enabled
+  net::capture *capture() const { return capture_.get(); }
+
   random::xoshiro256_star_star &rng() { return rng_; }
 
   const options &initial_options() const { return options_; }
@@ -35,5 +74,9 @@ private:
   std::vector<machine> machines_;
   net::network net_;
   options options_;
+  net::topology topology_;
+  std::atomic<net::endpoint_id> next_machine_id_ = 0;
+  const clock::time_point start_ = clock::now();
+  std::unique_ptr<net::capture> capture_;
 };
 } // namespace redstone::sim
\ No newline at end of file
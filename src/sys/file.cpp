@@ -58,6 +58,30 @@ std::int64_t file::read_at(std::uint64_t pos, std::span<std::byte> buf) {
   return res;
 }
 
+std::int64_t file::write(std::span<const std::byte> buf) {
+  auto res = ::write(fd_, buf.data(), buf.size_bytes());
+  if (res < 0) {
+    assert(0 < errno);
+    return -errno;
+  }
+  return res;
+}
+
+int file::write_all(std::span<const std::byte> buf) {
+  while (!buf.empty()) {
+    auto res = write(buf);
+    if (res < 0) {
+      if (-res == EINTR || -res == EAGAIN) {
+        continue;
+      }
+      return res;
+    }
+
+    buf = buf.subspan(res);
+  }
+  return 0;
+}
+
 std::int64_t file::write_at(std::uint64_t pos, std::span<const std::byte> buf) {
   auto off = static_cast<off_t>(pos);
   if (off < 0)
@@ -103,6 +127,15 @@ std::int64_t file::write_all_at(std::uint64_t pos,
   return 0;
 }
 
+file open(const char *path, int mode, int prot) {
+  auto res = ::open(path, mode, prot);
+  if (res < 0) {
+    throw std::system_error{errno, std::generic_category(),
+                            fmt::format("open {} failed", path)};
+  }
+  return file{res};
+}
+
 file proc_mem(sys::child &child, int mode) {
   auto path = fmt::format("/proc/{}/mem", child.pid());
   auto res = ::open(path.c_str(), mode, 0666);
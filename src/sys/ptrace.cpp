@@ -21,6 +21,10 @@ void ptrace_child(child &child, enum __ptrace_request req, T addr, U data) {
 
 void syscall(child &c) { ptrace_child(c, PTRACE_SYSCALL, 0, 0); }
 
+void cont(child &c, int signal) {
+  ptrace_child(c, PTRACE_CONT, 0, signal);
+}
+
 user_regs get_regs(child &c) {
   user_regs regs;
   ptrace_child(c, PTRACE_GETREGS, 0, &regs);
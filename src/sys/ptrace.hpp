@@ -38,6 +38,8 @@ struct syscall_info {
 using user_regs = ::user_regs_struct;
 
 void syscall(child &c);
+// Resumes the child, delivering `signal` if it is not 0
+void cont(child &c, int signal = 0);
 user_regs get_regs(child &c);
 void set_regs(child &c, const user_regs &regs);
 void set_options(child &c, int options);